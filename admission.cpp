@@ -0,0 +1,70 @@
+#include "admission.h"
+#include "metrics.h"
+
+static const unsigned long long NO_SAMPLE = ~0ull;
+
+admission *admission::get_instance() {
+    static admission instance;
+    return &instance;
+}
+
+admission::admission() : m_target_ns(0), m_interval_ns(0), m_interval_start(0), m_interval_min(NO_SAMPLE),
+    m_interval_count(0), m_interval_rejected(0), m_drain_count(0), m_overloaded(false), m_rejected(0) {
+}
+
+void admission::init(int target_ms, int interval_ms) {
+    m_target_ns.store((unsigned long long)target_ms * 1000000, std::memory_order_relaxed);
+    m_interval_ns = (unsigned long long)interval_ms * 1000000;
+    m_interval_start.store(metrics::now_ns(), std::memory_order_relaxed);
+}
+
+void admission::set_target(int target_ms) {
+    m_target_ns.store((unsigned long long)target_ms * 1000000, std::memory_order_relaxed);
+    if(target_ms == 0) {
+        m_overloaded.store(false, std::memory_order_relaxed);
+    }
+}
+
+void admission::observe(unsigned long long sojourn_ns) {
+    if(m_target_ns.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    m_interval_count.fetch_add(1, std::memory_order_relaxed);
+    unsigned long long cur = m_interval_min.load(std::memory_order_relaxed);
+    while(sojourn_ns < cur && !m_interval_min.compare_exchange_weak(cur, sojourn_ns, std::memory_order_relaxed)) {
+    }
+    unsigned long long now = metrics::now_ns();
+    if(now - m_interval_start.load(std::memory_order_relaxed) >= m_interval_ns) {
+        end_interval(now);
+    }
+}
+
+// 多个线程同时发现周期结束时只有一个负责结算
+void admission::end_interval(unsigned long long now) {
+    unsigned long long start = m_interval_start.load(std::memory_order_relaxed);
+    if(now - start < m_interval_ns ||
+       !m_interval_start.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+        return;
+    }
+    unsigned long long min = m_interval_min.exchange(NO_SAMPLE, std::memory_order_relaxed);
+    unsigned long long count = m_interval_count.exchange(0, std::memory_order_relaxed);
+    unsigned long long rejected = m_interval_rejected.exchange(0, std::memory_order_relaxed);
+    m_drain_count.store(count, std::memory_order_relaxed);
+    unsigned long long target = m_target_ns.load(std::memory_order_relaxed);
+    bool overloaded = target > 0 && min != NO_SAMPLE && min > target;
+    if(rejected > 0 && m_overloaded.load(std::memory_order_relaxed)) {
+        // 还在拒绝请求，说明到达速度仍超过处理能力
+        overloaded = true;
+    }
+    m_overloaded.store(overloaded, std::memory_order_relaxed);
+}
+
+// 按利特尔法则，新请求的等待时间约为队列长度除以出队速度
+bool admission::admit(int queue_size) {
+    if(!m_overloaded.load(std::memory_order_relaxed) || queue_size == 0) {
+        return true;
+    }
+    unsigned long long drained = m_drain_count.load(std::memory_order_relaxed);
+    return drained > 0 &&
+           (unsigned long long)queue_size * m_interval_ns <= m_target_ns.load(std::memory_order_relaxed) * drained;
+}
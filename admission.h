@@ -0,0 +1,50 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <atomic>
+
+// 过载时的准入控制，按CoDel的思路看请求在线程池队列中的等待时间（sojourn time）：
+// 短暂的突发会自己消化，只有一整个观察周期内最短的等待时间都超过目标值，
+// 说明队列积压不退，才进入过载状态。过载期间按当前队列长度和上一周期的出队速度
+// 估算新请求要等多久，超过目标值的由反应堆直接回复503，不再入队，使接受的请求排队时间
+// 保持在目标值附近；一整个周期既没有拒绝、最短等待时间也不超过目标值时退出过载状态
+class admission {
+public:
+    static admission *get_instance();
+
+    // target_ms为0时不做准入控制
+    void init(int target_ms, int interval_ms);
+    // 重新加载配置时修改目标值，为0时关闭准入控制
+    void set_target(int target_ms);
+
+    // 工作线程从队列取出请求时报告它的等待时间
+    void observe(unsigned long long sojourn_ns);
+    // 反应堆把请求交给线程池之前调用，queue_size为当前队列长度，返回false时应回复503
+    bool admit(int queue_size);
+    bool overloaded() const { return m_overloaded.load(std::memory_order_relaxed); }
+    int target_ms() const { return m_target_ns.load(std::memory_order_relaxed) / 1000000; }
+
+    unsigned long long rejected() const { return m_rejected.load(std::memory_order_relaxed); }
+    void count_rejected() {
+        m_rejected.fetch_add(1, std::memory_order_relaxed);
+        m_interval_rejected.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    admission();
+    void end_interval(unsigned long long now);  // 周期结束，按最短等待时间更新过载状态
+
+private:
+    std::atomic<unsigned long long> m_target_ns;
+    unsigned long long m_interval_ns;
+
+    std::atomic<unsigned long long> m_interval_start;   // 当前观察周期的开始时间
+    std::atomic<unsigned long long> m_interval_min;     // 当前周期内最短的等待时间
+    std::atomic<unsigned long long> m_interval_count;   // 当前周期内出队的请求数
+    std::atomic<unsigned long long> m_interval_rejected;// 当前周期内拒绝的请求数
+    std::atomic<unsigned long long> m_drain_count;      // 上一周期出队的请求数，即出队速度
+    std::atomic<bool> m_overloaded;
+    std::atomic<unsigned long long> m_rejected;         // 回复503的请求和连接数
+};
+
+#endif // ADMISSION_H
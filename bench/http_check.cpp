@@ -0,0 +1,443 @@
+// HTTP行为检查：用原始socket构造压测客户端不会发出的输入，检查服务器的响应，任一项失败时返回非0
+// 编译：g++ -O2 bench/http_check.cpp -o bin/http_check
+// 运行：bin/http_check [-u 路径] host:port [检查项]...，不指定检查项时全部执行
+//   split     请求在每个偏移处分成两次发送（包括紧跟\r之后），中间停顿，同时用另一个连接确认反应堆没有被占住
+//   pipeline  一次写入超过读缓冲区上限的流水线请求，每个请求都应得到响应
+//   upload    请求头和约100KB的请求体一次写入的PUT，服务器需要用-u指定上传目录，否则跳过
+//   head      HEAD的响应与GET的响应头相同（Date、Connection除外）且没有响应体，错误响应同样没有响应体
+//   revalidate  接受压缩时的条件请求：304与200（压缩版本准备好后）的ETag、Vary、Last-Modified相同
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <vector>
+
+static struct sockaddr_storage server_addr;
+static socklen_t server_addrlen;
+static std::string path = "/index.html";
+
+static uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static int connect_server() {
+    int fd = socket(server_addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if(connect(fd, (struct sockaddr *)&server_addr, server_addrlen) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const char *data, size_t len) {
+    while(len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if(n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// 读到对方关闭连接、出错或超时为止，返回收到的全部数据
+static std::string read_until_close(int fd, int timeout_ms) {
+    std::string data;
+    uint64_t deadline = now_ms() + timeout_ms;
+    char buf[65536];
+    while(true) {
+        int left = (int)(deadline - now_ms());
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if(left <= 0 || poll(&pfd, 1, left) != 1) {
+            break;
+        }
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0) {
+            break;
+        }
+        data.append(buf, n);
+    }
+    return data;
+}
+
+// 响应的状态码，没有收到状态行时返回0
+static int status_of(const std::string &resp) {
+    int status = 0;
+    if(sscanf(resp.c_str(), "HTTP/1.1 %d", &status) != 1) {
+        return 0;
+    }
+    return status;
+}
+
+// 一次发送完整请求，返回状态码
+static int request_status(const std::string &req, int timeout_ms) {
+    int fd = connect_server();
+    if(fd < 0) {
+        return 0;
+    }
+    int status = send_all(fd, req.data(), req.size()) ? status_of(read_until_close(fd, timeout_ms)) : 0;
+    close(fd);
+    return status;
+}
+
+// 边发送边接收，避免对方因为响应发不出去而停止读取时双方互相等待，读到对方关闭连接或超时为止
+static std::string exchange(int fd, const std::string &req, int timeout_ms) {
+    std::string data;
+    size_t sent = 0;
+    uint64_t deadline = now_ms() + timeout_ms;
+    char buf[65536];
+    while(true) {
+        int left = (int)(deadline - now_ms());
+        struct pollfd pfd = { fd, (short)(POLLIN | (sent < req.size() ? POLLOUT : 0)), 0 };
+        if(left <= 0 || poll(&pfd, 1, left) != 1) {
+            break;
+        }
+        if(pfd.revents & POLLOUT) {
+            ssize_t n = send(fd, req.data() + sent, req.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if(n < 0 && errno != EAGAIN) {
+                break;
+            }
+            sent += n > 0 ? n : 0;
+        }
+        if(pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+            if(n == 0 || (n < 0 && errno != EAGAIN)) {
+                break;
+            }
+            data.append(buf, n > 0 ? n : 0);
+        }
+    }
+    return data;
+}
+
+// 按Content-Length切分连续的响应，返回完整响应的个数，status_ok统计2xx和304
+static int count_responses(const std::string &data, int *status_ok) {
+    int count = 0;
+    *status_ok = 0;
+    size_t pos = 0;
+    while(pos < data.size()) {
+        size_t head_end = data.find("\r\n\r\n", pos);
+        if(head_end == std::string::npos) {
+            break;
+        }
+        std::string head = data.substr(pos, head_end - pos);
+        size_t length = 0;
+        size_t cl = head.find("Content-Length:");
+        if(cl != std::string::npos) {
+            length = strtoul(head.c_str() + cl + 15, NULL, 10);
+        }
+        if(head_end + 4 + length > data.size()) {
+            break;
+        }
+        int status = status_of(head);
+        if((status >= 200 && status < 300) || status == 304) {
+            ++*status_ok;
+        }
+        ++count;
+        pos = head_end + 4 + length;
+    }
+    return count;
+}
+
+static std::string get_request(const std::string &target, bool keep_alive) {
+    return "GET " + target + " HTTP/1.1\r\nHost: localhost\r\nConnection: " +
+           (keep_alive ? "keep-alive" : "close") + "\r\n\r\n";
+}
+
+static bool check_split() {
+    std::string req = get_request(path, false);
+    int expected = request_status(req, 2000);
+    if(expected == 0) {
+        printf("split: no response to the whole request\n");
+        return false;
+    }
+    int failures = 0;
+    for(size_t off=1; off<req.size(); ++off) {
+        int fd = connect_server();
+        if(fd < 0 || !send_all(fd, req.data(), off)) {
+            printf("split: connect failure\n");
+            return false;
+        }
+        sleep_ms(10);
+        // 前一个连接只发了一部分请求，其他连接仍应得到响应
+        int probe = request_status(req, 2000);
+        int status = 0;
+        if(send_all(fd, req.data() + off, req.size() - off)) {
+            status = status_of(read_until_close(fd, 2000));
+        }
+        close(fd);
+        if(status != expected || probe != expected) {
+            printf("split at %d (after %s): status %d, concurrent request %d, expected %d\n", (int)off,
+                   req[off-1] == '\r' ? "\\r" : req[off-1] == '\n' ? "\\n" : "text", status, probe, expected);
+            ++failures;
+        }
+    }
+    printf("split: %d offsets, %d failures\n", (int)req.size() - 1, failures);
+    return failures == 0;
+}
+
+static bool check_pipeline() {
+    // 约3000个请求，远超读缓冲区上限，最后一个请求关闭连接
+    const int count = 3000;
+    std::string req;
+    for(int i=0; i<count; ++i) {
+        req += get_request(path, i + 1 < count);
+    }
+    int fd = connect_server();
+    if(fd < 0) {
+        printf("pipeline: connect failure\n");
+        return false;
+    }
+    int ok = 0;
+    int responses = count_responses(exchange(fd, req, 10000), &ok);
+    close(fd);
+    printf("pipeline: %d requests (%d bytes), %d responses, %d successful\n", count, (int)req.size(), responses, ok);
+    return responses == count && ok == count;
+}
+
+static bool check_upload() {
+    // 请求头和请求体由同一次写入发出，请求体超过读缓冲区上限；后面再跟一个流水线请求
+    std::string body(100 * 1024, 'x');
+    for(size_t i=0; i<body.size(); i+=64) {
+        body[i] = '\n';
+    }
+    char head[256];
+    snprintf(head, sizeof(head), "PUT /http_check_upload.txt HTTP/1.1\r\nHost: localhost\r\n"
+             "Content-Length: %d\r\nConnection: keep-alive\r\n\r\n", (int)body.size());
+    std::string req = head + body + get_request(path, false);
+    int fd = connect_server();
+    if(fd < 0) {
+        printf("upload: connect failure\n");
+        return false;
+    }
+    std::string data = exchange(fd, req, 10000);
+    close(fd);
+    int status = status_of(data);
+    if(status == 403 || status == 405) {
+        printf("upload: status %d, server has no upload directory, skipped\n", status);
+        return true;
+    }
+    int ok = 0;
+    int responses = count_responses(data, &ok);
+    printf("upload: %d bytes in one write, status %d, %d responses, %d successful\n", (int)req.size(), status,
+           responses, ok);
+    return status == 201 && responses == 2 && ok == 2;
+}
+
+// 去掉随时间和连接变化的Date、Connection行，比较同一资源的两次响应头
+static std::string comparable(const std::string &head) {
+    std::string s = head + "\r\n";
+    const char *names[] = { "\r\nDate:", "\r\nConnection:" };
+    for(size_t i=0; i<sizeof(names) / sizeof(names[0]); ++i) {
+        size_t pos = s.find(names[i]);
+        if(pos != std::string::npos) {
+            s.erase(pos, s.find("\r\n", pos + 2) - pos);
+        }
+    }
+    return s;
+}
+
+static bool check_head() {
+    std::string target = path;
+    std::string req = "HEAD " + target + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n"
+                      "HEAD /http_check_missing HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n" +
+                      get_request(target, false);
+    int fd = connect_server();
+    if(fd < 0) {
+        printf("head: connect failure\n");
+        return false;
+    }
+    std::string data = exchange(fd, req, 2000);
+    close(fd);
+    // HEAD的响应在空行处结束，下一个响应紧接其后
+    size_t end1 = data.find("\r\n\r\n");
+    size_t end2 = end1 == std::string::npos ? end1 : data.find("\r\n\r\n", end1 + 4);
+    size_t end3 = end2 == std::string::npos ? end2 : data.find("\r\n\r\n", end2 + 4);
+    if(end3 == std::string::npos) {
+        printf("head: incomplete responses (%d bytes)\n", (int)data.size());
+        return false;
+    }
+    std::string head = data.substr(0, end1);
+    std::string missing = data.substr(end1 + 4, end2 - end1 - 4);
+    std::string get = data.substr(end2 + 4, end3 - end2 - 4);
+    size_t length = 0;
+    size_t cl = get.find("Content-Length:");
+    if(cl != std::string::npos) {
+        length = strtoul(get.c_str() + cl + 15, NULL, 10);
+    }
+    bool ok = true;
+    if(status_of(head) != status_of(get) || comparable(head) != comparable(get)) {
+        printf("head: HEAD and GET headers differ\n%s\n--\n%s\n", head.c_str(), get.c_str());
+        ok = false;
+    }
+    if(status_of(missing) != 404) {
+        printf("head: HEAD of a missing file: status %d, expected 404 without a body\n", status_of(missing));
+        ok = false;
+    }
+    if(data.size() != end3 + 4 + length) {
+        printf("head: %d bytes after the responses\n", (int)(data.size() - end3 - 4 - length));
+        ok = false;
+    }
+    printf("head: status %d, GET body %d bytes\n", status_of(head), (int)length);
+    return ok;
+}
+
+// 响应头中某个字段的值，没有时返回空串
+static std::string header_value(const std::string &head, const char *name) {
+    std::string key = std::string("\r\n") + name + ": ";
+    size_t pos = head.find(key);
+    if(pos == std::string::npos) {
+        return "";
+    }
+    pos += key.size();
+    return head.substr(pos, head.find("\r\n", pos) - pos);
+}
+
+static std::string fetch_head(const std::string &extra) {
+    int fd = connect_server();
+    if(fd < 0) {
+        return "";
+    }
+    std::string req = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\nAccept-Encoding: gzip, br\r\n" + extra +
+                      "Connection: close\r\n\r\n";
+    std::string data = send_all(fd, req.data(), req.size()) ? read_until_close(fd, 2000) : "";
+    close(fd);
+    return data.substr(0, data.find("\r\n\r\n") + 2);
+}
+
+static bool check_revalidate() {
+    // 压缩版本在后台准备，第一次请求只触发压缩
+    std::string full;
+    for(int i=0; i<20; ++i) {
+        full = fetch_head("");
+        if(status_of(full) != 200 || !header_value(full, "Content-Encoding").empty()) {
+            break;
+        }
+        sleep_ms(50);
+    }
+    if(status_of(full) != 200) {
+        printf("revalidate: status %d for %s\n", status_of(full), path.c_str());
+        return false;
+    }
+    const char *fields[] = { "ETag", "Vary", "Last-Modified", "Accept-Ranges" };
+    std::string conditions[] = { "If-None-Match: " + header_value(full, "ETag") + "\r\n",
+                                 "If-Modified-Since: " + header_value(full, "Last-Modified") + "\r\n" };
+    bool ok = true;
+    for(int i=0; i<2; ++i) {
+        std::string head = fetch_head(conditions[i]);
+        if(status_of(head) != 304) {
+            printf("revalidate: %sstatus %d, expected 304\n", conditions[i].c_str(), status_of(head));
+            ok = false;
+            continue;
+        }
+        for(size_t k=0; k<sizeof(fields) / sizeof(fields[0]); ++k) {
+            if(header_value(head, fields[k]) != header_value(full, fields[k])) {
+                printf("revalidate: %s%s: 200 has \"%s\", 304 has \"%s\"\n", conditions[i].c_str(), fields[k],
+                       header_value(full, fields[k]).c_str(), header_value(head, fields[k]).c_str());
+                ok = false;
+            }
+        }
+    }
+    std::string encoding = header_value(full, "Content-Encoding");
+    printf("revalidate: 200 %s with ETag %s\n", encoding.empty() ? "identity" : encoding.c_str(),
+           header_value(full, "ETag").c_str());
+    return ok;
+}
+
+struct check {
+    const char *m_name;
+    bool (*m_func)();
+};
+
+static const check checks[] = {
+    { "split", check_split },
+    { "pipeline", check_pipeline },
+    { "upload", check_upload },
+    { "head", check_head },
+    { "revalidate", check_revalidate },
+};
+static const int CHECK_NUMBER = sizeof(checks) / sizeof(checks[0]);
+
+static bool parse_target(const char *target) {
+    const char *colon = strrchr(target, ':');
+    if(!colon) {
+        return false;
+    }
+    std::string host(target, colon - target);
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host.c_str(), colon + 1, &hints, &res) != 0) {
+        return false;
+    }
+    memcpy(&server_addr, res->ai_addr, res->ai_addrlen);
+    server_addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while((opt = getopt(argc, argv, "u:")) != -1) {
+        if(opt == 'u') {
+            path = optarg;
+        } else {
+            optind = argc;
+            break;
+        }
+    }
+    if(optind >= argc || !parse_target(argv[optind])) {
+        printf("按照以下格式运行：%s [-u path] host:port [", argv[0]);
+        for(int i=0; i<CHECK_NUMBER; ++i) {
+            printf("%s%s", i ? "|" : "", checks[i].m_name);
+        }
+        printf("]...\n");
+        return -1;
+    }
+    std::vector<const check *> selected;
+    for(int i=optind+1; i<argc; ++i) {
+        int k = 0;
+        while(k < CHECK_NUMBER && strcmp(argv[i], checks[k].m_name) != 0) {
+            ++k;
+        }
+        if(k == CHECK_NUMBER) {
+            printf("unknown check %s\n", argv[i]);
+            return -1;
+        }
+        selected.push_back(&checks[k]);
+    }
+    if(selected.empty()) {
+        for(int i=0; i<CHECK_NUMBER; ++i) {
+            selected.push_back(&checks[i]);
+        }
+    }
+    int failed = 0;
+    for(size_t i=0; i<selected.size(); ++i) {
+        bool ok = selected[i]->m_func();
+        printf("%-10s %s\n", selected[i]->m_name, ok ? "PASS" : "FAIL");
+        failed += !ok;
+    }
+    return failed == 0 ? 0 : 1;
+}
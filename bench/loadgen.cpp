@@ -0,0 +1,527 @@
+// HTTP压测客户端：多线程，每个线程一个epoll，支持长连接、流水线深度、恒定速率开环模式和按权重的URL混合
+// 编译：g++ -O2 bench/loadgen.cpp -pthread -o bin/loadgen
+// 运行：bin/loadgen [-t 线程数] [-c 连接数] [-d 秒数] [-p 流水线深度] [-R 每秒请求数] [-k 0|1]
+//                   [-u 路径[@权重]]... host:port
+// 不指定-R时为闭环模式：每个连接始终保持p个未完成的请求，延迟从实际发送算起；
+// 指定-R时为开环模式：按固定间隔安排请求，延迟从计划发送时间算起，服务器变慢导致的排队也计入延迟，
+// 避免协调遗漏（coordinated omission）
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+#include "../histogram.h"
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+struct url_entry {
+    std::string m_path;
+    int m_weight;
+    std::string m_request;      // 预先生成的请求报文
+};
+
+struct options {
+    int m_threads;
+    int m_conns;
+    double m_seconds;
+    int m_depth;
+    double m_rate;              // 0表示闭环
+    bool m_keep_alive;
+    struct sockaddr_storage m_addr;
+    socklen_t m_addr_len;
+    std::vector<url_entry> m_urls;
+    int m_total_weight;
+};
+
+struct connection {
+    int m_fd;
+    bool m_connected;
+    std::deque<uint64_t> m_inflight;    // 每个未完成请求的起始时间
+    std::string m_out;                  // 待发送的请求
+    size_t m_out_off;
+    bool m_want_write;
+    // 响应解析状态
+    std::string m_in;
+    bool m_in_body;
+    long long m_body_left;
+    int m_status;
+    bool m_close;
+};
+
+struct worker {
+    pthread_t m_thread;
+    int m_id;
+    const options *m_opts;
+    int m_epollfd;
+    int m_timerfd;                      // 开环模式下在下一个计划时间唤醒，不忙等
+    std::vector<connection> m_conns;
+    std::deque<uint64_t> m_backlog;     // 开环模式下已到计划时间、但没有空闲连接的请求
+    uint64_t m_rand;
+    uint64_t m_start;
+    uint64_t m_end;
+
+    histogram m_hist;
+    uint64_t m_requests;
+    uint64_t m_errors;
+    uint64_t m_bytes;
+    uint64_t m_status[6];               // 按状态码的百位计数
+    uint64_t m_reconnects;
+};
+
+static uint64_t next_rand(uint64_t &s) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+static const std::string &pick_request(worker &w) {
+    const options &o = *w.m_opts;
+    if(o.m_urls.size() == 1) {
+        return o.m_urls[0].m_request;
+    }
+    int r = (int)(next_rand(w.m_rand) % o.m_total_weight);
+    for(size_t i=0; i<o.m_urls.size(); ++i) {
+        r -= o.m_urls[i].m_weight;
+        if(r < 0) {
+            return o.m_urls[i].m_request;
+        }
+    }
+    return o.m_urls.back().m_request;
+}
+
+static void update_events(worker &w, connection &c) {
+    struct epoll_event ev;
+    ev.data.ptr = &c;
+    ev.events = EPOLLIN | (c.m_want_write ? EPOLLOUT : 0);
+    epoll_ctl(w.m_epollfd, EPOLL_CTL_MOD, c.m_fd, &ev);
+}
+
+static bool open_conn(worker &w, connection &c) {
+    const options &o = *w.m_opts;
+    c.m_fd = socket(o.m_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(c.m_fd < 0) {
+        return false;
+    }
+    int one = 1;
+    setsockopt(c.m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c.m_connected = false;
+    c.m_inflight.clear();
+    c.m_out.clear();
+    c.m_out_off = 0;
+    c.m_in.clear();
+    c.m_in_body = false;
+    c.m_body_left = 0;
+    c.m_close = false;
+    if(connect(c.m_fd, (struct sockaddr *)&o.m_addr, o.m_addr_len) < 0 && errno != EINPROGRESS) {
+        close(c.m_fd);
+        c.m_fd = -1;
+        return false;
+    }
+    // 连接完成时可写
+    c.m_want_write = true;
+    struct epoll_event ev;
+    ev.data.ptr = &c;
+    ev.events = EPOLLIN | EPOLLOUT;
+    epoll_ctl(w.m_epollfd, EPOLL_CTL_ADD, c.m_fd, &ev);
+    return true;
+}
+
+// 关闭连接并重连，未完成的请求记为错误
+static void reset_conn(worker &w, connection &c, bool error) {
+    if(error) {
+        w.m_errors += c.m_inflight.size();
+    }
+    if(c.m_fd >= 0) {
+        epoll_ctl(w.m_epollfd, EPOLL_CTL_DEL, c.m_fd, NULL);
+        close(c.m_fd);
+        c.m_fd = -1;
+    }
+    ++w.m_reconnects;
+    open_conn(w, c);
+}
+
+static bool flush_conn(worker &w, connection &c) {
+    while(c.m_out_off < c.m_out.size()) {
+        ssize_t n = send(c.m_fd, c.m_out.data() + c.m_out_off, c.m_out.size() - c.m_out_off, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno == EAGAIN) {
+                break;
+            }
+            return false;
+        }
+        c.m_out_off += n;
+    }
+    if(c.m_out_off == c.m_out.size()) {
+        c.m_out.clear();
+        c.m_out_off = 0;
+    }
+    bool want = !c.m_out.empty();
+    if(want != c.m_want_write) {
+        c.m_want_write = want;
+        update_events(w, c);
+    }
+    return true;
+}
+
+static void enqueue_request(worker &w, connection &c, uint64_t start) {
+    c.m_out += pick_request(w);
+    c.m_inflight.push_back(start);
+}
+
+// 闭环模式：把连接的未完成请求补足到流水线深度
+static void fill_closed(worker &w, connection &c) {
+    if(!c.m_connected) {
+        return;
+    }
+    int depth = w.m_opts->m_keep_alive ? w.m_opts->m_depth : 1;
+    bool added = false;
+    while((int)c.m_inflight.size() < depth) {
+        enqueue_request(w, c, now_ns());
+        added = true;
+    }
+    if(added && !flush_conn(w, c)) {
+        reset_conn(w, c, true);
+    }
+}
+
+// 开环模式：把积压的请求分给有空位的连接
+static void dispatch_backlog(worker &w) {
+    int depth = w.m_opts->m_keep_alive ? w.m_opts->m_depth : 1;
+    for(size_t i=0; i<w.m_conns.size() && !w.m_backlog.empty(); ++i) {
+        connection &c = w.m_conns[i];
+        if(!c.m_connected) {
+            continue;
+        }
+        bool added = false;
+        while((int)c.m_inflight.size() < depth && !w.m_backlog.empty()) {
+            enqueue_request(w, c, w.m_backlog.front());
+            w.m_backlog.pop_front();
+            added = true;
+        }
+        if(added && !flush_conn(w, c)) {
+            reset_conn(w, c, true);
+        }
+    }
+}
+
+// 解析收到的响应，返回false表示连接需要关闭
+static bool parse_responses(worker &w, connection &c) {
+    size_t pos = 0;
+    while(pos < c.m_in.size()) {
+        if(c.m_in_body) {
+            long long n = (long long)(c.m_in.size() - pos);
+            if(n > c.m_body_left) {
+                n = c.m_body_left;
+            }
+            c.m_body_left -= n;
+            pos += n;
+            if(c.m_body_left > 0) {
+                break;
+            }
+            // 一个响应完成
+            c.m_in_body = false;
+            uint64_t now = now_ns();
+            if(!c.m_inflight.empty()) {
+                uint64_t start = c.m_inflight.front();
+                c.m_inflight.pop_front();
+                if(now <= w.m_end) {
+                    w.m_hist.record(now - start);
+                    ++w.m_requests;
+                    int cls = c.m_status / 100;
+                    ++w.m_status[cls >= 1 && cls <= 5 ? cls : 0];
+                }
+            }
+            if(c.m_close) {
+                c.m_in.erase(0, pos);
+                return false;
+            }
+            continue;
+        }
+
+        size_t end = c.m_in.find("\r\n\r\n", pos);
+        if(end == std::string::npos) {
+            break;
+        }
+        // 状态行和需要的字段
+        const char *head = c.m_in.c_str() + pos;
+        c.m_status = strncmp(head, "HTTP/1.", 7) == 0 ? atoi(head + 9) : 0;
+        c.m_body_left = 0;
+        c.m_close = !w.m_opts->m_keep_alive;
+        for(size_t line = c.m_in.find("\r\n", pos) + 2; line < end; ) {
+            size_t next = c.m_in.find("\r\n", line);
+            const char *p = c.m_in.c_str() + line;
+            if(strncasecmp(p, "Content-Length:", 15) == 0) {
+                c.m_body_left = atoll(p + 15);
+            } else if(strncasecmp(p, "Connection:", 11) == 0 && strncasecmp(p + 11 + strspn(p + 11, " "), "close", 5) == 0) {
+                c.m_close = true;
+            }
+            line = next + 2;
+        }
+        w.m_bytes += end + 4 - pos + c.m_body_left;
+        pos = end + 4;
+        c.m_in_body = true;
+    }
+    c.m_in.erase(0, pos);
+    return true;
+}
+
+static void handle_event(worker &w, connection &c, uint32_t events) {
+    if(events & (EPOLLERR | EPOLLHUP)) {
+        reset_conn(w, c, true);
+        return;
+    }
+    if(!c.m_connected && (events & EPOLLOUT)) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c.m_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if(err) {
+            reset_conn(w, c, true);
+            return;
+        }
+        c.m_connected = true;
+        c.m_want_write = false;
+        update_events(w, c);
+    }
+    if(events & EPOLLOUT) {
+        if(!flush_conn(w, c)) {
+            reset_conn(w, c, true);
+            return;
+        }
+    }
+    if(events & EPOLLIN) {
+        char buf[65536];
+        bool eof = false;
+        while(true) {
+            ssize_t n = recv(c.m_fd, buf, sizeof(buf), 0);
+            if(n > 0) {
+                c.m_in.append(buf, n);
+                continue;
+            }
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            eof = n == 0 || errno != EAGAIN;
+            break;
+        }
+        if(!parse_responses(w, c)) {
+            // 服务器要求关闭，剩余的流水线请求记为错误
+            reset_conn(w, c, true);
+            return;
+        }
+        if(eof) {
+            reset_conn(w, c, true);
+            return;
+        }
+    }
+}
+
+static void *run_worker(void *arg) {
+    worker &w = *(worker *)arg;
+    const options &o = *w.m_opts;
+    w.m_epollfd = epoll_create1(0);
+    for(size_t i=0; i<w.m_conns.size(); ++i) {
+        open_conn(w, w.m_conns[i]);
+    }
+
+    // 开环模式下每个线程承担1/threads的速率，各线程的计划时间错开
+    uint64_t interval = o.m_rate > 0 ? (uint64_t)(1e9 * o.m_threads / o.m_rate) : 0;
+    uint64_t next_send = w.m_start + (interval * w.m_id) / o.m_threads;
+    w.m_timerfd = -1;
+    if(interval) {
+        w.m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        struct epoll_event ev;
+        ev.data.ptr = NULL;
+        ev.events = EPOLLIN;
+        epoll_ctl(w.m_epollfd, EPOLL_CTL_ADD, w.m_timerfd, &ev);
+    }
+
+    struct epoll_event events[256];
+    while(true) {
+        uint64_t now = now_ns();
+        if(now >= w.m_end) {
+            break;
+        }
+        int timeout = 100;
+        if(interval) {
+            // 把已到计划时间的请求放入积压队列，计划时间即延迟的起点
+            for(; next_send <= now; next_send += interval) {
+                w.m_backlog.push_back(next_send);
+            }
+            dispatch_backlog(w);
+            // 毫秒级的epoll超时不够精确，改用绝对时间的timerfd
+            struct itimerspec its;
+            memset(&its, 0, sizeof(its));
+            its.it_value.tv_sec = next_send / 1000000000ull;
+            its.it_value.tv_nsec = next_send % 1000000000ull;
+            timerfd_settime(w.m_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+        } else {
+            for(size_t i=0; i<w.m_conns.size(); ++i) {
+                fill_closed(w, w.m_conns[i]);
+            }
+        }
+        int n = epoll_wait(w.m_epollfd, events, 256, timeout);
+        for(int i=0; i<n; ++i) {
+            if(!events[i].data.ptr) {
+                uint64_t expirations;
+                ssize_t ret = read(w.m_timerfd, &expirations, sizeof(expirations));
+                (void)ret;
+                continue;
+            }
+            handle_event(w, *(connection *)events[i].data.ptr, events[i].events);
+        }
+    }
+    for(size_t i=0; i<w.m_conns.size(); ++i) {
+        if(w.m_conns[i].m_fd >= 0) {
+            close(w.m_conns[i].m_fd);
+        }
+    }
+    if(w.m_timerfd >= 0) {
+        close(w.m_timerfd);
+    }
+    close(w.m_epollfd);
+    return NULL;
+}
+
+static bool parse_target(const char *target, options &o) {
+    std::string s(target);
+    size_t colon = s.rfind(':');
+    if(colon == std::string::npos) {
+        return false;
+    }
+    std::string host = s.substr(0, colon);
+    std::string port = s.substr(colon + 1);
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+        return false;
+    }
+    memcpy(&o.m_addr, res->ai_addr, res->ai_addrlen);
+    o.m_addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    options o;
+    o.m_threads = 2;
+    o.m_conns = 64;
+    o.m_seconds = 10;
+    o.m_depth = 1;
+    o.m_rate = 0;
+    o.m_keep_alive = true;
+    o.m_total_weight = 0;
+    std::vector<std::string> urls;
+    int opt;
+    while((opt = getopt(argc, argv, "t:c:d:p:R:k:u:")) != -1) {
+        switch(opt) {
+            case 't': o.m_threads = atoi(optarg); break;
+            case 'c': o.m_conns = atoi(optarg); break;
+            case 'd': o.m_seconds = atof(optarg); break;
+            case 'p': o.m_depth = atoi(optarg); break;
+            case 'R': o.m_rate = atof(optarg); break;
+            case 'k': o.m_keep_alive = atoi(optarg) != 0; break;
+            case 'u': urls.push_back(optarg); break;
+            default: break;
+        }
+    }
+    if(optind >= argc || o.m_threads <= 0 || o.m_conns < o.m_threads || o.m_seconds <= 0 || o.m_depth <= 0 ||
+       !parse_target(argv[optind], o)) {
+        printf("按照以下格式运行：%s [-t threads] [-c connections] [-d seconds] [-p pipeline_depth] [-R rate] "
+               "[-k 0|1] [-u path[@weight]]... host:port\n", argv[0]);
+        return -1;
+    }
+    if(urls.empty()) {
+        urls.push_back("/index.html");
+    }
+    for(size_t i=0; i<urls.size(); ++i) {
+        url_entry u;
+        size_t at = urls[i].find('@');
+        u.m_path = urls[i].substr(0, at);
+        u.m_weight = at == std::string::npos ? 1 : atoi(urls[i].c_str() + at + 1);
+        if(u.m_weight <= 0) {
+            u.m_weight = 1;
+        }
+        u.m_request = "GET " + u.m_path + " HTTP/1.1\r\nHost: " + argv[optind] + "\r\nConnection: " +
+                      (o.m_keep_alive ? "keep-alive" : "close") + "\r\n\r\n";
+        o.m_total_weight += u.m_weight;
+        o.m_urls.push_back(u);
+    }
+
+    std::vector<worker *> workers;
+    uint64_t start = now_ns() + 50 * 1000000ull;    // 留出连接建立的时间
+    uint64_t end = start + (uint64_t)(o.m_seconds * 1e9);
+    for(int i=0; i<o.m_threads; ++i) {
+        worker *w = new worker();
+        w->m_id = i;
+        w->m_opts = &o;
+        w->m_conns.resize(o.m_conns / o.m_threads + (i < o.m_conns % o.m_threads ? 1 : 0));
+        w->m_rand = 0x9E3779B97F4A7C15ull * (i + 1);
+        w->m_start = start;
+        w->m_end = end;
+        w->m_requests = w->m_errors = w->m_bytes = w->m_reconnects = 0;
+        memset(w->m_status, 0, sizeof(w->m_status));
+        for(size_t j=0; j<w->m_conns.size(); ++j) {
+            w->m_conns[j].m_fd = -1;
+        }
+        workers.push_back(w);
+        pthread_create(&w->m_thread, NULL, run_worker, w);
+    }
+
+    histogram total;
+    uint64_t requests = 0, errors = 0, bytes = 0, reconnects = 0, backlog = 0;
+    uint64_t status[6] = { 0 };
+    for(size_t i=0; i<workers.size(); ++i) {
+        worker *w = workers[i];
+        pthread_join(w->m_thread, NULL);
+        total.merge(w->m_hist);
+        requests += w->m_requests;
+        errors += w->m_errors;
+        bytes += w->m_bytes;
+        reconnects += w->m_reconnects;
+        backlog += w->m_backlog.size();
+        for(int j=0; j<6; ++j) {
+            status[j] += w->m_status[j];
+        }
+        delete w;
+    }
+
+    printf("mode=%s threads=%d connections=%d depth=%d keep_alive=%d duration=%.1fs",
+           o.m_rate > 0 ? "open" : "closed", o.m_threads, o.m_conns, o.m_depth, (int)o.m_keep_alive, o.m_seconds);
+    if(o.m_rate > 0) {
+        printf(" target_rate=%.0f", o.m_rate);
+    }
+    printf("\n");
+    printf("requests=%llu errors=%llu reconnects=%llu unsent=%llu\n", (unsigned long long)requests,
+           (unsigned long long)errors, (unsigned long long)reconnects, (unsigned long long)backlog);
+    printf("status 2xx=%llu 3xx=%llu 4xx=%llu 5xx=%llu other=%llu\n", (unsigned long long)status[2],
+           (unsigned long long)status[3], (unsigned long long)status[4], (unsigned long long)status[5],
+           (unsigned long long)(status[0] + status[1]));
+    printf("throughput=%.0f req/s %.2f MB/s\n", requests / o.m_seconds, bytes / o.m_seconds / 1e6);
+    printf("latency(us) p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n", total.percentile(50) / 1e3,
+           total.percentile(90) / 1e3, total.percentile(99) / 1e3, total.percentile(99.9) / 1e3, total.m_max / 1e3);
+    return 0;
+}
@@ -0,0 +1,277 @@
+// 请求解析基准测试：对比逐字节扫描+strpbrk+strncasecmp与向量扫描+完美哈希识别字段名，
+// 再用http_conn的解析状态机（不经socket）测量典型请求、大量请求头和逐字节到达三种输入
+// 编译：g++ -O2 bench/parser_bench.cpp $(ls *.cpp | grep -v main.cpp) -pthread -lz -o bin/parser_bench
+// 运行：bin/parser_bench [请求文件]，默认使用仓库中的http_request样例（浏览器的真实请求头）
+// 输出每种实现解析一个请求的平均耗时（ns/request）和每字节的周期数（cycles/byte，仅x86）
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../http_scanner.h"
+#include "../http_conn.h"
+
+static const int ITERATIONS = 2000000;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 时间戳计数器，非x86上返回0，不输出cycles/byte
+static uint64_t now_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void report(const char *name, uint64_t elapsed_ns, uint64_t cycles, int iterations, size_t bytes) {
+    printf("%-24s %10.1f ns/request", name, (double)elapsed_ns / iterations);
+    if(cycles > 0) {
+        printf(" %8.2f cycles/byte", (double)cycles / iterations / bytes);
+    }
+}
+
+// 读取请求文件，行结束符统一为\r\n，末尾补一个空行
+static std::string load_request(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if(!fp) {
+        return "";
+    }
+    std::string req;
+    char line[4096];
+    while(fgets(line, sizeof(line), fp)) {
+        size_t len = strcspn(line, "\r\n");
+        if(len == 0) {
+            break;
+        }
+        req.append(line, len);
+        req.append("\r\n");
+    }
+    fclose(fp);
+    req.append("\r\n");
+    return req;
+}
+
+// 解析结果，防止被编译器优化掉
+struct parse_result {
+    const char *m_url;
+    const char *m_host;
+    bool m_linger;
+    int m_headers;
+};
+
+// 改动前的做法：逐字节找行结束符，strpbrk切分请求首行，strncasecmp依次比较字段名
+static bool parse_baseline(char *buf, int len, parse_result &r) {
+    int start = 0;
+    bool first = true;
+    for(int i=0; i<len; ++i) {
+        if(buf[i] != '\r') {
+            continue;
+        }
+        buf[i] = buf[i+1] = '\0';
+        char *text = buf + start;
+        start = i + 2;
+        ++i;
+        if(first) {
+            char *url = strpbrk(text, " \t");
+            if(!url) {
+                return false;
+            }
+            *url++ = '\0';
+            char *version = strpbrk(url, " \t");
+            if(!version) {
+                return false;
+            }
+            *version++ = '\0';
+            r.m_url = url;
+            first = false;
+        } else if(text[0] == '\0') {
+            return true;
+        } else if(strncasecmp(text, "Host:", 5) == 0) {
+            r.m_host = text + 5 + strspn(text + 5, " \t");
+        } else if(strncasecmp(text, "Connection:", 11) == 0) {
+            r.m_linger = strcasecmp(text + 11 + strspn(text + 11, " \t"), "keep-alive") == 0;
+        } else if(strncasecmp(text, "Content-Length:", 15) == 0) {
+            ++r.m_headers;
+        } else {
+            ++r.m_headers;
+        }
+    }
+    return false;
+}
+
+// 与http_conn相同的做法：向量扫描行结束符和分隔符，完美哈希识别字段名
+static bool parse_scanner(char *buf, int len, parse_result &r) {
+    char *p = buf;
+    char *end = buf + len;
+    bool first = true;
+    while(p < end) {
+        char *eol = (char *)http_scanner::find_line_end(p, end);
+        if(eol + 1 >= end || eol[1] != '\n') {
+            return false;
+        }
+        eol[0] = eol[1] = '\0';
+        char *text = p;
+        p = eol + 2;
+        if(first) {
+            char *url = (char *)http_scanner::find_space(text, eol);
+            if(url == eol) {
+                return false;
+            }
+            *url++ = '\0';
+            char *version = (char *)http_scanner::find_space(url, eol);
+            if(version == eol) {
+                return false;
+            }
+            *version++ = '\0';
+            r.m_url = url;
+            first = false;
+            continue;
+        }
+        if(text == eol) {
+            return true;
+        }
+        char *colon = (char *)http_scanner::find_colon(text, eol);
+        HEADER_NAME name = colon == eol ? HEADER_UNKNOWN : http_scanner::classify_header(text, colon - text);
+        char *value = colon + 1 + strspn(colon + 1, " \t");
+        switch(name) {
+            case HEADER_HOST:
+                r.m_host = value;
+                break;
+            case HEADER_CONNECTION:
+                r.m_linger = strcasecmp(value, "keep-alive") == 0;
+                break;
+            default:
+                ++r.m_headers;
+                break;
+        }
+    }
+    return false;
+}
+
+template <typename F>
+static void run(const char *name, F parse, const std::string &req) {
+    char *buf = new char[req.size()];
+    parse_result r;
+    memset(&r, 0, sizeof(r));
+    uint64_t headers = 0;
+    uint64_t begin = now_ns();
+    uint64_t begin_cycles = now_cycles();
+    for(int i=0; i<ITERATIONS; ++i) {
+        // 解析会写入\0，每次先恢复原始请求
+        memcpy(buf, req.data(), req.size());
+        if(!parse(buf, (int)req.size(), r)) {
+            printf("%s: parse failure\n", name);
+            break;
+        }
+        headers += r.m_headers;
+        r.m_headers = 0;
+    }
+    uint64_t cycles = now_cycles() - begin_cycles;
+    report(name, now_ns() - begin, cycles, ITERATIONS, req.size());
+    printf("  (%llu headers, keep-alive=%d)\n", (unsigned long long)headers / ITERATIONS, (int)r.m_linger);
+    delete[] buf;
+}
+
+// http_conn的解析状态机：每次把请求分成chunk字节一段追加到读缓冲区，每段之后继续解析，
+// chunk为0时一次追加整个请求
+static void run_conn(const char *name, http_conn *conn, const std::string &req, int chunk, int iterations) {
+    int step = chunk > 0 ? chunk : (int)req.size();
+    uint64_t begin = now_ns();
+    uint64_t begin_cycles = now_cycles();
+    for(int i=0; i<iterations; ++i) {
+        conn->reset_parser();
+        int ret = http_conn::PARSE_MORE;
+        for(size_t off=0; off<req.size() && ret == http_conn::PARSE_MORE; off+=step) {
+            ret = conn->parse_input(req.data() + off, std::min((size_t)step, req.size() - off));
+        }
+        if(ret != http_conn::PARSE_DONE) {
+            printf("%s: parse failure\n", name);
+            return;
+        }
+    }
+    uint64_t cycles = now_cycles() - begin_cycles;
+    report(name, now_ns() - begin, cycles, iterations, req.size());
+    printf("  (%d bytes)\n", (int)req.size());
+}
+
+// 在请求头末尾补上多个常见的代理、缓存和跟踪字段，模拟经过多层代理的请求
+static std::string add_headers(const std::string &req) {
+    static const char *extra[] = {
+        "X-Forwarded-For: 203.0.113.7, 198.51.100.23, 192.0.2.41",
+        "X-Forwarded-Proto: https",
+        "X-Forwarded-Host: www.example.com",
+        "X-Real-IP: 203.0.113.7",
+        "X-Request-ID: 5f0c1b9e-3d2a-4c8b-9e61-2a7d4f0b8c13",
+        "Via: 1.1 varnish, 1.1 edge-proxy-03",
+        "Cache-Control: max-age=0",
+        "Pragma: no-cache",
+        "Referer: https://www.example.com/articles/2022/10/parsing-http-requests-quickly?utm_source=feed",
+        "Cookie: session=7b1d2f9c0a3e4b5d8f6a; theme=dark; lang=zh-CN; _ga=GA1.2.1234567890.1665400000; "
+        "_gid=GA1.2.987654321.1665400000; consent=analytics%3Dtrue%26ads%3Dfalse",
+        "Sec-Fetch-Site: same-origin",
+        "Sec-Fetch-Mode: navigate",
+        "Sec-Fetch-User: ?1",
+        "Sec-Fetch-Dest: document",
+        "Sec-CH-UA: \"Chromium\";v=\"106\", \"Microsoft Edge\";v=\"106\", \"Not;A=Brand\";v=\"99\"",
+        "Sec-CH-UA-Mobile: ?0",
+        "Sec-CH-UA-Platform: \"Windows\"",
+        "If-None-Match: \"1665400000-4096\"",
+        "If-Modified-Since: Mon, 10 Oct 2022 08:00:00 GMT",
+        "DNT: 1",
+        "Traceparent: 00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01",
+        "Tracestate: congo=t61rcWkgMzE,rojo=00f067aa0ba902b7",
+        "Forwarded: for=203.0.113.7;proto=https;by=198.51.100.23",
+        "Accept-Charset: utf-8, iso-8859-1;q=0.5",
+    };
+    std::string out = req.substr(0, req.size() - 2);
+    for(size_t i=0; i<sizeof(extra) / sizeof(extra[0]); ++i) {
+        out.append(extra[i]);
+        out.append("\r\n");
+    }
+    out.append("\r\n");
+    return out;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = argc > 1 ? argv[1] : "http_request";
+    std::string req = load_request(path);
+    if(req.size() <= 2) {
+        printf("按照以下格式运行：%s [request_file]\n", argv[0]);
+        return -1;
+    }
+    printf("request: %s, %d bytes\n", path, (int)req.size());
+
+    run("baseline", parse_baseline, req);
+    http_scanner::IMPL impls[] = { http_scanner::IMPL_SCALAR, http_scanner::IMPL_SSE42, http_scanner::IMPL_AVX2 };
+    for(size_t i=0; i<sizeof(impls) / sizeof(impls[0]); ++i) {
+        if(!http_scanner::set_impl(impls[i])) {
+            printf("%-16s not supported by this cpu\n", http_scanner::impl_name(impls[i]));
+            continue;
+        }
+        std::string name = std::string("scanner/") + http_scanner::impl_name(impls[i]);
+        run(name.c_str(), parse_scanner, req);
+    }
+
+    // 以下使用上面最后一个设置成功的实现，即当前CPU支持的最快实现
+    http_conn *conn = new http_conn;
+    std::string heavy = add_headers(req);
+    run_conn("http_conn/typical", conn, req, 0, ITERATIONS);
+    run_conn("http_conn/header-heavy", conn, heavy, 0, ITERATIONS / 4);
+    // 逐字节到达时每个字节都要重新查找行结束符
+    run_conn("http_conn/fragmented", conn, req, 1, ITERATIONS / 20);
+    delete conn;
+    return 0;
+}
@@ -0,0 +1,191 @@
+// 请求解析的模糊测试：把输入按不同的分段追加到http_conn的读缓冲区并解析，包括其后的流水线请求，
+// 每一步检查读缓冲区的下标和已解析字段的指针不越界，出错时abort
+// libFuzzer：clang++ -g -O1 -fsanitize=fuzzer,address,undefined -DUSE_LIBFUZZER -DBUFFER_POOL_MALLOC
+//            bench/parser_fuzz.cpp $(ls *.cpp | grep -v main.cpp) -pthread -lz -o bin/parser_fuzz
+//            bin/parser_fuzz corpus/
+// 独立运行（不需要clang）：g++ -g -O1 -fsanitize=address,undefined -DBUFFER_POOL_MALLOC
+//            bench/parser_fuzz.cpp $(ls *.cpp | grep -v main.cpp) -pthread -lz -o bin/parser_fuzz
+//            bin/parser_fuzz [-n iterations] [-s seed] [file...]
+// 独立运行时先回放给出的文件，再以http_request和几个内置请求为种子随机变异
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "../http_conn.h"
+
+static http_conn *conn = NULL;
+
+static void check(bool ok, const char *what) {
+    if(!ok) {
+        fprintf(stderr, "parser_fuzz: %s\n", what);
+        abort();
+    }
+}
+
+// 读缓冲区中已有的数据可能还含有后续请求，逐个解析直到需要更多数据或出错
+static int drain(int ret) {
+    while(ret == http_conn::PARSE_DONE) {
+        check(conn->parser_consistent(), "inconsistent state after a request");
+        check(conn->url() && conn->url()[0] == '/', "request without a url");
+        check(conn->request_bytes() > 0, "empty request");
+        conn->next_request();
+        ret = conn->parse_input(NULL, 0);
+        check(conn->parser_consistent(), "inconsistent state");
+    }
+    return ret;
+}
+
+// 第一个字节决定每段的长度（0表示一次追加全部），其余为请求数据
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if(!conn) {
+        conn = new http_conn;
+    }
+    if(size == 0) {
+        return 0;
+    }
+    size_t step = data[0] % 17;
+    const char *input = (const char *)data + 1;
+    size_t len = size - 1;
+    if(step == 0) {
+        step = len > 0 ? len : 1;
+    }
+    conn->reset_parser();
+    int ret = http_conn::PARSE_MORE;
+    for(size_t off=0; off<len && ret != http_conn::PARSE_ERROR; off+=step) {
+        size_t n = len - off < step ? len - off : step;
+        ret = drain(conn->parse_input(input + off, n));
+        check(conn->parser_consistent(), "inconsistent state");
+    }
+    return 0;
+}
+
+#ifndef USE_LIBFUZZER
+static const char *builtin_seeds[] = {
+    "GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n",
+    "GET http://localhost/a?b=c HTTP/1.1\r\nRange: bytes=0-1,5-9\r\nIf-Range: \"1-2\"\r\n\r\n"
+    "HEAD / HTTP/1.1\r\nIf-None-Match: \"x\"\r\nAccept-Encoding: gzip\r\n\r\n",
+    "POST /form HTTP/1.1\r\nContent-Length: 11\r\n\r\nhello world"
+    "GET / HTTP/1.1\r\n\r\n",
+    "POST /up HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5;ext=1\r\nhello\r\n6\r\n world\r\n0\r\nTrailer: x\r\n\r\n",
+    "PUT /file.txt HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc",
+    "GET / HTTP/1.1\nHost: bare-lf\n\n",
+};
+
+static std::string load_file(const char *path) {
+    std::string s;
+    FILE *fp = fopen(path, "rb");
+    if(!fp) {
+        return s;
+    }
+    char buf[4096];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        s.append(buf, n);
+    }
+    fclose(fp);
+    return s;
+}
+
+// 变异时倾向于插入对解析有特殊意义的字符
+static const char special[] = "\r\n :\t/?;0123456789-\"";
+
+static void mutate(std::string &s, unsigned *seed) {
+    int count = 1 + rand_r(seed) % 8;
+    for(int i=0; i<count; ++i) {
+        size_t pos = s.empty() ? 0 : rand_r(seed) % (s.size() + 1);
+        char c = rand_r(seed) % 2 ? special[rand_r(seed) % (sizeof(special) - 1)] : (char)rand_r(seed);
+        switch(rand_r(seed) % 5) {
+            case 0:
+                if(pos < s.size()) {
+                    s[pos] = c;
+                }
+                break;
+            case 1:
+                s.insert(pos, 1, c);
+                break;
+            case 2:
+                if(pos < s.size()) {
+                    s.erase(pos, 1 + rand_r(seed) % 16);
+                }
+                break;
+            case 3: {
+                // 复制一段，制造超长的行和重复的字段
+                size_t from = s.empty() ? 0 : rand_r(seed) % s.size();
+                std::string piece = s.substr(from, 1 + rand_r(seed) % 256);
+                for(int k=rand_r(seed) % 64; k>=0 && s.size() < 200000; --k) {
+                    s.insert(pos, piece);
+                }
+                break;
+            }
+            default:
+                // 改变分段方式
+                if(!s.empty()) {
+                    s[0] = (char)rand_r(seed);
+                }
+                break;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = 1000000;
+    unsigned seed = (unsigned)getpid();
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch(opt) {
+            case 'n':
+                iterations = atol(optarg);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                printf("按照以下格式运行：%s [-n iterations] [-s seed] [file...]\n", argv[0]);
+                return -1;
+        }
+    }
+
+    std::vector<std::string> seeds;
+    for(int i=optind; i<argc; ++i) {
+        std::string s = load_file(argv[i]);
+        LLVMFuzzerTestOneInput((const uint8_t *)s.data(), s.size());
+        seeds.push_back(s);
+    }
+    if(optind < argc) {
+        printf("replayed %d file(s)\n", argc - optind);
+    }
+    // http_request中的行结束符是\n，统一为\r\n
+    std::string sample = load_file("http_request");
+    std::string req;
+    for(size_t i=0; i<sample.size(); ++i) {
+        if(sample[i] == '\n' && (i == 0 || sample[i-1] != '\r')) {
+            req += '\r';
+        }
+        req += sample[i];
+    }
+    if(!req.empty()) {
+        seeds.push_back(std::string(1, '\0') + req);
+        seeds.push_back(std::string(1, '\1') + req);
+    }
+    for(size_t i=0; i<sizeof(builtin_seeds) / sizeof(builtin_seeds[0]); ++i) {
+        seeds.push_back(std::string(1, (char)i) + builtin_seeds[i]);
+    }
+
+    printf("seed=%u, %d seeds, %ld iterations\n", seed, (int)seeds.size(), iterations);
+    for(long i=0; i<iterations; ++i) {
+        std::string s = seeds[rand_r(&seed) % seeds.size()];
+        mutate(s, &seed);
+        LLVMFuzzerTestOneInput((const uint8_t *)s.data(), s.size());
+        if((i + 1) % 100000 == 0) {
+            printf("%ld\n", i + 1);
+            fflush(stdout);
+        }
+    }
+    printf("done\n");
+    return 0;
+}
+#endif // USE_LIBFUZZER
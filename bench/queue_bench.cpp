@@ -0,0 +1,165 @@
+// 线程池请求队列基准测试：对比链表+互斥锁队列、无锁环形队列和工作窃取队列
+// 编译：g++ -O2 bench/queue_bench.cpp -pthread -o bin/queue_bench
+// 运行：bin/queue_bench [每轮秒数]
+// 每轮使用n个生产者和n个消费者（n = 1..64），输出吞吐量和入队到出队的延迟分位数
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "../threadpool.h"
+#include "../histogram.h"
+
+static const int QUEUE_SIZE = 10000;
+
+struct item {
+    uint64_t m_enqueue_ns;
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+template<typename Queue>
+struct bench_ctx {
+    Queue *m_queue;
+    std::atomic<bool> m_stop;
+    item m_poison;              // 生产者结束后发给消费者的退出标记
+    histogram *m_hists;
+    uint64_t *m_pushed;
+};
+
+template<typename Queue>
+struct thread_arg {
+    bench_ctx<Queue> *m_ctx;
+    int m_id;
+};
+
+template<typename Queue>
+static void *producer(void *arg) {
+    thread_arg<Queue> *a = (thread_arg<Queue> *)arg;
+    bench_ctx<Queue> *ctx = a->m_ctx;
+    // 每个生产者循环复用自己的一组任务对象，数量是队列容量的两倍，保证复用时旧对象早已出队
+    int nitems = QUEUE_SIZE * 2;
+    item *items = new item[nitems];
+    uint64_t pushed = 0;
+    int next = 0;
+    while(!ctx->m_stop.load(std::memory_order_relaxed)) {
+        item *it = &items[next];
+        it->m_enqueue_ns = now_ns();
+        if(ctx->m_queue->push(it)) {
+            ++pushed;
+            next = (next + 1) % nitems;
+        } else {
+            cpu_relax();
+        }
+    }
+    ctx->m_pushed[a->m_id] = pushed;
+    // 等消费者退出后再释放
+    return items;
+}
+
+template<typename Queue>
+static void *consumer(void *arg) {
+    thread_arg<Queue> *a = (thread_arg<Queue> *)arg;
+    bench_ctx<Queue> *ctx = a->m_ctx;
+    histogram &h = ctx->m_hists[a->m_id];
+    while(true) {
+        item *it = ctx->m_queue->pop(a->m_id);
+        if(!it) {
+            continue;
+        }
+        if(it == &ctx->m_poison) {
+            break;
+        }
+        h.record(now_ns() - it->m_enqueue_ns);
+    }
+    return NULL;
+}
+
+template<typename Queue>
+static void run(const char *name, int n, double seconds) {
+    Queue queue(n, QUEUE_SIZE);
+    bench_ctx<Queue> ctx;
+    ctx.m_queue = &queue;
+    ctx.m_stop = false;
+    ctx.m_hists = new histogram[n];
+    ctx.m_pushed = new uint64_t[n];
+
+    pthread_t *producers = new pthread_t[n];
+    pthread_t *consumers = new pthread_t[n];
+    thread_arg<Queue> *pargs = new thread_arg<Queue>[n];
+    thread_arg<Queue> *cargs = new thread_arg<Queue>[n];
+
+    uint64_t start = now_ns();
+    for(int i=0; i<n; ++i) {
+        cargs[i].m_ctx = &ctx;
+        cargs[i].m_id = i;
+        pthread_create(&consumers[i], NULL, consumer<Queue>, &cargs[i]);
+    }
+    for(int i=0; i<n; ++i) {
+        pargs[i].m_ctx = &ctx;
+        pargs[i].m_id = i;
+        pthread_create(&producers[i], NULL, producer<Queue>, &pargs[i]);
+    }
+
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+    ctx.m_stop = true;
+
+    item **items = new item*[n];
+    for(int i=0; i<n; ++i) {
+        pthread_join(producers[i], (void **)&items[i]);
+    }
+    for(int i=0; i<n; ++i) {
+        while(!queue.push(&ctx.m_poison)) {
+            cpu_relax();
+        }
+    }
+    for(int i=0; i<n; ++i) {
+        pthread_join(consumers[i], NULL);
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    histogram all;
+    uint64_t pushed = 0;
+    for(int i=0; i<n; ++i) {
+        all.merge(ctx.m_hists[i]);
+        pushed += ctx.m_pushed[i];
+        delete[] items[i];
+    }
+    printf("%-6s %3d/%-3d %12.0f %10llu %10llu %10llu %10llu\n", name, n, n, pushed / elapsed,
+           (unsigned long long)all.percentile(50), (unsigned long long)all.percentile(99),
+           (unsigned long long)all.percentile(99.9), (unsigned long long)all.percentile(99.99));
+
+    delete[] items;
+    delete[] pargs;
+    delete[] cargs;
+    delete[] producers;
+    delete[] consumers;
+    delete[] ctx.m_pushed;
+    delete[] ctx.m_hists;
+}
+
+int main(int argc, char *argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    if(seconds <= 0) {
+        printf("按照以下格式运行：%s [seconds_per_round]\n", argv[0]);
+        return -1;
+    }
+
+    printf("%-6s %7s %12s %10s %10s %10s %10s\n", "queue", "prod/con", "ops/s", "p50(ns)", "p99(ns)", "p99.9(ns)", "p99.99(ns)");
+    for(int n=1; n<=64; n*=2) {
+        run<list_queue<item> >("list", n, seconds);
+        run<ring_queue<item> >("ring", n, seconds);
+        run<steal_queue<item> >("steal", n, seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+// 路由查找基准测试：分别注册10、100、1000组路由，测量每次查找的平均耗时，检查耗时不随路由数增长
+// 编译：g++ -O2 bench/router_bench.cpp router.cpp buffer_pool.cpp topology.cpp http_header.cpp -pthread -o bin/router_bench
+// 运行：bin/router_bench [route_count...]，默认10 100 1000
+// 路由表是单例，只能编译一次，每组路由在单独的子进程中测量
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+
+#include "../router.h"
+
+static const int ITERATIONS = 5000000;
+static const int GET = 0;
+static const int POST = 1;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void noop_handler(const http_request &, http_response &, void *) {
+}
+
+// 每组4条路由，模仿常见的REST接口，资源名带编号使各组互不相同
+static void register_group(router *r, int i) {
+    char pattern[128];
+    snprintf(pattern, sizeof(pattern), "/api/v1/resource%d", i);
+    r->add(GET, pattern, noop_handler, NULL);
+    r->add(POST, pattern, noop_handler, NULL);
+    snprintf(pattern, sizeof(pattern), "/api/v1/resource%d/:id", i);
+    r->add(GET, pattern, noop_handler, NULL);
+    snprintf(pattern, sizeof(pattern), "/api/v1/resource%d/:id/items/:item", i);
+    r->add(GET, pattern, noop_handler, NULL);
+}
+
+static void measure(int groups) {
+    router *r = router::get_instance();
+    for(int i=0; i<groups; ++i) {
+        register_group(r, i);
+    }
+    r->compile();
+
+    // 查找的路径均匀分布在各组上，另有一半是未注册的静态文件路径
+    std::vector<std::string> paths;
+    char path[128];
+    for(int i=0; i<64; ++i) {
+        int g = (int)((long long)i * 7919 % groups);
+        switch(i % 4) {
+            case 0:
+                snprintf(path, sizeof(path), "/api/v1/resource%d", g);
+                break;
+            case 1:
+                snprintf(path, sizeof(path), "/api/v1/resource%d/%d", g, i * 31);
+                break;
+            case 2:
+                snprintf(path, sizeof(path), "/api/v1/resource%d/%d/items/%d", g, i, i * 17);
+                break;
+            default:
+                snprintf(path, sizeof(path), "/static/img/photo%d.jpg", i);
+                break;
+        }
+        paths.push_back(path);
+        paths.push_back("/index.html");
+    }
+
+    route_param params[router::MAX_PARAMS];
+    int count;
+    unsigned allowed;
+    uint64_t hits = 0;
+    uint64_t begin = now_ns();
+    for(int i=0; i<ITERATIONS; ++i) {
+        const std::string &p = paths[i % paths.size()];
+        if(r->match(GET, p.data(), (int)p.size(), params, &count, &allowed)) {
+            ++hits;
+        }
+    }
+    uint64_t elapsed = now_ns() - begin;
+    printf("%6d routes %7d nodes %8.1f ns/lookup  (hit %.0f%%)\n", (int)r->route_count(), (int)r->node_count(),
+           (double)elapsed / ITERATIONS, 100.0 * hits / ITERATIONS);
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<int> counts;
+    for(int i=1; i<argc; ++i) {
+        counts.push_back(atoi(argv[i]));
+    }
+    if(counts.empty()) {
+        counts.push_back(10);
+        counts.push_back(100);
+        counts.push_back(1000);
+    }
+    for(size_t i=0; i<counts.size(); ++i) {
+        if(counts[i] <= 0) {
+            printf("按照以下格式运行：%s [route_count...]\n", argv[0]);
+            return -1;
+        }
+        fflush(stdout);
+        pid_t pid = fork();
+        if(pid == 0) {
+            measure((counts[i] + 3) / 4);
+            return 0;
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
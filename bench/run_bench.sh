@@ -0,0 +1,54 @@
+#!/bin/bash
+# 端到端基准测试：在回环地址上启动bin/main（网站根目录为root/），用bin/loadgen跑几组固定场景，
+# 结果追加到bench/results/<日期>-<提交>.txt
+# 运行：bench/run_bench.sh [port] [duration_seconds]
+set -e
+cd "$(dirname "$0")/.."
+
+PORT=${1:-10080}
+DURATION=${2:-10}
+REACTORS=${REACTORS:-2}
+BACKEND=${BACKEND:-epoll}
+THREADS=${THREADS:-2}
+CONNS=${CONNS:-64}
+
+# 协程反应堆需要以C++20编译
+STD=
+if [ "$BACKEND" = coro ]; then
+    STD=-std=c++20
+fi
+
+mkdir -p bin bench/results
+g++ -O2 $STD *.cpp -pthread -lz -o bin/main
+g++ -O2 bench/loadgen.cpp -pthread -o bin/loadgen
+
+OUT=bench/results/$(date +%Y%m%d-%H%M%S)-$(git rev-parse --short HEAD 2>/dev/null || echo unknown).txt
+
+bin/main -r "$REACTORS" -i "$BACKEND" -l /dev/null -d root "$PORT" > /dev/null &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null; wait $SERVER 2>/dev/null' EXIT
+sleep 0.5
+
+run() {
+    echo "== $*" | tee -a "$OUT"
+    bin/loadgen -t "$THREADS" -d "$DURATION" "$@" 127.0.0.1:"$PORT" | tee -a "$OUT"
+    echo | tee -a "$OUT"
+}
+
+{
+    echo "commit: $(git rev-parse HEAD 2>/dev/null) $(git diff --quiet 2>/dev/null || echo dirty)"
+    echo "host: $(uname -srm), $(nproc) cpus"
+    echo "server: -r $REACTORS -i $BACKEND"
+    echo
+} | tee -a "$OUT"
+
+# 闭环：长连接、短连接、流水线
+run -c "$CONNS" -k 1
+run -c "$CONNS" -k 0
+run -c "$CONNS" -k 1 -p 16
+# 开环：固定速率，延迟包含排队时间
+run -c "$CONNS" -k 1 -R 20000
+run -c "$CONNS" -k 1 -R 50000 -u /index.html@9 -u /missing.html@1
+
+curl -s "http://127.0.0.1:$PORT/__stats" >> "$OUT" || true
+echo "results: $OUT"
@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "buffer_pool.h"
+
+buffer_pool *buffer_pool::get_instance() {
+    // 不析构：线程退出时的缓存归还可能晚于静态对象析构
+    static buffer_pool *instance = new buffer_pool();
+    return instance;
+}
+
+buffer_pool::buffer_pool() : m_slab_bytes(0) {
+    for(int node=0; node<cpu_topology::MAX_NODES; ++node) {
+        for(int i=0; i<CLASS_NUMBER; ++i) {
+            m_depots[node][i].m_head = NULL;
+            m_depots[node][i].m_count = 0;
+        }
+    }
+}
+
+buffer_pool::~buffer_pool() {
+}
+
+buffer_pool::thread_cache::thread_cache() : m_node(cpu_topology::current_node()) {
+    for(int i=0; i<CLASS_NUMBER; ++i) {
+        m_head[i] = NULL;
+        m_count[i] = 0;
+    }
+}
+
+buffer_pool::thread_cache::~thread_cache() {
+    // 线程退出时把缓存的块全部还给仓库
+    for(int i=0; i<CLASS_NUMBER; ++i) {
+        get_instance()->flush(*this, i, m_count[i]);
+    }
+}
+
+buffer_pool::thread_cache &buffer_pool::local_cache() {
+    static thread_local thread_cache cache;
+    return cache;
+}
+
+int buffer_pool::class_of(size_t size) {
+    if(size <= MIN_SIZE) {
+        return 0;
+    }
+    return 64 - __builtin_clzll(size - 1) - MIN_SHIFT;
+}
+
+int buffer_pool::cache_limit(int cls) {
+    // 每级最多缓存256KB，至少4块
+    int n = (int)(SLAB_SIZE >> (MIN_SHIFT + cls));
+    return n < 4 ? 4 : n;
+}
+
+char *buffer_pool::alloc(size_t size, size_t *capacity) {
+    if(size > MAX_SIZE) {
+        return NULL;
+    }
+    int cls = class_of(size);
+#ifdef BUFFER_POOL_MALLOC
+    *capacity = MIN_SIZE << cls;
+    return (char *)malloc(*capacity);
+#endif
+    thread_cache &cache = local_cache();
+    if(!cache.m_head[cls]) {
+        refill(cache, cls);
+        if(!cache.m_head[cls]) {
+            return NULL;
+        }
+    }
+    chunk *c = cache.m_head[cls];
+    cache.m_head[cls] = c->m_next;
+    --cache.m_count[cls];
+    *capacity = MIN_SIZE << cls;
+    return (char *)c;
+}
+
+void buffer_pool::free(char *buf, size_t capacity) {
+    if(!buf) {
+        return;
+    }
+#ifdef BUFFER_POOL_MALLOC
+    ::free(buf);
+    return;
+#endif
+    int cls = class_of(capacity);
+    thread_cache &cache = local_cache();
+    chunk *c = (chunk *)buf;
+    c->m_next = cache.m_head[cls];
+    cache.m_head[cls] = c;
+    if(++cache.m_count[cls] > cache_limit(cls)) {
+        // 保留一半，其余成批还给仓库
+        flush(cache, cls, cache.m_count[cls] / 2);
+    }
+}
+
+void buffer_pool::refill(thread_cache &cache, int cls) {
+    int batch = cache_limit(cls) / 2;
+    depot &d = m_depots[cache.m_node][cls];
+    d.m_lock.lock();
+    while(d.m_head && batch > 0) {
+        chunk *c = d.m_head;
+        d.m_head = c->m_next;
+        --d.m_count;
+        c->m_next = cache.m_head[cls];
+        cache.m_head[cls] = c;
+        ++cache.m_count[cls];
+        --batch;
+    }
+    d.m_lock.unlock();
+    if(cache.m_head[cls]) {
+        return;
+    }
+
+    // 仓库也空了，切一个新slab放入本线程缓存
+    char *slab;
+    cpu_topology *topo = cpu_topology::get_instance();
+    if(topo->numa()) {
+        // 单独映射，在第一次访问之前绑定到本线程的节点
+        slab = (char *)mmap(NULL, SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(slab == MAP_FAILED) {
+            return;
+        }
+        topo->bind_memory(slab, SLAB_SIZE, cache.m_node);
+    } else {
+        slab = (char *)malloc(SLAB_SIZE);
+        if(!slab) {
+            return;
+        }
+    }
+    m_slab_bytes.fetch_add(SLAB_SIZE, std::memory_order_relaxed);
+    size_t size = MIN_SIZE << cls;
+    for(size_t off = 0; off + size <= SLAB_SIZE; off += size) {
+        chunk *c = (chunk *)(slab + off);
+        c->m_next = cache.m_head[cls];
+        cache.m_head[cls] = c;
+        ++cache.m_count[cls];
+    }
+}
+
+void buffer_pool::flush(thread_cache &cache, int cls, int n) {
+    if(n <= 0) {
+        return;
+    }
+    // 先在本地摘下n块，再一次性挂到仓库
+    chunk *first = cache.m_head[cls];
+    chunk *last = first;
+    for(int i=1; i<n; ++i) {
+        last = last->m_next;
+    }
+    cache.m_head[cls] = last->m_next;
+    cache.m_count[cls] -= n;
+
+    depot &d = m_depots[cache.m_node][cls];
+    d.m_lock.lock();
+    last->m_next = d.m_head;
+    d.m_head = first;
+    d.m_count += n;
+    d.m_lock.unlock();
+}
@@ -0,0 +1,69 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include <atomic>
+
+#include "locker.h"
+#include "topology.h"
+
+// 连接缓冲区的slab内存池：按2的幂分为4KB~64KB几个大小级别，每级从256KB的slab中切出定长块。
+// 每个线程有自己的空闲块缓存，分配和归还不加锁；缓存过多或为空时与全局仓库成批交换，
+// 所以反应堆线程归还工作线程借出的块也不会在全局锁上竞争。slab不归还给系统。
+// 仓库按NUMA节点划分，线程只与所在节点的仓库交换；多节点时slab绑定到切分它的线程所在的节点。
+// 编译时加 -DBUFFER_POOL_MALLOC 时每块单独malloc，供AddressSanitizer检查越界
+class buffer_pool {
+public:
+    static const int MIN_SHIFT = 12;                            // 最小块4KB
+    static const int MAX_SHIFT = 16;                            // 最大块64KB
+    static const int CLASS_NUMBER = MAX_SHIFT - MIN_SHIFT + 1;
+    static const size_t MIN_SIZE = (size_t)1 << MIN_SHIFT;
+    static const size_t MAX_SIZE = (size_t)1 << MAX_SHIFT;
+    static const size_t SLAB_SIZE = 256 * 1024;
+
+    static buffer_pool *get_instance();
+
+    // 借出一块不小于size的缓冲区，实际大小写入capacity，size超过MAX_SIZE时返回NULL
+    char *alloc(size_t size, size_t *capacity);
+    // 归还缓冲区，capacity为alloc给出的实际大小
+    void free(char *buf, size_t capacity);
+
+    size_t slab_bytes() const { return m_slab_bytes.load(std::memory_order_relaxed); }
+
+private:
+    buffer_pool();
+    ~buffer_pool();
+
+    struct chunk {
+        chunk *m_next;
+    };
+
+    // 线程本地缓存
+    struct thread_cache {
+        chunk *m_head[CLASS_NUMBER];
+        int m_count[CLASS_NUMBER];
+        int m_node;                 // 第一次使用时线程所在的节点
+
+        thread_cache();
+        ~thread_cache();
+    };
+
+    // 各节点的仓库，每个级别一把锁
+    struct alignas(64) depot {
+        locker m_lock;
+        chunk *m_head;
+        int m_count;
+    };
+
+    static int class_of(size_t size);
+    static int cache_limit(int cls);                // 线程缓存每级最多保留的块数
+    static thread_cache &local_cache();
+    void refill(thread_cache &cache, int cls);      // 从仓库取一批，仓库为空时切一个新slab
+    void flush(thread_cache &cache, int cls, int n);// 把n块还给仓库
+
+private:
+    depot m_depots[cpu_topology::MAX_NODES][CLASS_NUMBER];
+    std::atomic<size_t> m_slab_bytes;
+};
+
+#endif // BUFFER_POOL_H
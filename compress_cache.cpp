@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zlib.h>
+
+#include "compress_cache.h"
+#include "logger.h"
+
+// 每个路径在哈希表中除数据外的大致开销，计入预算，避免大量不压缩的记录不受限制
+static const size_t SET_OVERHEAD = 128;
+
+compress_cache *compress_cache::get_instance() {
+    // 不析构：进程退出时工作线程可能仍持有条目
+    static compress_cache *instance = new compress_cache();
+    return instance;
+}
+
+compress_cache::compress_cache() : m_byte_budget(0), m_shard_budget(0), m_max_file_size(0), m_bytes(0),
+    m_thread(0) {
+    for(int i=0; i<SHARD_NUMBER; ++i) {
+        m_shards[i].m_buckets = NULL;
+        m_shards[i].m_bucket_mask = 0;
+        m_shards[i].m_count = 0;
+        m_shards[i].m_oldest = NULL;
+        m_shards[i].m_newest = NULL;
+        m_shards[i].m_bytes = 0;
+    }
+}
+
+compress_cache::~compress_cache() {
+}
+
+bool compress_cache::init(size_t byte_budget, size_t max_file_size) {
+    m_byte_budget = byte_budget;
+    m_shard_budget = byte_budget / SHARD_NUMBER;
+    m_max_file_size = max_file_size < m_shard_budget ? max_file_size : m_shard_budget;
+    if(!enabled()) {
+        return true;
+    }
+    for(int i=0; i<SHARD_NUMBER; ++i) {
+        m_shards[i].m_bucket_mask = 255;
+        m_shards[i].m_buckets = new variant_set*[m_shards[i].m_bucket_mask + 1]();
+    }
+    if(pthread_create(&m_thread, NULL, worker, this) != 0) {
+        m_byte_budget = 0;
+        return false;
+    }
+    pthread_detach(m_thread);
+    return true;
+}
+
+compress_cache::variant_set *compress_cache::find(shard &s, const char *path, unsigned long long h) {
+    variant_set *set = s.m_buckets[(h >> 8) & s.m_bucket_mask];
+    for(; set; set = set->m_next) {
+        if(set->m_hash == h && strcmp(set->m_path, path) == 0) {
+            return set;
+        }
+    }
+    return NULL;
+}
+
+file_entry *compress_cache::acquire(const char *path, const struct stat &st, int encodings, int *encoding) {
+    if(!enabled() || encodings == 0) {
+        return NULL;
+    }
+    unsigned long long h = file_cache::hash(path);
+    shard &s = shard_of(h);
+    s.m_lock.rdlock();
+    variant_set *set = find(s, path, h);
+    if(set && set->m_mtime == st.st_mtime && set->m_size == st.st_size) {
+        // br通常比gzip小，两者都接受时优先br
+        file_entry *e = NULL;
+        if((encodings & ENCODING_BR) && set->m_br) {
+            e = set->m_br;
+            *encoding = ENCODING_BR;
+        } else if((encodings & ENCODING_GZIP) && set->m_gzip) {
+            e = set->m_gzip;
+            *encoding = ENCODING_GZIP;
+        }
+        if(e) {
+            e->m_refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        s.m_lock.unlock();
+        return e;
+    }
+    s.m_lock.unlock();
+    schedule(path, st);
+    return NULL;
+}
+
+void compress_cache::schedule(const char *path, const struct stat &st) {
+    m_queue_lock.lock();
+    if((int)m_queue.size() < MAX_PENDING && m_pending.insert(path).second) {
+        job j;
+        j.m_path = path;
+        j.m_stat = st;
+        m_queue.push_back(j);
+        m_queue_cond.signal();
+    }
+    m_queue_lock.unlock();
+}
+
+void *compress_cache::worker(void *arg) {
+    compress_cache *cache = (compress_cache *)arg;
+    cache->run();
+    return cache;
+}
+
+void compress_cache::run() {
+    while(true) {
+        m_queue_lock.lock();
+        while(m_queue.empty()) {
+            m_queue_cond.wait(m_queue_lock.get());
+        }
+        job j = m_queue.front();
+        m_queue.pop_front();
+        m_queue_lock.unlock();
+
+        build(j);
+
+        m_queue_lock.lock();
+        m_pending.erase(j.m_path);
+        m_queue_lock.unlock();
+    }
+}
+
+// 生成一个文件的所有编码版本并替换旧记录
+void compress_cache::build(const job &j) {
+    // 排队期间文件可能已被修改，以当前状态为准
+    struct stat st;
+    if(stat(j.m_path.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) {
+        return;
+    }
+
+    file_entry *br = load_sibling(j.m_path, st, ENCODING_BR);
+    file_entry *gzip = load_sibling(j.m_path, st, ENCODING_GZIP);
+    if(!gzip && st.st_size >= MIN_SIZE && (size_t)st.st_size <= m_max_file_size &&
+       http_header::compressible(http_header::mime_type(j.m_path.c_str()))) {
+        gzip = compress(j.m_path, st);
+    }
+    size_t bytes = SET_OVERHEAD + j.m_path.size() + (br ? br->m_stat.st_size : 0) +
+                   (gzip ? gzip->m_stat.st_size : 0);
+    LOG_DEBUG("compress %s: br=%lld gzip=%lld original=%lld", j.m_path.c_str(),
+              br ? (long long)br->m_stat.st_size : -1LL, gzip ? (long long)gzip->m_stat.st_size : -1LL,
+              (long long)st.st_size);
+
+    unsigned long long h = file_cache::hash(j.m_path.c_str());
+    shard &s = shard_of(h);
+    s.m_lock.wrlock();
+    variant_set *set = find(s, j.m_path.c_str(), h);
+    if(set) {
+        // 原地替换旧版本，并移到加入顺序的最新一端
+        s.m_bytes -= set->m_bytes;
+        m_bytes.fetch_sub(set->m_bytes, std::memory_order_relaxed);
+        release_set(*set);
+        unlink_order(s, set);
+    } else {
+        set = new variant_set;
+        set->m_path = strdup(j.m_path.c_str());
+        set->m_hash = h;
+        size_t idx = (h >> 8) & s.m_bucket_mask;
+        set->m_next = s.m_buckets[idx];
+        s.m_buckets[idx] = set;
+        ++s.m_count;
+    }
+    set->m_mtime = st.st_mtime;
+    set->m_size = st.st_size;
+    set->m_br = br;
+    set->m_gzip = gzip;
+    set->m_bytes = bytes;
+    link_newest(s, set);
+    if(s.m_count > s.m_bucket_mask) {
+        rehash(s);
+    }
+    s.m_bytes += bytes;
+    m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    evict(s);
+    s.m_lock.unlock();
+}
+
+file_entry *compress_cache::load_sibling(const std::string &path, const struct stat &st, int encoding) {
+    std::string sibling = path + http_header::encoding_suffix(encoding);
+    int fd = open(sibling.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return NULL;
+    }
+    struct stat sst;
+    if(fstat(fd, &sst) < 0 || !S_ISREG(sst.st_mode) || sst.st_mtime < st.st_mtime ||
+       (size_t)sst.st_size > m_max_file_size) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = sst.st_size;
+    char *data = (char *)malloc(size ? size : 1);
+    size_t done = 0;
+    while(data && done < size) {
+        ssize_t n = read(fd, data + done, size - done);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+    if(!data || done != size) {
+        free(data);
+        return NULL;
+    }
+    return make_entry(path, st, data, size, encoding);
+}
+
+// 用zlib生成gzip格式，压缩后不到原大小的90%才保留
+file_entry *compress_cache::compress(const std::string &path, const struct stat &st) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return NULL;
+    }
+    size_t size = st.st_size;
+    char *src = (char *)malloc(size);
+    size_t done = 0;
+    while(src && done < size) {
+        ssize_t n = read(fd, src + done, size - done);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+    if(!src || done != size) {
+        free(src);
+        return NULL;
+    }
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // windowBits加16输出gzip头尾
+    if(deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(src);
+        return NULL;
+    }
+    size_t bound = deflateBound(&zs, size);
+    char *dst = (char *)malloc(bound);
+    zs.next_in = (Bytef *)src;
+    zs.avail_in = size;
+    zs.next_out = (Bytef *)dst;
+    zs.avail_out = bound;
+    int ret = dst ? deflate(&zs, Z_FINISH) : Z_MEM_ERROR;
+    size_t out = zs.total_out;
+    deflateEnd(&zs);
+    free(src);
+    if(ret != Z_STREAM_END || out >= size / 10 * 9) {
+        free(dst);
+        return NULL;
+    }
+    char *shrunk = (char *)realloc(dst, out);
+    return make_entry(path, st, shrunk ? shrunk : dst, out, ENCODING_GZIP);
+}
+
+// 条目的m_stat中保留原文件的修改时间，大小换成编码后的大小；
+// 响应头中的ETag在原文件ETag的基础上改为弱校验，与原文件共用同一组条件请求的判断
+file_entry *compress_cache::make_entry(const std::string &path, const struct stat &st, char *data, size_t size,
+                                       int encoding) {
+    file_entry *e = new file_entry;
+    e->m_path = strdup((path + http_header::encoding_suffix(encoding)).c_str());
+    e->m_hash = 0;
+    e->m_data = data;
+    e->m_stat = st;
+    e->m_stat.st_size = size;
+
+    char etag[http_header::ETAG_SIZE];
+    char last_modified[http_header::DATE_SIZE];
+    http_header::format_etag(st, etag, sizeof(etag));
+    http_header::format_date(st.st_mtime, last_modified, sizeof(last_modified));
+    e->m_headers_len = snprintf(e->m_headers, sizeof(e->m_headers),
+        "HTTP/1.1 200 OK\r\nContent-Length: %llu\r\nContent-Type: %s\r\nContent-Encoding: %s\r\n"
+        "Vary: Accept-Encoding\r\nETag: W/%s\r\nLast-Modified: %s\r\n",
+        (unsigned long long)size, http_header::mime_type(path.c_str()), http_header::encoding_name(encoding),
+        etag, last_modified);
+    if(e->m_headers_len >= (int)sizeof(e->m_headers)) {
+        free(e->m_data);
+        free(e->m_path);
+        delete e;
+        return NULL;
+    }
+    e->m_refs.store(1, std::memory_order_relaxed);     // 缓存持有一个
+    e->m_referenced.store(false, std::memory_order_relaxed);
+    e->m_checked.store(0, std::memory_order_relaxed);
+    e->m_next = NULL;
+    e->m_clock_index = -1;
+    return e;
+}
+
+void compress_cache::release_set(variant_set &set) {
+    file_cache *cache = file_cache::get_instance();
+    if(set.m_gzip) {
+        cache->release(set.m_gzip);
+        set.m_gzip = NULL;
+    }
+    if(set.m_br) {
+        cache->release(set.m_br);
+        set.m_br = NULL;
+    }
+}
+
+void compress_cache::link_newest(shard &s, variant_set *set) {
+    set->m_newer = NULL;
+    set->m_older = s.m_newest;
+    if(s.m_newest) {
+        s.m_newest->m_newer = set;
+    } else {
+        s.m_oldest = set;
+    }
+    s.m_newest = set;
+}
+
+void compress_cache::unlink_order(shard &s, variant_set *set) {
+    if(set->m_older) {
+        set->m_older->m_newer = set->m_newer;
+    } else {
+        s.m_oldest = set->m_newer;
+    }
+    if(set->m_newer) {
+        set->m_newer->m_older = set->m_older;
+    } else {
+        s.m_newest = set->m_older;
+    }
+}
+
+void compress_cache::erase(shard &s, variant_set *set) {
+    variant_set **p = &s.m_buckets[(set->m_hash >> 8) & s.m_bucket_mask];
+    while(*p && *p != set) {
+        p = &(*p)->m_next;
+    }
+    if(*p) {
+        *p = set->m_next;
+    }
+    unlink_order(s, set);
+    --s.m_count;
+    s.m_bytes -= set->m_bytes;
+    m_bytes.fetch_sub(set->m_bytes, std::memory_order_relaxed);
+    release_set(*set);
+    free(set->m_path);
+    delete set;
+}
+
+void compress_cache::evict(shard &s) {
+    while(s.m_bytes > m_shard_budget && s.m_oldest) {
+        erase(s, s.m_oldest);
+    }
+}
+
+void compress_cache::rehash(shard &s) {
+    size_t mask = s.m_bucket_mask * 2 + 1;
+    variant_set **buckets = new variant_set*[mask + 1]();
+    for(variant_set *set = s.m_oldest; set; set = set->m_newer) {
+        size_t idx = (set->m_hash >> 8) & mask;
+        set->m_next = buckets[idx];
+        buckets[idx] = set;
+    }
+    delete[] s.m_buckets;
+    s.m_buckets = buckets;
+    s.m_bucket_mask = mask;
+}
@@ -0,0 +1,99 @@
+#ifndef COMPRESS_CACHE_H
+#define COMPRESS_CACHE_H
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <unordered_set>
+
+#include "locker.h"
+#include "file_cache.h"
+#include "http_header.h"
+
+// 压缩后的响应体缓存：按路径保存一个文件的br、gzip编码版本，版本与原文件的修改时间和大小绑定。
+// 请求路径上只查表，未命中时把路径交给后台线程，本次仍发送原文件；后台线程优先读取同目录下
+// 预先压缩好的.br/.gz文件，没有时用zlib生成gzip，压缩效果不明显的文件记为不压缩，不再重试。
+// 条目复用file_entry，由file_cache::release归还。与file_cache一样按路径哈希分片，每个分片一把读写锁
+class compress_cache {
+public:
+    static const int SHARD_NUMBER = 16;
+    static const int MAX_PENDING = 1024;        // 等待后台压缩的路径数上限，超过时丢弃
+    static const int MIN_SIZE = 256;            // 小于该大小的文件不压缩
+
+    static compress_cache *get_instance();
+
+    // byte_budget为0时禁用，max_file_size以上的文件不压缩
+    bool init(size_t byte_budget, size_t max_file_size);
+    bool enabled() const { return m_byte_budget > 0; }
+
+    // 查找path（状态为st）在encodings中最合适的编码版本，命中时返回已增加引用的条目并写入encoding；
+    // 未命中或版本过期时安排后台处理，返回NULL
+    file_entry *acquire(const char *path, const struct stat &st, int encodings, int *encoding);
+
+    size_t bytes() const { return m_bytes.load(std::memory_order_relaxed); }
+
+private:
+    compress_cache();
+    ~compress_cache();
+
+    // 一个文件的所有编码版本
+    struct variant_set {
+        char *m_path;                   // 原文件路径，即键
+        unsigned long long m_hash;
+        time_t m_mtime;                 // 原文件的修改时间和大小
+        off_t m_size;
+        file_entry *m_gzip;
+        file_entry *m_br;
+        size_t m_bytes;
+        variant_set *m_next;            // 哈希桶链表
+        variant_set *m_older;           // 按加入顺序的双向链表，重新生成时移到最新一端
+        variant_set *m_newer;
+    };
+    struct alignas(64) shard {
+        rwlocker m_lock;                // 保护本分片的全部字段
+        variant_set **m_buckets;
+        size_t m_bucket_mask;
+        size_t m_count;
+        variant_set *m_oldest;
+        variant_set *m_newest;
+        size_t m_bytes;
+    };
+    struct job {
+        std::string m_path;
+        struct stat m_stat;
+    };
+
+    static void *worker(void *arg);
+    void run();
+    void schedule(const char *path, const struct stat &st);
+    void build(const job &j);
+    // 读取预先压缩好的文件，修改时间早于原文件时视为过期
+    file_entry *load_sibling(const std::string &path, const struct stat &st, int encoding);
+    file_entry *compress(const std::string &path, const struct stat &st);
+    file_entry *make_entry(const std::string &path, const struct stat &st, char *data, size_t size, int encoding);
+    shard &shard_of(unsigned long long h) { return m_shards[h % SHARD_NUMBER]; }
+    variant_set *find(shard &s, const char *path, unsigned long long h);
+    void release_set(variant_set &set);
+    void link_newest(shard &s, variant_set *set);
+    void unlink_order(shard &s, variant_set *set);
+    void erase(shard &s, variant_set *set);     // 从分片中移除并释放，需持写锁
+    void evict(shard &s);               // 按加入顺序淘汰直到分片不超过预算，需持写锁
+    void rehash(shard &s);
+
+private:
+    size_t m_byte_budget;
+    size_t m_shard_budget;
+    size_t m_max_file_size;
+    shard m_shards[SHARD_NUMBER];
+    std::atomic<size_t> m_bytes;
+
+    locker m_queue_lock;                // 保护m_queue、m_pending
+    cond m_queue_cond;
+    std::deque<job> m_queue;
+    std::unordered_set<std::string> m_pending;     // 已在队列中或正在处理的路径
+    pthread_t m_thread;
+};
+
+#endif // COMPRESS_CACHE_H
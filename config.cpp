@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include "config.h"
+
+// 配置项表，每项只有一个成员指针非空
+struct config_item {
+    const char *m_name;
+    int server_config::*m_int;
+    bool server_config::*m_bool;
+    std::string server_config::*m_str;
+    bool m_reloadable;
+};
+
+static const config_item config_items[] = {
+    { "port", &server_config::m_port, NULL, NULL, false },
+    { "reactors", &server_config::m_reactors, NULL, NULL, false },
+    { "workers", &server_config::m_workers, NULL, NULL, false },
+    { "queue_size", &server_config::m_queue_size, NULL, NULL, false },
+    { "max_fd", &server_config::m_max_fd, NULL, NULL, false },
+    { "doc_root", NULL, NULL, &server_config::m_doc_root, true },
+    { "upload_dir", NULL, NULL, &server_config::m_upload_dir, true },
+    { "cache_mb", &server_config::m_cache_mb, NULL, NULL, false },
+    { "compress_mb", &server_config::m_compress_mb, NULL, NULL, false },
+    { "log_file", NULL, NULL, &server_config::m_log_file, false },
+    { "verbose", NULL, &server_config::m_verbose, NULL, true },
+    { "backend", NULL, NULL, &server_config::m_backend, false },
+    { "backlog", &server_config::m_backlog, NULL, NULL, false },
+    { "shared_listener", NULL, &server_config::m_shared_listener, NULL, false },
+    { "admission_target_ms", &server_config::m_admission_target, NULL, NULL, true },
+    { "inline", NULL, &server_config::m_inline, NULL, false },
+    { "io_cpus", NULL, NULL, &server_config::m_io_cpus, false },
+    { "worker_cpus", NULL, NULL, &server_config::m_worker_cpus, false },
+    { "steer_incoming", NULL, &server_config::m_steer_incoming, NULL, false },
+    { "header_timeout_ms", &server_config::m_header_timeout, NULL, NULL, false },
+    { "idle_timeout_ms", &server_config::m_idle_timeout, NULL, NULL, false },
+    { "write_timeout_ms", &server_config::m_write_timeout, NULL, NULL, false },
+    { "handoff", NULL, NULL, &server_config::m_handoff, false },
+    { "drain_timeout_s", &server_config::m_drain_timeout, NULL, NULL, false },
+};
+static const int CONFIG_ITEM_NUMBER = sizeof(config_items) / sizeof(config_items[0]);
+
+server_config::server_config() : m_port(0), m_reactors(1), m_workers(8), m_queue_size(10000), m_max_fd(65535),
+    m_doc_root("/root/codes/webserver/root"), m_cache_mb(64), m_compress_mb(32), m_log_file("-"), m_verbose(false),
+    m_backend("epoll"), m_backlog(1024), m_shared_listener(false), m_admission_target(20), m_inline(true),
+    m_steer_incoming(false), m_header_timeout(10000), m_idle_timeout(15000), m_write_timeout(10000),
+    m_drain_timeout(30) {
+}
+
+// 去掉首尾空白
+static std::string trim(const char *begin, const char *end) {
+    while(begin < end && strchr(" \t\r\n", *begin)) {
+        ++begin;
+    }
+    while(end > begin && strchr(" \t\r\n", end[-1])) {
+        --end;
+    }
+    return std::string(begin, end);
+}
+
+bool server_config::load(const char *path, std::string &err) {
+    FILE *fp = fopen(path, "r");
+    if(!fp) {
+        err = std::string(path) + ": " + strerror(errno);
+        return false;
+    }
+    char line[1024];
+    int lineno = 0;
+    bool ok = true;
+    while(ok && fgets(line, sizeof(line), fp)) {
+        ++lineno;
+        char *end = line + strcspn(line, "#\n");
+        std::string text = trim(line, end);
+        if(text.empty()) {
+            continue;
+        }
+        size_t eq = text.find('=');
+        if(eq == std::string::npos ||
+           !set(trim(text.c_str(), text.c_str() + eq), trim(text.c_str() + eq + 1, text.c_str() + text.size()))) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), ":%d: ", lineno);
+            err = std::string(path) + buf + text;
+            ok = false;
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+bool server_config::set(const std::string &key, const std::string &value) {
+    for(int i=0; i<CONFIG_ITEM_NUMBER; ++i) {
+        const config_item &item = config_items[i];
+        if(key != item.m_name) {
+            continue;
+        }
+        if(item.m_int) {
+            char *end;
+            long v = strtol(value.c_str(), &end, 10);
+            if(value.empty() || *end != '\0' || v < 0 || v > 1000000000) {
+                return false;
+            }
+            this->*item.m_int = v;
+        } else if(item.m_bool) {
+            const char *v = value.c_str();
+            if(!strcasecmp(v, "on") || !strcasecmp(v, "yes") || !strcasecmp(v, "true") || !strcmp(v, "1")) {
+                this->*item.m_bool = true;
+            } else if(!strcasecmp(v, "off") || !strcasecmp(v, "no") || !strcasecmp(v, "false") || !strcmp(v, "0")) {
+                this->*item.m_bool = false;
+            } else {
+                return false;
+            }
+        } else {
+            this->*item.m_str = value;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool server_config::valid(std::string &err) const {
+    if(m_port <= 0 || m_port > 65535) {
+        err = "port must be 1-65535";
+    } else if(m_reactors <= 0 || m_workers <= 0 || m_queue_size <= 0 || m_backlog <= 0) {
+        err = "reactors, workers, queue_size and backlog must be positive";
+    } else if(m_max_fd < 1024 || m_max_fd < m_reactors) {
+        err = "max_fd must be at least 1024";
+    } else if(m_backend != "epoll" && m_backend != "uring" && m_backend != "coro") {
+        err = "backend must be epoll, uring or coro";
+    } else if(m_header_timeout <= 0 || m_idle_timeout <= 0 || m_write_timeout <= 0) {
+        err = "timeouts must be positive";
+    } else {
+        return true;
+    }
+    return false;
+}
+
+std::string server_config::restart_needed(const server_config &other) const {
+    std::string names;
+    for(int i=0; i<CONFIG_ITEM_NUMBER; ++i) {
+        const config_item &item = config_items[i];
+        bool changed = item.m_int ? this->*item.m_int != other.*item.m_int :
+                       item.m_bool ? this->*item.m_bool != other.*item.m_bool :
+                       this->*item.m_str != other.*item.m_str;
+        if(changed && !item.m_reloadable) {
+            if(!names.empty()) {
+                names += " ";
+            }
+            names += item.m_name;
+        }
+    }
+    return names;
+}
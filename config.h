@@ -0,0 +1,48 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+
+// 服务器配置：先取默认值，再读配置文件，最后用命令行参数覆盖。
+// 配置文件每行一项 key = value，#之后为注释；布尔值为on/off、yes/no、true/false或1/0。
+// 收到SIGHUP时按同样的顺序重新生成，doc_root、upload_dir、verbose、admission_target_ms立即生效，
+// 其余的项要通过平滑升级换到新进程
+struct server_config {
+    int m_port;
+    int m_reactors;                 // 反应堆数量
+    int m_workers;                  // 工作线程数量
+    int m_queue_size;               // 线程池请求队列的容量
+    int m_max_fd;                   // 连接表大小，fd不小于该值的连接直接拒绝
+    std::string m_doc_root;
+    std::string m_upload_dir;       // 为空时不接受PUT上传
+    int m_cache_mb;
+    int m_compress_mb;
+    std::string m_log_file;
+    bool m_verbose;
+    std::string m_backend;          // epoll、uring或coro
+    int m_backlog;
+    bool m_shared_listener;
+    int m_admission_target;         // 毫秒，0表示不做准入控制
+    bool m_inline;
+    std::string m_io_cpus;          // 为空时不绑定
+    std::string m_worker_cpus;
+    bool m_steer_incoming;
+    int m_header_timeout;           // 毫秒
+    int m_idle_timeout;
+    int m_write_timeout;
+    std::string m_handoff;          // 平滑升级用的Unix域socket路径，为空时不支持升级
+    int m_drain_timeout;            // 移交监听socket后等待已有连接结束的最长时间（秒）
+
+    server_config();
+
+    // 读取配置文件，出错时err中为出错的行和原因
+    bool load(const char *path, std::string &err);
+    // 按名字设置一项，名字未知或值格式错误时返回false
+    bool set(const std::string &key, const std::string &value);
+    // 检查取值范围
+    bool valid(std::string &err) const;
+    // 与other相比变化了的项中，需要重启才能生效的项名，以空格分隔
+    std::string restart_needed(const server_config &other) const;
+};
+
+#endif // CONFIG_H
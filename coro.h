@@ -0,0 +1,82 @@
+#ifndef CORO_H
+#define CORO_H
+
+// 以C++20编译（-std=c++20）时提供协程反应堆，否则只保留epoll和io_uring
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define HAVE_COROUTINES 1
+#endif
+#endif
+
+#ifdef HAVE_COROUTINES
+
+#include <stddef.h>
+#include <exception>
+#include <new>
+#include <coroutine>
+
+// 协程帧分配器：按64字节分级的每线程空闲链表。连接协程总是在所属反应堆线程中创建、恢复和结束，
+// 帧在同一线程分配和释放，不需要加锁；释放的帧留在链表中给下一个连接复用
+class frame_pool {
+public:
+    static void *alloc(size_t size) {
+        size_t cls = (size + GRANULE - 1) / GRANULE;
+        if(cls >= CLASS_NUMBER) {
+            return ::operator new(size);
+        }
+        free_list &list = local();
+        node *n = list.m_heads[cls];
+        if(n) {
+            list.m_heads[cls] = n->m_next;
+            return n;
+        }
+        return ::operator new(cls * GRANULE);
+    }
+
+    static void free(void *p, size_t size) {
+        size_t cls = (size + GRANULE - 1) / GRANULE;
+        if(cls >= CLASS_NUMBER) {
+            ::operator delete(p);
+            return;
+        }
+        free_list &list = local();
+        node *n = (node *)p;
+        n->m_next = list.m_heads[cls];
+        list.m_heads[cls] = n;
+    }
+
+private:
+    static const size_t GRANULE = 64;
+    static const size_t CLASS_NUMBER = 32;      // 2KB以上的帧直接用operator new
+
+    struct node {
+        node *m_next;
+    };
+    struct free_list {
+        node *m_heads[CLASS_NUMBER];
+    };
+
+    static free_list &local() {
+        static thread_local free_list list = {};
+        return list;
+    }
+};
+
+// 连接协程的返回类型：创建后立即运行到第一个挂起点，运行结束时自动释放协程帧；
+// 挂起期间连接被关闭时由反应堆调用destroy释放
+struct conn_task {
+    struct promise_type {
+        conn_task get_return_object() { return conn_task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        static void *operator new(size_t size) { return frame_pool::alloc(size); }
+        static void operator delete(void *p, size_t size) { frame_pool::free(p, size); }
+    };
+};
+
+#endif // HAVE_COROUTINES
+
+#endif // CORO_H
@@ -0,0 +1,274 @@
+#include "coro_reactor.h"
+
+#ifdef HAVE_COROUTINES
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/epoll.h>
+
+#include "logger.h"
+#include "admission.h"
+#include "topology.h"
+
+// 修改文件描述符，重置socket上的EPOLLONESHOT事件
+extern void modifyfd(int epollfd, int fd, int ev);
+
+coro_reactor::coro_reactor(int id, int port, conn_table *users, int max_users, http_threadpool *pool,
+                           const reactor_options &options) :
+    reactor(id, port, users, max_users, pool, options) {
+}
+
+coro_reactor::~coro_reactor() {
+}
+
+// 挂起操作表也迁移到所在节点
+void coro_reactor::place() {
+    reactor::place();
+    if(m_options.m_cpu >= 0) {
+        cpu_topology *topo = cpu_topology::get_instance();
+        topo->bind_memory(&m_ops[0], m_ops.size() * sizeof(io_op *), topo->node_of(m_options.m_cpu));
+    }
+}
+
+bool coro_reactor::start() {
+    m_ops.assign(m_users->size(), NULL);
+    return reactor::start();
+}
+
+bool coro_reactor::io_op::attempt(unsigned events) {
+    ssize_t n;
+    switch(m_kind) {
+    case OP_READABLE:
+        if(events == 0) {
+            return false;
+        }
+        m_result = events;
+        return true;
+    case OP_RECV:
+        n = ::recv(m_fd, m_buf, m_len, 0);
+        break;
+    case OP_SEND: {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = m_iov;
+        msg.msg_iovlen = m_iov_count;
+        n = sendmsg(m_fd, &msg, m_flags);
+        break;
+    }
+    case OP_SENDFILE:
+        n = ::sendfile(m_fd, m_file_fd, &m_offset, m_len);
+        break;
+    default:
+        return false;
+    }
+    if(n < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return false;
+        }
+        m_result = -errno;
+        return true;
+    }
+    m_result = n;
+    return true;
+}
+
+coro_reactor::io_awaiter coro_reactor::readable(http_conn *conn) {
+    io_awaiter a = { this, {} };
+    a.m_op.m_kind = OP_READABLE;
+    a.m_op.m_conn = conn;
+    a.m_op.m_fd = conn->sockfd();
+    return a;
+}
+
+coro_reactor::io_awaiter coro_reactor::recv(http_conn *conn, char *buf, size_t len) {
+    io_awaiter a = { this, {} };
+    a.m_op.m_kind = OP_RECV;
+    a.m_op.m_conn = conn;
+    a.m_op.m_fd = conn->sockfd();
+    a.m_op.m_buf = buf;
+    a.m_op.m_len = len;
+    return a;
+}
+
+coro_reactor::io_awaiter coro_reactor::send(http_conn *conn, int flags) {
+    io_awaiter a = { this, {} };
+    a.m_op.m_kind = OP_SEND;
+    a.m_op.m_conn = conn;
+    a.m_op.m_fd = conn->sockfd();
+    a.m_op.m_iov = conn->iv();
+    a.m_op.m_iov_count = conn->iv_count();
+    a.m_op.m_flags = flags;
+    return a;
+}
+
+coro_reactor::io_awaiter coro_reactor::sendfile(http_conn *conn, size_t count) {
+    io_awaiter a = { this, {} };
+    a.m_op.m_kind = OP_SENDFILE;
+    a.m_op.m_conn = conn;
+    a.m_op.m_fd = conn->sockfd();
+    a.m_op.m_file_fd = conn->file_fd();
+    a.m_op.m_offset = conn->file_offset();
+    a.m_op.m_len = count;
+    return a;
+}
+
+coro_reactor::pool_awaiter coro_reactor::run_in_pool(http_conn *conn) {
+    pool_awaiter a = { this, {}, false };
+    a.m_op.m_kind = OP_POOL;
+    a.m_op.m_conn = conn;
+    a.m_op.m_fd = conn->sockfd();
+    return a;
+}
+
+// 先登记再入队：工作线程可能在enqueue返回前就交还连接，但交还的连接只在反应堆线程中取出
+bool coro_reactor::pool_awaiter::await_suspend(std::coroutine_handle<> h) {
+    m_op.m_handle = h;
+    m_reactor->m_ops[m_op.m_fd] = &m_op;
+    m_admitted = m_reactor->enqueue(m_op.m_conn);
+    if(!m_admitted) {
+        m_reactor->m_ops[m_op.m_fd] = NULL;
+    }
+    return m_admitted;
+}
+
+// 等待发送期间按写超时计时，有进展时由下一次等待重新计时
+void coro_reactor::wait(io_op *op) {
+    m_ops[op->m_fd] = op;
+    if(op->m_kind == OP_SEND || op->m_kind == OP_SENDFILE) {
+        arm_timer(op->m_conn, http_conn::TIMER_WRITE);
+        modifyfd(m_epollfd, op->m_fd, EPOLLOUT);
+    } else {
+        modifyfd(m_epollfd, op->m_fd, EPOLLIN);
+    }
+}
+
+// 一个连接的全部处理：等待请求、解析处理、发送响应，直到出错、超时或对方要求关闭。
+// 空闲时只等待可读，不占用读缓冲区；协程挂起期间连接被定时器关闭时协程帧随之销毁
+conn_task coro_reactor::serve(http_conn *conn) {
+    int sockfd = conn->sockfd();
+    // 读缓冲区中的数据不足以构成完整的请求时必须先接收，不能只凭是否有未扫描的数据判断
+    bool need_input = true;
+    while(true) {
+        if(need_input || !conn->has_unparsed_input()) {
+            if(!conn->has_buffered_input()) {
+                co_await readable(conn);
+            }
+            char *buf;
+            int len;
+            if(!conn->input_space(&buf, &len)) {
+                break;
+            }
+            ssize_t n = co_await recv(conn, buf, len);
+            if(n <= 0) {
+                break;
+            }
+            conn->received(n);
+            if(conn->timer_kind() == http_conn::TIMER_IDLE || conn->reading_body()) {
+                // 长连接上开始了新的请求，请求头时限从现在算起；接收请求体期间每次有数据到达都重新计时
+                arm_timer(conn, http_conn::TIMER_HEADER);
+            }
+        }
+
+        int ret = m_options.m_inline ? conn->process_inline() : (int)http_conn::INLINE_DEFER;
+        if(ret == http_conn::INLINE_ERROR) {
+            break;
+        } else if(ret == http_conn::INLINE_WAIT) {
+            need_input = true;
+            continue;
+        } else if(ret == http_conn::INLINE_DEFER && !co_await run_in_pool(conn)) {
+            // 过载，回复503后关闭
+            admission::get_instance()->count_rejected();
+            http_conn::send_overloaded(sockfd);
+            break;
+        }
+
+        // 线程池也没有生成响应时同样要等待更多数据
+        need_input = !conn->writing();
+        // 发送整批响应，文件数据排在内存块之后
+        bool ok = true;
+        while(ok && conn->writing()) {
+            bool from_file = conn->iv_count() == 0;
+            ssize_t n;
+            if(!from_file) {
+                n = co_await send(conn, MSG_NOSIGNAL | (conn->file_fd() != -1 ? MSG_MORE : 0));
+            } else {
+                size_t left = conn->bytes_to_send();
+                n = co_await sendfile(conn, left < SENDFILE_CHUNK ? left : SENDFILE_CHUNK);
+            }
+            // sendfile返回0说明文件在发送过程中被截断，无法补齐Content-Length
+            ok = n > 0 || (n == 0 && !from_file);
+            if(ok) {
+                conn->sent(n, from_file);
+            }
+        }
+        if(!ok || !conn->finish_write()) {
+            break;
+        }
+        need_input = need_input || !conn->has_unparsed_input();
+        if(conn->has_buffered_input()) {
+            // 读缓冲区中有下一个请求的全部或一部分，仍按请求头时限计时
+            arm_timer(conn, http_conn::TIMER_HEADER);
+        } else {
+            arm_timer(conn, http_conn::TIMER_IDLE);
+        }
+    }
+    close_conn(conn);
+}
+
+void coro_reactor::open_conn(http_conn *conn, int connfd, struct sockaddr_in &addr) {
+    conn->init(connfd, addr, m_epollfd, &m_user_count, this, true);
+    arm_timer(conn, http_conn::TIMER_HEADER);
+    serve(conn);
+}
+
+// 重试挂起的操作，完成后恢复协程；对方断开时操作可能一直无法完成，以错误恢复
+void coro_reactor::handle_event(int sockfd, unsigned events) {
+    io_op *op = m_ops[sockfd];
+    if(!op || op->m_kind == OP_POOL) {
+        // 连接已在本轮关闭，或正在线程池中处理
+        return;
+    }
+    if(!op->attempt(events)) {
+        if(!(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+            wait(op);
+            return;
+        }
+        op->m_result = -ECONNRESET;
+    }
+    m_ops[sockfd] = NULL;
+    op->m_handle.resume();
+}
+
+// 连接关闭时销毁挂起中的协程帧，帧中的局部对象随之析构
+void coro_reactor::close_conn(http_conn *conn) {
+    int sockfd = conn->sockfd();
+    io_op *op = m_ops[sockfd];
+    if(op) {
+        m_ops[sockfd] = NULL;
+        op->m_handle.destroy();
+    }
+    reactor::close_conn(conn);
+}
+
+// 工作线程交还的连接：恢复挂起在线程池上的协程，由它继续发送或接收
+void coro_reactor::drain_posted() {
+    take_posted();
+    for(size_t i=0; i<m_draining.size(); ++i) {
+        http_conn *conn = m_draining[i].m_conn;
+        conn->set_busy(false);
+        int sockfd = conn->sockfd();
+        io_op *op = m_ops[sockfd];
+        if(op && op->m_kind == OP_POOL && op->m_conn == conn) {
+            m_ops[sockfd] = NULL;
+            op->m_result = m_draining[i].m_ev;
+            op->m_handle.resume();
+        }
+    }
+    m_draining.clear();
+}
+
+#endif // HAVE_COROUTINES
@@ -0,0 +1,98 @@
+#ifndef CORO_REACTOR_H
+#define CORO_REACTOR_H
+
+#include "coro.h"
+
+#ifdef HAVE_COROUTINES
+
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "reactor.h"
+
+// 协程反应堆：与epoll反应堆共用同一个事件循环、连接表、时间轮和线程池，每个连接由一个协程驱动，
+// 接收、处理、发送写成顺序的代码。recv、send、sendfile等操作先直接尝试，会阻塞时才挂起协程、
+// 登记EPOLLONESHOT事件，就绪后由反应堆重试并在完成时恢复协程；需要读盘的请求交给线程池，
+// 协程挂起到工作线程交还连接为止
+class coro_reactor : public reactor {
+public:
+    coro_reactor(int id, int port, conn_table *users, int max_users, http_threadpool *pool,
+                 const reactor_options &options);
+    ~coro_reactor();
+    bool start();
+
+private:
+    static const size_t SENDFILE_CHUNK = 1024 * 1024;  // 每次sendfile的最大字节数，与epoll反应堆相同
+
+    enum OP {
+        OP_READABLE = 0,    // 只等待可读，空闲连接等待期间不占用读缓冲区
+        OP_RECV,
+        OP_SEND,            // sendmsg发送iovec
+        OP_SENDFILE,
+        OP_POOL             // 在线程池中处理，由工作线程交还
+    };
+
+    // 挂起中的一次操作，存放在等待它的协程帧中
+    struct io_op {
+        int m_kind;
+        http_conn *m_conn;
+        int m_fd;
+        char *m_buf;
+        size_t m_len;
+        struct iovec *m_iov;
+        int m_iov_count;
+        int m_flags;
+        int m_file_fd;
+        off_t m_offset;
+        ssize_t m_result;               // 完成时的返回值，失败为负的错误码
+        std::coroutine_handle<> m_handle;
+
+        // 执行一次系统调用，会阻塞时返回false；events为就绪的事件，第一次尝试时为0
+        bool attempt(unsigned events);
+    };
+
+    struct io_awaiter {
+        coro_reactor *m_reactor;
+        io_op m_op;
+
+        bool await_ready() { return m_op.attempt(0); }
+        void await_suspend(std::coroutine_handle<> h) {
+            m_op.m_handle = h;
+            m_reactor->wait(&m_op);
+        }
+        ssize_t await_resume() { return m_op.m_result; }
+    };
+
+    // 交给线程池：过载被拒绝时不挂起，返回false；否则挂起到工作线程交还连接，返回true
+    struct pool_awaiter {
+        coro_reactor *m_reactor;
+        io_op m_op;
+        bool m_admitted;
+
+        bool await_ready() { return false; }
+        bool await_suspend(std::coroutine_handle<> h);
+        bool await_resume() { return m_admitted; }
+    };
+
+    io_awaiter readable(http_conn *conn);
+    io_awaiter recv(http_conn *conn, char *buf, size_t len);
+    io_awaiter send(http_conn *conn, int flags);            // 发送连接的iovec
+    io_awaiter sendfile(http_conn *conn, size_t count);     // 从连接的文件偏移发送
+    pool_awaiter run_in_pool(http_conn *conn);
+
+    conn_task serve(http_conn *conn);           // 连接协程
+    void wait(io_op *op);                       // 登记事件，就绪后重试op
+    void place();
+    void open_conn(http_conn *conn, int connfd, struct sockaddr_in &addr);
+    void handle_event(int fd, unsigned events);
+    void close_conn(http_conn *conn);
+    void drain_posted();
+
+private:
+    std::vector<io_op *> m_ops;                 // 按fd索引，各连接当前挂起的操作
+};
+
+#endif // HAVE_COROUTINES
+
+#endif // CORO_REACTOR_H
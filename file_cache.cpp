@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/inotify.h>
+
+#include "file_cache.h"
+#include "http_header.h"
+
+file_cache *file_cache::get_instance() {
+    // 不析构：进程退出时工作线程可能仍持有条目
+    static file_cache *instance = new file_cache();
+    return instance;
+}
+
+file_cache::file_cache() : m_byte_budget(0), m_shard_budget(0), m_max_file_size(0),
+    m_bytes(0), m_hits(0), m_misses(0), m_inotifyfd(-1), m_notify_thread(0) {
+    for(int i=0; i<SHARD_NUMBER; ++i) {
+        m_shards[i].m_buckets = NULL;
+        m_shards[i].m_bucket_mask = 0;
+        m_shards[i].m_count = 0;
+        m_shards[i].m_hand = 0;
+        m_shards[i].m_bytes = 0;
+    }
+}
+
+file_cache::~file_cache() {
+}
+
+bool file_cache::init(size_t byte_budget, size_t max_file_size) {
+    m_byte_budget = byte_budget;
+    m_shard_budget = byte_budget / SHARD_NUMBER;
+    m_max_file_size = max_file_size < m_shard_budget ? max_file_size : m_shard_budget;
+    if(!enabled()) {
+        return true;
+    }
+
+    for(int i=0; i<SHARD_NUMBER; ++i) {
+        m_shards[i].m_bucket_mask = 255;
+        m_shards[i].m_buckets = new file_entry*[m_shards[i].m_bucket_mask + 1]();
+    }
+
+    // inotify不可用时退化为按mtime检查
+    m_inotifyfd = inotify_init1(IN_CLOEXEC);
+    if(m_inotifyfd >= 0 && pthread_create(&m_notify_thread, NULL, notify_worker, this) == 0) {
+        pthread_detach(m_notify_thread);
+    } else if(m_inotifyfd >= 0) {
+        close(m_inotifyfd);
+        m_inotifyfd = -1;
+    }
+    return true;
+}
+
+// FNV-1a
+unsigned long long file_cache::hash(const char *path) {
+    unsigned long long h = 14695981039346656037ull;
+    for(; *path; ++path) {
+        h ^= (unsigned char)*path;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+file_entry *file_cache::find(shard &s, const char *path, unsigned long long h) {
+    file_entry *e = s.m_buckets[(h >> 8) & s.m_bucket_mask];
+    for(; e; e = e->m_next) {
+        if(e->m_hash == h && strcmp(e->m_path, path) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+file_entry *file_cache::acquire(const char *path) {
+    if(!enabled()) {
+        return NULL;
+    }
+    unsigned long long h = hash(path);
+    shard &s = shard_of(h);
+
+    s.m_lock.rdlock();
+    file_entry *e = find(s, path, h);
+    if(e && !stale(e)) {
+        e->m_refs.fetch_add(1, std::memory_order_relaxed);
+        e->m_referenced.store(true, std::memory_order_relaxed);
+        s.m_lock.unlock();
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+        return e;
+    }
+    s.m_lock.unlock();
+
+    if(e) {
+        invalidate(path);
+    }
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    return NULL;
+}
+
+file_entry *file_cache::load(const char *path, const struct stat &st) {
+    if(!enabled() || !S_ISREG(st.st_mode) || (size_t)st.st_size > m_max_file_size) {
+        return NULL;
+    }
+
+    // 先监听目录再读取，读取期间发生的修改也能使条目失效
+    if(m_inotifyfd >= 0) {
+        watch(path);
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return NULL;
+    }
+    file_entry *e = new file_entry;
+    if(fstat(fd, &e->m_stat) < 0 || (size_t)e->m_stat.st_size > m_max_file_size) {
+        close(fd);
+        delete e;
+        return NULL;
+    }
+    size_t size = e->m_stat.st_size;
+    e->m_data = (char *)malloc(size ? size : 1);
+    size_t done = 0;
+    while(e->m_data && done < size) {
+        ssize_t n = read(fd, e->m_data + done, size - done);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+    if(!e->m_data || done != size) {
+        // 读取期间文件被截断
+        free(e->m_data);
+        delete e;
+        return NULL;
+    }
+
+    e->m_path = strdup(path);
+    e->m_hash = hash(path);
+    char etag[http_header::ETAG_SIZE];
+    char last_modified[http_header::DATE_SIZE];
+    http_header::format_etag(e->m_stat, etag, sizeof(etag));
+    http_header::format_date(e->m_stat.st_mtime, last_modified, sizeof(last_modified));
+    const char *type = http_header::mime_type(path);
+    e->m_headers_len = snprintf(e->m_headers, sizeof(e->m_headers),
+        "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\nContent-Type: %s\r\n%s"
+        "ETag: %s\r\nLast-Modified: %s\r\nAccept-Ranges: bytes\r\n", (long long)size, type,
+        http_header::compressible(type) ? "Vary: Accept-Encoding\r\n" : "", etag, last_modified);
+    if(e->m_headers_len >= (int)sizeof(e->m_headers)) {
+        // 响应头被截断（如MIME类型过长），不缓存，由调用者走普通路径
+        free(e->m_data);
+        free(e->m_path);
+        delete e;
+        return NULL;
+    }
+    e->m_refs.store(2, std::memory_order_relaxed);  // 缓存一个，调用者一个
+    e->m_referenced.store(false, std::memory_order_relaxed);
+    e->m_checked.store(time(NULL), std::memory_order_relaxed);
+    e->m_next = NULL;
+    e->m_clock_index = -1;
+
+    shard &s = shard_of(e->m_hash);
+    size_t need = size + strlen(e->m_path);
+    s.m_lock.wrlock();
+    file_entry *old = find(s, path, e->m_hash);
+    if(old) {
+        // 其他线程已加载同一文件
+        unlink(s, old);
+    }
+    evict(s, need);
+    size_t idx = (e->m_hash >> 8) & s.m_bucket_mask;
+    e->m_next = s.m_buckets[idx];
+    s.m_buckets[idx] = e;
+    e->m_clock_index = s.m_clock.size();
+    s.m_clock.push_back(e);
+    s.m_bytes += need;
+    if(++s.m_count > s.m_bucket_mask) {
+        rehash(s);
+    }
+    s.m_lock.unlock();
+    m_bytes.fetch_add(need, std::memory_order_relaxed);
+    return e;
+}
+
+void file_cache::release(file_entry *entry) {
+    if(entry->m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        free(entry->m_data);
+        free(entry->m_path);
+        delete entry;
+    }
+}
+
+void file_cache::invalidate(const char *path) {
+    if(!enabled()) {
+        return;
+    }
+    unsigned long long h = hash(path);
+    shard &s = shard_of(h);
+    s.m_lock.wrlock();
+    file_entry *e = find(s, path, h);
+    if(e) {
+        unlink(s, e);
+    }
+    s.m_lock.unlock();
+}
+
+void file_cache::invalidate_all() {
+    for(int i=0; i<SHARD_NUMBER; ++i) {
+        shard &s = m_shards[i];
+        s.m_lock.wrlock();
+        while(!s.m_clock.empty()) {
+            unlink(s, s.m_clock.back());
+        }
+        s.m_lock.unlock();
+    }
+}
+
+void file_cache::unlink(shard &s, file_entry *entry) {
+    file_entry **p = &s.m_buckets[(entry->m_hash >> 8) & s.m_bucket_mask];
+    while(*p && *p != entry) {
+        p = &(*p)->m_next;
+    }
+    if(*p) {
+        *p = entry->m_next;
+    }
+
+    // 用CLOCK环的最后一个元素填补空位
+    file_entry *last = s.m_clock.back();
+    s.m_clock[entry->m_clock_index] = last;
+    last->m_clock_index = entry->m_clock_index;
+    s.m_clock.pop_back();
+    if(s.m_hand >= s.m_clock.size()) {
+        s.m_hand = 0;
+    }
+
+    size_t bytes = entry->m_stat.st_size + strlen(entry->m_path);
+    s.m_bytes -= bytes;
+    --s.m_count;
+    m_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    release(entry);
+}
+
+void file_cache::evict(shard &s, size_t need) {
+    // 访问位为1的条目获得第二次机会，最多扫描两圈
+    size_t budget = s.m_clock.size() * 2;
+    while(s.m_bytes + need > m_shard_budget && !s.m_clock.empty() && budget-- > 0) {
+        file_entry *e = s.m_clock[s.m_hand];
+        if(e->m_referenced.exchange(false, std::memory_order_relaxed)) {
+            s.m_hand = (s.m_hand + 1) % s.m_clock.size();
+        } else {
+            unlink(s, e);
+        }
+    }
+    while(s.m_bytes + need > m_shard_budget && !s.m_clock.empty()) {
+        unlink(s, s.m_clock[s.m_hand]);
+    }
+}
+
+void file_cache::rehash(shard &s) {
+    size_t mask = s.m_bucket_mask * 2 + 1;
+    file_entry **buckets = new file_entry*[mask + 1]();
+    for(size_t i=0; i<s.m_clock.size(); ++i) {
+        file_entry *e = s.m_clock[i];
+        size_t idx = (e->m_hash >> 8) & mask;
+        e->m_next = buckets[idx];
+        buckets[idx] = e;
+    }
+    delete[] s.m_buckets;
+    s.m_buckets = buckets;
+    s.m_bucket_mask = mask;
+}
+
+bool file_cache::stale(file_entry *entry) {
+    if(m_inotifyfd >= 0) {
+        return false;
+    }
+    time_t now = time(NULL);
+    time_t checked = entry->m_checked.load(std::memory_order_relaxed);
+    if(now == checked || !entry->m_checked.compare_exchange_strong(checked, now)) {
+        return false;
+    }
+    struct stat st;
+    return stat(entry->m_path, &st) < 0 || st.st_mtime != entry->m_stat.st_mtime ||
+           st.st_size != entry->m_stat.st_size || st.st_ino != entry->m_stat.st_ino;
+}
+
+void file_cache::watch(const char *path) {
+    const char *slash = strrchr(path, '/');
+    if(!slash) {
+        return;
+    }
+    std::string dir(path, slash - path);
+    m_watch_lock.lock();
+    if(m_watched_dirs.find(dir) == m_watched_dirs.end()) {
+        int wd = inotify_add_watch(m_inotifyfd, dir.c_str(),
+            IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+            IN_DELETE_SELF | IN_MOVE_SELF);
+        if(wd >= 0) {
+            m_watches[wd] = dir;
+            m_watched_dirs[dir] = wd;
+        }
+    }
+    m_watch_lock.unlock();
+}
+
+void *file_cache::notify_worker(void *arg) {
+    file_cache *cache = (file_cache *)arg;
+    cache->notify_loop();
+    return cache;
+}
+
+// 处理inotify事件，使被修改、删除、移动的文件对应的条目失效
+void file_cache::notify_loop() {
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char path[4096];
+    while(true) {
+        ssize_t len = read(m_inotifyfd, buf, sizeof(buf));
+        if(len < 0 && errno == EINTR) {
+            continue;
+        }
+        if(len <= 0) {
+            break;
+        }
+        for(char *p = buf; p < buf + len; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if(ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                // 事件丢失或目录本身变化，无法确定影响范围
+                if(ev->mask & IN_IGNORED) {
+                    m_watch_lock.lock();
+                    std::map<int, std::string>::iterator it = m_watches.find(ev->wd);
+                    if(it != m_watches.end()) {
+                        m_watched_dirs.erase(it->second);
+                        m_watches.erase(it);
+                    }
+                    m_watch_lock.unlock();
+                }
+                invalidate_all();
+                continue;
+            }
+            if(ev->len == 0) {
+                continue;
+            }
+
+            m_watch_lock.lock();
+            std::map<int, std::string>::iterator it = m_watches.find(ev->wd);
+            bool found = it != m_watches.end();
+            if(found) {
+                snprintf(path, sizeof(path), "%s/%s", it->second.c_str(), ev->name);
+            }
+            m_watch_lock.unlock();
+            if(found) {
+                invalidate(path);
+            }
+        }
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <map>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "locker.h"
+
+// 缓存的文件条目，请求通过引用计数借用，最后一个引用释放时回收内存
+struct file_entry {
+    char *m_path;                       // 解析后的完整路径，即缓存键
+    unsigned long long m_hash;
+    char *m_data;                       // 文件内容
+    struct stat m_stat;                 // 加载时的文件状态，大小和修改时间以此为准
+    char m_headers[256];                // 预先生成的响应头：状态行、Content-Length、Content-Type、校验器
+    int m_headers_len;
+    std::atomic<int> m_refs;            // 缓存本身持有一个引用
+    std::atomic<bool> m_referenced;     // CLOCK淘汰的访问位
+    std::atomic<time_t> m_checked;      // 无inotify时上次检查mtime的时间
+    file_entry *m_next;                 // 哈希桶链表
+    int m_clock_index;                  // 在所属分片CLOCK数组中的位置
+};
+
+// 静态文件缓存：按路径哈希分片，每个分片一把读写锁、一个链式哈希表和一个CLOCK环，
+// 总内存受字节预算限制。修改通过inotify监听所在目录失效，inotify不可用时每秒
+// 最多stat一次比较mtime。命中时不做任何文件系统调用
+class file_cache {
+public:
+    static const int SHARD_NUMBER = 16;
+
+    static file_cache *get_instance();
+
+    // byte_budget为0时禁用缓存，大于max_file_size的文件不缓存
+    bool init(size_t byte_budget, size_t max_file_size);
+    bool enabled() const { return m_byte_budget > 0; }
+    size_t max_file_size() const { return m_max_file_size; }
+
+    // 查找缓存，命中返回已增加引用的条目，用完调用release
+    file_entry *acquire(const char *path);
+    // 读取文件内容并加入缓存，st为调用者刚取得的文件状态，失败返回NULL
+    file_entry *load(const char *path, const struct stat &st);
+    void release(file_entry *entry);
+    // 使路径对应的条目失效
+    void invalidate(const char *path);
+    void invalidate_all();
+
+    size_t bytes() const { return m_bytes.load(std::memory_order_relaxed); }
+    unsigned long long hits() const { return m_hits.load(std::memory_order_relaxed); }
+    unsigned long long misses() const { return m_misses.load(std::memory_order_relaxed); }
+
+    // 路径的FNV-1a哈希，compress_cache按同一哈希分片
+    static unsigned long long hash(const char *path);
+
+private:
+    file_cache();
+    ~file_cache();
+
+    struct alignas(64) shard {
+        rwlocker m_lock;
+        file_entry **m_buckets;
+        size_t m_bucket_mask;
+        size_t m_count;
+        std::vector<file_entry *> m_clock;  // CLOCK环
+        size_t m_hand;                      // CLOCK指针
+        size_t m_bytes;
+    };
+
+    shard &shard_of(unsigned long long h) { return m_shards[h % SHARD_NUMBER]; }
+    file_entry *find(shard &s, const char *path, unsigned long long h);
+    void unlink(shard &s, file_entry *entry);   // 从分片中移除并放弃缓存持有的引用，需持写锁
+    void evict(shard &s, size_t need);          // 按CLOCK淘汰直到分片腾出need字节，需持写锁
+    void rehash(shard &s);
+    bool stale(file_entry *entry);              // 无inotify时检查mtime
+    void watch(const char *path);               // 监听路径所在目录
+    static void *notify_worker(void *arg);
+    void notify_loop();
+
+private:
+    size_t m_byte_budget;
+    size_t m_shard_budget;
+    size_t m_max_file_size;
+    shard m_shards[SHARD_NUMBER];
+    std::atomic<size_t> m_bytes;
+    std::atomic<unsigned long long> m_hits;
+    std::atomic<unsigned long long> m_misses;
+
+    int m_inotifyfd;
+    pthread_t m_notify_thread;
+    locker m_watch_lock;
+    std::map<int, std::string> m_watches;       // inotify监听描述符 -> 目录
+    std::map<std::string, int> m_watched_dirs;
+};
+
+#endif // FILE_CACHE_H
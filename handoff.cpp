@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdint.h>
+
+#include "handoff.h"
+
+static const uint32_t HANDOFF_MAGIC = 0x57534844;   // "WSHD"
+static const char TAKEOVER_MSG[] = "TAKEOVER";
+static const char READY_MSG[] = "READY";
+static const char CONFIRM_MSG[] = "BYE";
+
+// 控制消息的缓冲区须按cmsghdr对齐
+union control_buffer {
+    char m_buf[CMSG_SPACE(sizeof(int) * handoff::MAX_LISTENERS)];
+    struct cmsghdr m_align;
+};
+
+// 随监听socket一起发送的说明
+struct handoff_header {
+    uint32_t m_magic;
+    uint32_t m_count;
+    uint32_t m_shared;
+    int32_t m_port;
+};
+
+static bool make_address(const char *path, struct sockaddr_un &addr) {
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    return true;
+}
+
+// 等待最多timeout_ms毫秒，收到完整的一条消息时返回true
+static bool expect(int conn, const char *msg, int timeout_ms) {
+    struct pollfd pfd = { conn, POLLIN, 0 };
+    char buf[16];
+    if(poll(&pfd, 1, timeout_ms) != 1) {
+        return false;
+    }
+    ssize_t n = recv(conn, buf, sizeof(buf), 0);
+    return n == (ssize_t)strlen(msg) && memcmp(buf, msg, n) == 0;
+}
+
+static bool say(int conn, const char *msg) {
+    return send(conn, msg, strlen(msg), MSG_NOSIGNAL) == (ssize_t)strlen(msg);
+}
+
+int handoff::take_over(const char *path, listeners &ls) {
+    struct sockaddr_un addr;
+    if(!make_address(path, addr)) {
+        return -1;
+    }
+    // 消息有边界，一次recv收到一条
+    int conn = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(conn < 0) {
+        return -1;
+    }
+    if(connect(conn, (struct sockaddr *)&addr, sizeof(addr)) < 0 || !say(conn, TAKEOVER_MSG)) {
+        // 没有旧进程
+        close(conn);
+        return -1;
+    }
+
+    handoff_header header;
+    struct iovec iov = { &header, sizeof(header) };
+    control_buffer control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.m_buf;
+    msg.msg_controllen = sizeof(control.m_buf);
+    struct pollfd pfd = { conn, POLLIN, 0 };
+    ssize_t n = poll(&pfd, 1, 5000) == 1 ? recvmsg(conn, &msg, MSG_CMSG_CLOEXEC) : -1;
+
+    ls.m_fds.clear();
+    for(struct cmsghdr *c = CMSG_FIRSTHDR(&msg); n > 0 && c; c = CMSG_NXTHDR(&msg, c)) {
+        if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+            int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int *fds = (const int *)CMSG_DATA(c);
+            ls.m_fds.assign(fds, fds + count);
+        }
+    }
+    if(n != sizeof(header) || header.m_magic != HANDOFF_MAGIC || header.m_count != ls.m_fds.size() ||
+       ls.m_fds.empty() || (msg.msg_flags & MSG_CTRUNC)) {
+        for(size_t i=0; i<ls.m_fds.size(); ++i) {
+            close(ls.m_fds[i]);
+        }
+        ls.m_fds.clear();
+        close(conn);
+        return -1;
+    }
+    ls.m_shared = header.m_shared != 0;
+    ls.m_port = header.m_port;
+    return conn;
+}
+
+bool handoff::finish(int conn) {
+    // 旧进程停止接收只需关闭几个事件，很快就能确认
+    bool ok = say(conn, READY_MSG) && expect(conn, CONFIRM_MSG, 5000);
+    close(conn);
+    return ok;
+}
+
+int handoff::listen(const char *path) {
+    struct sockaddr_un addr;
+    if(!make_address(path, addr)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    unlink(path);
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(fd, 4) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int handoff::serve(int listenfd, const listeners &ls, int timeout_ms) {
+    int conn = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+    if(conn < 0) {
+        return -1;
+    }
+    if(!expect(conn, TAKEOVER_MSG, 1000) || ls.m_fds.empty() || ls.m_fds.size() > MAX_LISTENERS) {
+        close(conn);
+        return -1;
+    }
+
+    handoff_header header = { HANDOFF_MAGIC, (uint32_t)ls.m_fds.size(), ls.m_shared, ls.m_port };
+    struct iovec iov = { &header, sizeof(header) };
+    control_buffer control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.m_buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * ls.m_fds.size());
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) * ls.m_fds.size());
+    memcpy(CMSG_DATA(c), &ls.m_fds[0], sizeof(int) * ls.m_fds.size());
+    if(sendmsg(conn, &msg, MSG_NOSIGNAL) != sizeof(header)) {
+        close(conn);
+        return -1;
+    }
+
+    // 新进程启动失败时连接被关闭，旧进程继续服务
+    if(!expect(conn, READY_MSG, timeout_ms)) {
+        close(conn);
+        return -1;
+    }
+    return conn;
+}
+
+void handoff::confirm(int conn) {
+    say(conn, CONFIRM_MSG);
+    close(conn);
+}
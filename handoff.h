@@ -0,0 +1,35 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <vector>
+
+// 平滑升级：运行中的进程在Unix域socket上等待新进程。新进程启动时先连接该socket，
+// 旧进程用SCM_RIGHTS把监听socket发给它；新进程用这些socket启动反应堆后回复就绪，
+// 旧进程随即停止接收新连接并确认，之后只处理完已有的连接就退出。
+// 监听socket始终打开，升级期间到达的连接留在监听队列中由其中一个进程接收，不会被拒绝。
+// 新进程收到确认后接替旧进程在该路径上等待下一次升级
+class handoff {
+public:
+    static const int MAX_LISTENERS = 256;
+
+    // 监听socket的集合：各反应堆的SO_REUSEPORT socket，按加入端口的顺序排列，或一个共用的socket
+    struct listeners {
+        std::vector<int> m_fds;
+        bool m_shared;
+        int m_port;
+    };
+
+    // 新进程：连接path上的旧进程并取得监听socket，返回与旧进程的连接，没有旧进程或失败时返回-1
+    static int take_over(const char *path, listeners &ls);
+    // 新进程：反应堆都已启动，通知旧进程停止接收新连接，等它确认
+    static bool finish(int conn);
+
+    // 在path上等待升级请求，删除残留的socket文件
+    static int listen(const char *path);
+    // 旧进程：接受一个升级请求并发送监听socket，等新进程就绪，超时或新进程失败时返回-1
+    static int serve(int listenfd, const listeners &ls, int timeout_ms);
+    // 旧进程：已停止接收新连接，确认后关闭连接
+    static void confirm(int conn);
+};
+
+#endif // HANDOFF_H
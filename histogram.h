@@ -0,0 +1,74 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+// 对数线性直方图（HDR风格）的档位划分：小于16的值各占一档，
+// 之后每个2的幂区间再分16档，相对误差约6%
+struct log_linear {
+    static const int SUB_BITS = 4;
+    static const int BUCKETS = 64 << SUB_BITS;
+
+    static int index(uint64_t v) {
+        if(v < (1u << SUB_BITS)) {
+            return (int)v;
+        }
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - SUB_BITS;
+        return ((shift + 1) << SUB_BITS) + (int)((v >> shift) & ((1u << SUB_BITS) - 1));
+    }
+    // 档位的上界
+    static uint64_t upper(int idx) {
+        if(idx < (1 << SUB_BITS)) {
+            return idx;
+        }
+        int shift = (idx >> SUB_BITS) - 1;
+        uint64_t base = ((uint64_t)(1u << SUB_BITS) + (idx & ((1u << SUB_BITS) - 1))) << shift;
+        return base + ((uint64_t)1 << shift) - 1;
+    }
+};
+
+// 只在一个线程内使用的直方图，各线程结束后用merge汇总
+struct histogram : log_linear {
+    uint64_t m_counts[BUCKETS];
+    uint64_t m_max;
+
+    histogram() : m_max(0) { memset(m_counts, 0, sizeof(m_counts)); }
+
+    void record(uint64_t v) {
+        ++m_counts[index(v)];
+        if(v > m_max) {
+            m_max = v;
+        }
+    }
+    void merge(const histogram &h) {
+        for(int i=0; i<BUCKETS; ++i) {
+            m_counts[i] += h.m_counts[i];
+        }
+        if(h.m_max > m_max) {
+            m_max = h.m_max;
+        }
+    }
+    uint64_t total() const {
+        uint64_t n = 0;
+        for(int i=0; i<BUCKETS; ++i) {
+            n += m_counts[i];
+        }
+        return n;
+    }
+    // 第p百分位所在档位的上界，不超过最大值
+    uint64_t percentile(double p) const {
+        uint64_t target = (uint64_t)(total() * p / 100.0);
+        uint64_t seen = 0;
+        for(int i=0; i<BUCKETS; ++i) {
+            seen += m_counts[i];
+            if(seen > target) {
+                return upper(i) < m_max ? upper(i) : m_max;
+            }
+        }
+        return m_max;
+    }
+};
+
+#endif // HISTOGRAM_H
@@ -11,35 +11,84 @@
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
-#include <stdarg.h>
 #include <errno.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 
 #include "http_conn.h"
 #include "locker.h"
+#include "buffer_pool.h"
+#include "http_scanner.h"
+#include "logger.h"
+#include "metrics.h"
+#include "compress_cache.h"
+#include "reactor.h"
+#include "admission.h"
 
-const char *doc_root = "/root/codes/webserver/root";    // 网站根目录
+// 重新加载配置时由主线程替换，旧的字符串可能仍被正在处理的请求使用，不释放
+std::atomic<const char *> doc_root("/root/codes/webserver/root");  // 网站根目录
+std::atomic<const char *> upload_root(NULL);    // PUT上传文件的目录，NULL表示不接受上传
+static std::atomic<bool> s_draining(false);     // 监听socket已移交给新进程
 
-//定义HTTP响应的些状态信息
-const char* ok_200_title = "OK";
-const char* error_400_title = "Bad Request";
-const char* error_400_form = "error_400_form: BAD_REQUEST\n";
-const char* error_403_title = "Forbidden";
-const char* error_403_form = "error_403_form: FORBIDDED_REQUEST\n";
-const char* error_404_title = "Not Found";
-const char* error_404_form = "The requested file was not found on this server. \n";
-const char* error_500_title = "Internal Error";
-const char* error_500_form = "error_500_form: INTERNAL_ERROR\n";
+// 请求方法名，下标为http_conn::METHOD
+static const char *method_names[] = { "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT" };
 
+//定义HTTP响应的状态行
+static const char ok_200_status[] = "HTTP/1.1 200 OK\r\n";
+static const char created_201_status[] = "HTTP/1.1 201 Created\r\n";
+static const char partial_206_status[] = "HTTP/1.1 206 Partial Content\r\n";
+static const char not_modified_304_status[] = "HTTP/1.1 304 Not Modified\r\n";
+static const char error_405_status[] = "HTTP/1.1 405 Method Not Allowed\r\n";
+static const char error_405_form[] = "error_405_form: METHOD_NOT_ALLOWED\n";
+static const char error_416_status[] = "HTTP/1.1 416 Range Not Satisfiable\r\n";
+static const char error_416_form[] = "error_416_form: RANGE_NOT_SATISFIABLE\n";
 
-// 设置文件描述符非阻塞
-int setnonblocking(int fd) {
-    int old_flag = fcntl(fd, F_GETFL);
-    int new_flag = old_flag | O_NONBLOCK;
-    fcntl(fd, F_SETFL, new_flag);
+// 预先生成的完整错误响应：Date之前的部分按是否保持连接各一份，Date之后是空行和响应体
+struct error_response {
+    int m_status;
+    const char *m_title;
+    const char *m_form;
+    const char *m_extra;            // 额外的响应头
+    char m_head[2][160];
+    int m_head_len[2];
+    char m_tail[128];
+    int m_tail_len;
+};
+static error_response error_responses[] = {
+    { 400, "Bad Request", "error_400_form: BAD_REQUEST\n", "" },
+    { 403, "Forbidden", "error_403_form: FORBIDDED_REQUEST\n", "" },
+    { 404, "Not Found", "The requested file was not found on this server. \n", "" },
+    { 413, "Payload Too Large", "error_413_form: PAYLOAD_TOO_LARGE\n", "" },
+    { 500, "Internal Error", "error_500_form: INTERNAL_ERROR\n", "" },
+    // 过载时由反应堆直接回复，之后关闭连接
+    { 503, "Service Unavailable", "error_503_form: SERVICE_UNAVAILABLE\n", "Retry-After: 1\r\n" }
+};
+
+static bool build_error_responses() {
+    for(size_t i=0; i<sizeof(error_responses) / sizeof(error_responses[0]); ++i) {
+        error_response &r = error_responses[i];
+        for(int linger=0; linger<2; ++linger) {
+            r.m_head_len[linger] = snprintf(r.m_head[linger], sizeof(r.m_head[linger]),
+                "HTTP/1.1 %d %s\r\n%sContent-Length: %d\r\nContent-Type: text/html\r\nConnection: %s\r\n",
+                r.m_status, r.m_title, r.m_extra, (int)strlen(r.m_form), linger ? "keep-alive" : "close");
+        }
+        r.m_tail_len = snprintf(r.m_tail, sizeof(r.m_tail), "\r\n%s", r.m_form);
+    }
+    return true;
 }
+static bool error_responses_built = build_error_responses();
 
-// 向epoll中增加需要监听的文件标识符
+static const error_response *find_error(int status) {
+    for(size_t i=0; i<sizeof(error_responses) / sizeof(error_responses[0]); ++i) {
+        if(error_responses[i].m_status == status) {
+            return &error_responses[i];
+        }
+    }
+    return NULL;
+}
+
+
+// 向epoll中增加需要监听的文件标识符，fd已由accept4设为非阻塞
 void addfd(int epollfd, int fd, bool one_shot) {
     epoll_event event;
     event.data.fd = fd;
@@ -49,11 +98,9 @@ void addfd(int epollfd, int fd, bool one_shot) {
     event.events = EPOLLIN | EPOLLRDHUP;  // 边缘触发，防止一直读数据，主线程一般不用
     // EPOLLONESHOT事件：5.6第六节 37.30
     if(one_shot) {
-        event.events | EPOLLONESHOT;
+        event.events |= EPOLLONESHOT;
     }
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    // 设置文件描述符非阻塞 
-    setnonblocking(fd);
 }
 
 // 从epoll中移除监听的文件描述符
@@ -71,21 +118,27 @@ void modifyfd(int epollfd, int fd, int ev) {
 }
 
 
-int http_conn::m_epollfd = -1;
-int http_conn::m_user_count = 0;
-
 // 初始化连接
-void http_conn::init(int sockfd, struct sockaddr_in &addr){
+void http_conn::init(int sockfd, struct sockaddr_in &addr, int epollfd, std::atomic<int> *user_count,
+                     reactor *owner, bool reactor_io){
     m_sockfd = sockfd;
     m_address = addr;
+    m_epollfd = epollfd;
+    m_owner = owner;
+    m_reactor_io = reactor_io;
+    m_user_count = user_count;
 
-    // 端口复用
-    int reuse = 1;
-    setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-
-    // 增加到epoll对象中
-    addfd(m_epollfd, m_sockfd, true);
-    ++m_user_count;   
+    if(m_epollfd != -1) {
+        // 增加到epoll对象中
+        addfd(m_epollfd, m_sockfd, true);
+    } else {
+        // 读写都以io_uring操作提交，由所属反应堆在完成事件中推进
+        m_uring_io.m_pipe_bytes = 0;
+        m_uring_io.m_inflight = 0;
+        m_uring_io.m_failed = false;
+        m_uring_io.m_closing = false;
+    }
+    ++*m_user_count;
 
     // 初始化连接其余信息
     init();
@@ -93,50 +146,187 @@ void http_conn::init(int sockfd, struct sockaddr_in &addr){
 
 // 初始化连接其余信息
 void http_conn::init() {
-    m_check_state = CHECK_STATE_REQUESTLINE; // 初始化状态为解析请求首行
-
-    bzero(m_read_buf, READ_BUFFER_SIZE);
     m_read_index = 0;
     m_start_line = 0;
     m_checked_index = 0;
+    m_inline = false;
+    m_deferred = false;
+
+    init_request();
+    init_write();
+}
+
+// 初始化单个请求的解析状态，读缓冲区中已有的后续请求数据保留
+void http_conn::init_request() {
+    release_body_sink();
+    m_check_state = CHECK_STATE_REQUESTLINE; // 初始化状态为解析请求首行
+    m_request_start = m_checked_index;
 
-    bzero(m_real_file, MAX_FILE_PATH_SIZE);
     bzero(&m_file_stat, sizeof(m_file_stat));
     m_file_address = 0;
+    m_file_entry = 0;
+    m_dynamic_buf = 0;
+    m_dynamic_size = 0;
+    m_dynamic_len = 0;
+    m_content_type = "text/html";
+    m_range_count = 0;
+    m_encoded = false;
 
     m_method = GET;
     m_url = 0;
     m_version = 0;
     m_host = 0;
     m_linger = false;
-    m_content_length = 0;
-    m_content = 0;
+    m_content_length = -1;
+    m_chunked = false;
+    m_route = NULL;
+    m_param_count = 0;
+    m_allowed = 0;
+    m_dynamic_status = 200;
+    m_if_none_match = 0;
+    m_if_modified_since = 0;
+    m_range = 0;
+    m_if_range = 0;
+    m_accept_encoding = 0;
+}
 
-    bzero(m_write_buf, WRITE_BUFFER_SIZE);
-    bzero(m_iv, 2);
+// 清空写状态，准备生成下一批响应
+void http_conn::init_write() {
     m_write_idx = 0;
     m_iv_count = 0;
+    m_response_count = 0;
+    m_batch_linger = false;
+    m_file_fd = -1;
+    m_file_offset = 0;
+    m_bytes_to_send = 0;
+    m_bytes_have_send = 0;
+}
+
+// 上一批响应发送完后，把未处理完的请求数据移到读缓冲区开头，没有剩余数据时归还读缓冲区
+void http_conn::compact_read_buf() {
+    int shift = m_request_start;
+    if(shift > 0) {
+        memmove(m_read_buf, m_read_buf + shift, m_read_index - shift);
+        rebase_read_buf(m_read_buf, shift);
+    }
+    if(m_read_index == 0) {
+        release_read_buf();
+    }
+}
+
+// 读缓冲区换到new_buf并丢弃开头shift个字节后，调整各下标，
+// 已解析出的请求字段指向读缓冲区，随数据一起移动
+void http_conn::rebase_read_buf(char *new_buf, int shift) {
+    char **fields[] = { &m_url, &m_version, &m_host,
+                        &m_if_none_match, &m_if_modified_since, &m_range, &m_if_range, &m_accept_encoding };
+    for(size_t i=0; i<sizeof(fields) / sizeof(fields[0]); ++i) {
+        if(*fields[i]) {
+            *fields[i] = new_buf + (*fields[i] - m_read_buf) - shift;
+        }
+    }
+    for(int i=0; i<m_param_count; ++i) {
+        m_params[i].m_value = new_buf + (m_params[i].m_value - m_read_buf) - shift;
+    }
+    m_read_buf = new_buf;
+    m_read_index -= shift;
+    m_checked_index -= shift;
+    m_start_line -= shift;
+    m_request_start -= shift;
+}
+
+// 借用读缓冲区，或把已满的读缓冲区换成大一级的
+bool http_conn::grow_read_buf() {
+    size_t size = m_read_buf ? m_read_size * 2 : buffer_pool::MIN_SIZE;
+    if(size > MAX_READ_BUFFER_SIZE) {
+        return false;
+    }
+    size_t capacity;
+    char *buf = buffer_pool::get_instance()->alloc(size, &capacity);
+    if(!buf) {
+        return false;
+    }
+    if(m_read_buf) {
+        memcpy(buf, m_read_buf, m_read_index);
+        char *old = m_read_buf;
+        rebase_read_buf(buf, 0);
+        buffer_pool::get_instance()->free(old, m_read_size);
+    } else {
+        m_read_buf = buf;
+    }
+    m_read_size = capacity;
+    return true;
+}
+
+// 读缓冲区写满时判断是否还需要扩大：未解析的数据中已有请求头结束的空行时，
+// 解析总能取得进展（生成响应或进入请求体），不必再读
+bool http_conn::header_complete() const {
+    const char *begin = m_read_buf + m_start_line;
+    int len = m_read_index - m_start_line;
+    if(m_check_state == CHECK_STATE_HEADER && len >= 2 && begin[0] == '\r' && begin[1] == '\n') {
+        // 已解析的请求头之后紧接着空行
+        return true;
+    }
+    return memmem(begin, len, "\r\n\r\n", 4) != NULL;
+}
+
+void http_conn::release_read_buf() {
+    buffer_pool::get_instance()->free(m_read_buf, m_read_size);
+    m_read_buf = NULL;
+    m_read_size = 0;
+}
+
+void http_conn::release_write_buf() {
+    buffer_pool::get_instance()->free(m_write_buf, m_write_size);
+    m_write_buf = NULL;
+    m_write_size = 0;
 }
 
 //关闭连接
 void http_conn::close_conn() {
     if(m_sockfd != -1) {
-        removefd(m_sockfd, m_sockfd);
+        unmap();
+        release_body_sink();
+        release_read_buf();
+        release_write_buf();
+        // 连接表按fd共用，fd一关闭就可能被其他反应堆接收的新连接复用，连同本对象，
+        // 所以先清除本连接的状态，最后才关闭socket
+        int sockfd = m_sockfd;
         m_sockfd = -1;
-        --m_user_count;
+        --*m_user_count;
+        if(m_epollfd != -1) {
+            removefd(m_epollfd, sockfd);
+        } else {
+            close(sockfd);
+        }
     }
 }
 
 // 循环读取客户数据，直到无数据可读或对方关闭连接
 bool http_conn::read() {
-    if(m_read_index >= READ_BUFFER_SIZE) {
+    // 上传的请求体留在socket中，由工作线程直接splice到文件
+    if(reading_body() && m_body_sink && m_body_sink->splice_capable() && m_body.raw_left() > 0 &&
+       !has_unparsed_input()) {
+        return true;
+    }
+    // 读缓冲区只在有请求数据时从内存池借用，写满时换更大的一块，最大MAX_READ_BUFFER_SIZE
+    if(!m_read_buf && !grow_read_buf()) {
         return false;
     }
 
     // 读取到的字节
     int bytes_read = 0;
     while(true) {
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_index, READ_BUFFER_SIZE - m_read_index, 0);
+        if(m_read_index >= m_read_size) {
+            // 请求体先交给接收方腾出读缓冲区；已收到完整的请求头时先处理已收到的请求，
+            // 剩下的数据（流水线请求或随请求头一起到达的请求体）留在socket中等下一轮
+            if(reading_body() ? m_read_size >= BODY_BUFFER_SIZE : header_complete()) {
+                break;
+            }
+            if(!grow_read_buf()) {
+                return false;
+            }
+        }
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_index, m_read_size - m_read_index, 0);
         if(bytes_read == -1) {
             if(errno == EAGAIN || errno == EWOULDBLOCK) {
                 // 数据已读完
@@ -148,113 +338,363 @@ bool http_conn::read() {
         }
         m_read_index += bytes_read;
     }
-    printf("读取到了数据：\n%s\n", m_read_buf);
+    if(m_read_index == 0) {
+        // 虚假的可读事件，不占用缓冲区
+        release_read_buf();
+        return true;
+    }
+    LOG_DEBUG("读取到了数据：\n%s", log_str(m_read_buf, m_read_index));
     return true;
 }
 
-// 写http响应
+// 写http响应：响应头和内存中的响应体用sendmsg分散写，大文件的响应体用sendfile发送，
+// 每次部分写入后推进iovec和文件偏移，下一轮EPOLLOUT从断点继续
 bool http_conn::write() {
-    int tmp = 0;                        
-    int bytes_have_end = 0;             // 已经发送的字节数
-    int bytes_to_send = m_write_idx;    // 将要发送的字节数
-
-    if(bytes_to_send == 0) {
-        // 将要发送的字节数为0，本次响应结束
-        modifyfd(m_epollfd, m_sockfd, EPOLLIN);
-        init();
-        return true;
-    }
-    while(true) {
-        // 分散写
-        tmp = writev(m_sockfd, m_iv, m_iv_count);
-        if(tmp <= -1) {
+    while(m_bytes_to_send > 0) {
+        ssize_t tmp;
+        if(m_iv_count > 0) {
+            // 后面还有sendfile的响应体时带上MSG_MORE，让响应头与文件数据合并成满的报文段
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = m_iv;
+            msg.msg_iovlen = m_iv_count;
+            int flags = MSG_NOSIGNAL | (m_file_fd != -1 ? MSG_MORE : 0);
+            tmp = sendmsg(m_sockfd, &msg, flags);
+        } else {
+            size_t chunk = m_bytes_to_send < SENDFILE_CHUNK_SIZE ? m_bytes_to_send : SENDFILE_CHUNK_SIZE;
+            tmp = sendfile(m_sockfd, m_file_fd, &m_file_offset, chunk);
+        }
+        if(tmp < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件
             if(errno == EAGAIN) {
-                modifyfd(m_epollfd, m_sockfd, EPOLLOUT);
+                rearm(EPOLLOUT);
                 return true;
             }
             unmap();
             return false;
         }
-        bytes_to_send -= tmp;
-        bytes_have_end += tmp;
-        if(bytes_to_send <= bytes_have_end) {
-            // 发送http响应成功，根据connection字段决定是否立即断开连接
+        if(tmp == 0 && m_iv_count == 0) {
+            // 文件在发送过程中被截断，无法补齐Content-Length
             unmap();
-            if(m_linger) {
-                init();
-                modifyfd(m_epollfd, m_sockfd, EPOLLIN);
-                return true;
-            }else {
-                modifyfd(m_epollfd, m_sockfd, EPOLLIN);
-                return false;
-            }
+            return false;
+        }
+        m_bytes_to_send -= tmp;
+        m_bytes_have_send += tmp;
+        metrics::add_bytes_sent(tmp);
+        if(m_iv_count > 0) {
+            advance_iv(tmp);
         }
     }
+    if(!finish_write()) {
+        return false;
+    }
+    // 读缓冲区中还有未解析的流水线请求时由反应堆直接处理，不再等待可读事件
+    if(!has_unparsed_input()) {
+        rearm(EPOLLIN);
+    }
     return true;
 }
 
-//往写缓存中写入待发送的数据
-bool http_conn::add_response(const char *format, ...) {
-    if(m_write_idx >= WRITE_BUFFER_SIZE) {
+// 一批响应发送完毕，根据connection字段决定是否立即断开连接
+bool http_conn::finish_write() {
+    if(m_response_count > 0) {
+        metrics::record(STAGE_RESPONSE, metrics::now_ns() - m_enqueue_ns);
+    }
+    unmap();
+    if(m_response_count > 0 && !m_batch_linger) {
         return false;
     }
+    init_write();
+    release_write_buf();
+    compact_read_buf();
+    return true;
+}
+
+// 把io_uring接收到的数据追加到读缓冲区，超过读缓冲区上限时返回false
+bool http_conn::append_input(const char *data, int len) {
+    while(m_read_size - m_read_index < len) {
+        if(!grow_read_buf()) {
+            return false;
+        }
+    }
+    memcpy(m_read_buf + m_read_index, data, len);
+    m_read_index += len;
+    LOG_DEBUG("读取到了数据：\n%s", log_str(m_read_buf, m_read_index));
+    return true;
+}
 
-    va_list arg_list;
-    va_start(arg_list, format);
-    int len = vsnprintf(m_write_buf+m_write_idx, WRITE_BUFFER_SIZE-1-m_write_idx, format, arg_list);
-    if(len >= WRITE_BUFFER_SIZE-1-m_write_idx) {
+// 协程反应堆接收前调用，读缓冲区只在真正接收时才借用
+bool http_conn::input_space(char **buf, int *len) {
+    if((!m_read_buf || m_read_index >= m_read_size) && !grow_read_buf()) {
         return false;
     }
+    *buf = m_read_buf + m_read_index;
+    *len = m_read_size - m_read_index;
+    return true;
+}
+
+void http_conn::received(int len) {
+    m_read_index += len;
+    LOG_DEBUG("读取到了数据：\n%s", log_str(m_read_buf, m_read_index));
+}
+
+// io_uring的发送操作完成后调用，from_file表示发出的是m_file_fd中的数据
+void http_conn::sent(size_t bytes, bool from_file) {
+    m_bytes_to_send -= bytes;
+    m_bytes_have_send += bytes;
+    metrics::add_bytes_sent(bytes);
+    if(from_file) {
+        m_file_offset += bytes;
+    } else {
+        advance_iv(bytes);
+    }
+}
+
+// 等待下一个可读或可写事件：epoll反应堆重置EPOLLONESHOT，
+// io_uring和协程反应堆的读写只能由它自己的线程发起，交给它在下一轮循环中继续
+void http_conn::rearm(int ev) {
+    if(m_reactor_io) {
+        m_owner->post(this, ev);
+        return;
+    }
+    modifyfd(m_epollfd, m_sockfd, ev);
+}
+
+// 追加一段待发送数据，与上一段在内存中相邻时直接合并
+void http_conn::add_iv(char *base, size_t len) {
+    if(len == 0) {
+        return;
+    }
+    if(m_iv_count > 0 && (char *)m_iv[m_iv_count-1].iov_base + m_iv[m_iv_count-1].iov_len == base) {
+        m_iv[m_iv_count-1].iov_len += len;
+    } else {
+        m_iv[m_iv_count].iov_base = base;
+        m_iv[m_iv_count].iov_len = len;
+        ++m_iv_count;
+    }
+    m_bytes_to_send += len;
+}
+
+// 跳过已发送的字节，丢弃发送完的iovec
+void http_conn::advance_iv(size_t bytes) {
+    int i = 0;
+    while(i < m_iv_count && bytes >= m_iv[i].iov_len) {
+        bytes -= m_iv[i].iov_len;
+        ++i;
+    }
+    if(i > 0) {
+        memmove(m_iv, m_iv + i, sizeof(struct iovec) * (m_iv_count - i));
+        m_iv_count -= i;
+    }
+    if(m_iv_count > 0) {
+        m_iv[0].iov_base = (char *)m_iv[0].iov_base + bytes;
+        m_iv[0].iov_len -= bytes;
+    }
+}
+
+//往写缓存中写入待发送的数据
+bool http_conn::append(const char *data, int len) {
+    if(len > m_write_size - m_write_idx) {
+        return false;
+    }
+    memcpy(m_write_buf + m_write_idx, data, len);
     m_write_idx += len;
-    va_end(arg_list);
     return true;
 }
-bool http_conn::add_status_line(int status, const char *title) {
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+bool http_conn::append(const char *str) {
+    return append(str, strlen(str));
+}
+bool http_conn::append_uint(unsigned long long v) {
+    if(m_write_size - m_write_idx < http_header::UINT_SIZE) {
+        return false;
+    }
+    m_write_idx += http_header::format_uint(v, m_write_buf + m_write_idx);
+    return true;
+}
+bool http_conn::add_status_line(int status, const char *line) {
+    metrics::count_status(status);
+    return append(line);
+}
+
+bool http_conn::add_status_line(int status) {
+    metrics::count_status(status);
+    return append("HTTP/1.1 ") && append_uint(status) && append(" ") &&
+           append(http_header::reason_phrase(status)) && append("\r\n");
+}
+
+// 路由支持的方法，加上静态文件支持的GET、HEAD和开启上传时的PUT
+bool http_conn::add_allow() {
+    unsigned allowed = m_allowed | (1u << GET) | (1u << HEAD) | (upload_root.load(std::memory_order_relaxed) ? 1u << PUT : 0);
+    bool first = true;
+    for(int i=0; i<router::METHOD_NUMBER; ++i) {
+        if(allowed & (1u << i)) {
+            if((!first && !append(", ")) || !append(method_names[i])) {
+                return false;
+            }
+            first = false;
+        }
+    }
+    return true;
 }
-bool http_conn::add_headers(int content_len) {
-    add_content_length(content_len);
-    add_content_type();
-    add_linger();
-    add_blank_line();
+bool http_conn::add_headers(long long content_len) {
+    return add_content_length(content_len) && add_content_type() &&
+           add_date() && add_linger() && add_blank_line();
 }
-bool http_conn::add_content_length(int content_len) {
-    return add_response("Content-Length: %d\r\n", content_len);
+bool http_conn::add_content_length(long long content_len) {
+    return append("Content-Length: ") && append_uint(content_len) && append("\r\n");
 }
 bool http_conn::add_content_type() {
-    return add_response("Content-Type: %s\r\n", "text/html");
+    return append("Content-Type: ") && append(m_content_type) && append("\r\n");
+}
+bool http_conn::add_date() {
+    int len;
+    const char *line = http_header::date_line(&len);
+    return append(line, len);
 }
 bool http_conn::add_linger() {
-    return add_response("Connection: %s\r\n", m_linger ? "keep-alive" : "close");
+    return m_linger ? append("Connection: keep-alive\r\n") : append("Connection: close\r\n");
 }
 bool http_conn::add_blank_line() {
-    return add_response("%s", "\r\n");
+    return append("\r\n");
+}
+bool http_conn::add_error(int status) {
+    const error_response *r = find_error(status);
+    if(!r) {
+        return false;
+    }
+    metrics::count_status(status);
+    // m_tail以结束响应头的空行开头
+    return append(r->m_head[m_linger], r->m_head_len[m_linger]) && add_date() &&
+           append(r->m_tail, m_method == HEAD ? 2 : r->m_tail_len);
+}
+// 错误响应的响应体，HEAD请求的响应只有响应头
+bool http_conn::add_form(const char *form) {
+    return m_method == HEAD || append(form);
 }
-bool http_conn::add_content(const char *content) {
-    return add_response("%s\r\n", content);
+
+// 不经过读写缓冲区，一次非阻塞的writev发出；发不完也不再等待，调用者随后关闭连接
+void http_conn::send_overloaded(int sockfd) {
+    const error_response *r = find_error(503);
+    int date_len;
+    const char *date = http_header::date_line(&date_len);
+    struct iovec iv[3];
+    iv[0].iov_base = (void *)r->m_head[0];
+    iv[0].iov_len = r->m_head_len[0];
+    iv[1].iov_base = (void *)date;
+    iv[1].iov_len = date_len;
+    iv[2].iov_base = (void *)r->m_tail;
+    iv[2].iov_len = r->m_tail_len;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iv;
+    msg.msg_iovlen = 3;
+    sendmsg(sockfd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    metrics::count_status(503);
+}
+
+void http_conn::set_draining() {
+    s_draining.store(true, std::memory_order_relaxed);
 }
 
 // 由线程池中的工作线程调用，是处理http请求的入口函数
 void http_conn::process() {
-    // 解析http请求
-    HTTP_CODE read_ret =  process_read();
-    if(read_ret == NO_REQUEST) {
-        modifyfd(m_epollfd, m_sockfd, EPOLLIN);
-        return;
+    unsigned long long sojourn = metrics::now_ns() - m_enqueue_ns;
+    metrics::record(STAGE_QUEUE_WAIT, sojourn);
+    admission::get_instance()->observe(sojourn);
+    bool ok = build_responses();
+    if(!ok) {
+        // 连接只能由所属反应堆关闭，这里关闭读写两端，让反应堆收到EPOLLHUP后关闭
+        shutdown(m_sockfd, SHUT_RDWR);
     }
+    // 交还给所属反应堆，由它取出时清除忙标志并重置事件：在这里清除的话，交还途中连接
+    // 就可能被定时器关闭，fd被新连接复用后再重置事件会作用到新连接上
+    m_owner->post(this, (m_response_count > 0 || !ok) ? EPOLLOUT : EPOLLIN);
+}
 
-    // 生成响应
-    bool write_ret = process_write(read_ret);
-    if(!write_ret) {
-        close_conn();
+// 由反应堆线程在读到数据后直接调用：只处理不需要文件系统调用的请求（缓存命中、错误响应、
+// 304、/__stats等），遇到需要读盘的请求时停下，连同已生成的响应一起交给线程池继续处理
+int http_conn::process_inline() {
+    m_enqueue_ns = metrics::now_ns();
+    m_inline = true;
+    bool ok = build_responses();
+    m_inline = false;
+    if(!ok) {
+        return INLINE_ERROR;
+    }
+    if(m_deferred) {
+        return INLINE_DEFER;
     }
-    modifyfd(m_epollfd, m_sockfd, EPOLLOUT);
+    return m_response_count > 0 ? INLINE_RESPONSE : INLINE_WAIT;
+}
+
+// 依次处理读缓冲区中所有完整的流水线请求，响应追加到同一批中，由一次分散写发出，返回false表示出错
+bool http_conn::build_responses() {
+    // 写缓冲区只在生成响应期间借用，整批发送完后归还
+    if(!m_write_buf) {
+        size_t capacity;
+        m_write_buf = buffer_pool::get_instance()->alloc(WRITE_BUFFER_SIZE, &capacity);
+        m_write_size = m_write_buf ? capacity : 0;
+        if(!m_write_buf) {
+            return false;
+        }
+    }
+    // 还要留出一个多范围响应所需的iovec
+    while(m_response_count < MAX_PIPELINE && m_write_size - m_write_idx >= MIN_RESPONSE_SPACE &&
+          m_iv_count + MAX_RANGES * 2 + 2 <= IV_CAPACITY) {
+        HTTP_CODE read_ret;
+        if(m_deferred && !reading_body()) {
+            // 内联处理时推迟的请求已经解析完，只需重新执行do_request
+            m_deferred = false;
+            read_ret = timed_do_request();
+        } else {
+            // 解析http请求，推迟的请求体从断点继续接收
+            m_deferred = false;
+            unsigned long long begin = metrics::now_ns();
+            m_do_request_ns = 0;
+            read_ret = process_read();
+            if(read_ret == NO_REQUEST) {
+                break;
+            }
+            if(read_ret == SLOW_REQUEST) {
+                m_deferred = true;
+                break;
+            }
+            metrics::record(STAGE_PARSE, metrics::now_ns() - begin - m_do_request_ns);
+        }
+
+        // 生成响应
+        if(!process_write(read_ret)) {
+            return false;
+        }
+        // 连接将关闭或响应体要用sendfile发送时，它必须是本批最后一个响应
+        bool more = m_linger && m_file_fd == -1;
+        init_request();
+        if(!more) {
+            break;
+        }
+    }
+
+    if(m_response_count == 0) {
+        // 请求尚不完整，等待期间不占用写缓冲区
+        release_write_buf();
+    }
+    return true;
 }
 
 // 解析http请求
 http_conn::HTTP_CODE http_conn::process_read() {
+    HTTP_CODE ret = parse_request();
+    if(ret == GET_REQUEST) {
+        return timed_do_request();
+    }
+    return ret;
+}
 
+// 请求解析的状态机，解析出一个完整的请求时返回GET_REQUEST，不处理请求
+http_conn::HTTP_CODE http_conn::parse_request() {
     LINE_STATUS line_status = LINE_OK;
     HTTP_CODE ret = NO_REQUEST;
     char *text = 0;
@@ -275,42 +715,83 @@ http_conn::HTTP_CODE http_conn::process_read() {
             }
             case CHECK_STATE_HEADER:
                 ret = parse_header(text);
-                if(ret == BAD_REQUEST) {
-                    return BAD_REQUEST;
-                }else if(ret == GET_REQUEST) {
-                    return do_request();
+                if(ret == BAD_REQUEST || ret == PAYLOAD_TOO_LARGE || ret == GET_REQUEST) {
+                    return ret;
                 }
                 break;
             case CHECK_STATE_CONTENT:
-                printf("\nCHECK_STATE_CONTENT\n");
-                ret = parse_content(text);
-                if(ret == GET_REQUEST) {
-                    return do_request();
-                }
-                line_status = LINE_OPEN;
-                break;
+                // 请求体未收齐时不能再按行扫描请求体中的数据
+                return parse_content();
             default:
                 return NO_REQUEST;
         }
     }
+    if(line_status == LINE_BAD) {
+        // 行中出现了不成对的\r或\n
+        return BAD_REQUEST;
+    }
     return NO_REQUEST;
 }
 
+void http_conn::reset_parser() {
+    init();
+}
+
+int http_conn::parse_input(const char *data, int len) {
+    if(len > 0 && !append_input(data, len)) {
+        return PARSE_ERROR;
+    }
+    HTTP_CODE ret = parse_request();
+    if(ret == GET_REQUEST) {
+        return PARSE_DONE;
+    }
+    return ret == NO_REQUEST ? PARSE_MORE : PARSE_ERROR;
+}
+
+void http_conn::next_request() {
+    init_request();
+}
+
+// 各下标不越过读缓冲区，已解析出的字段都指向已接收的数据
+bool http_conn::parser_consistent() const {
+    if(m_read_index < 0 || m_read_index > m_read_size || m_checked_index < 0 || m_checked_index > m_read_index ||
+       m_start_line < 0 || m_start_line > m_checked_index || m_request_start < 0 ||
+       m_request_start > m_start_line) {
+        return false;
+    }
+    const char *fields[] = { m_url, m_version, m_host,
+                             m_if_none_match, m_if_modified_since, m_range, m_if_range, m_accept_encoding };
+    for(size_t i=0; i<sizeof(fields) / sizeof(fields[0]); ++i) {
+        if(fields[i] && (fields[i] < m_read_buf || fields[i] >= m_read_buf + m_read_index)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 // 解析请求首行: 请求方法、目标url，http版本
 http_conn::HTTP_CODE http_conn::parse_request_line(char *text) {
     // GET /index.html HTTP/1.1
-    m_url = strpbrk(text, " \t");
+    char *end = text + m_line_length;
+    m_url = (char *)http_scanner::find_space(text, end);
+    if(m_url == end) {
+        return BAD_REQUEST;
+    }
     *m_url++ = '\0';
     
     char *method = text;
-    if(strcasecmp(method, "GET") == 0) {
-        m_method = GET;
-    }else {
+    int method_count = sizeof(method_names) / sizeof(method_names[0]);
+    int index = 0;
+    while(index < method_count && strcasecmp(method, method_names[index]) != 0) {
+        ++index;
+    }
+    if(index == method_count) {
         return BAD_REQUEST;
     }
+    m_method = (METHOD)index;
 
-    m_version = strpbrk(m_url, " \t");
-    if(!m_version) {
+    m_version = (char *)http_scanner::find_space(m_url, end);
+    if(m_version == end) {
         return BAD_REQUEST;
     }
     *m_version++ = '\0';
@@ -338,87 +819,390 @@ http_conn::HTTP_CODE http_conn::parse_header(char *text) {
     // Connection: keep-alive
     // Content-Length: 1076
     if(text[0] == '\0') {
-        if(m_content_length != 0) {
+        if(m_chunked && m_content_length >= 0) {
+            // 两者同时出现时前后的代理可能对请求边界理解不同，拒绝
+            return BAD_REQUEST;
+        }
+        // 请求头收齐后就确定路由，据此决定请求体交给谁
+        m_route = router::get_instance()->match(m_method, m_url, strcspn(m_url, "?"), m_params, &m_param_count,
+                                                &m_allowed);
+        if(!m_route && m_method == HEAD) {
+            // 没有为HEAD注册处理函数时使用GET的，生成响应时去掉响应体
+            m_route = router::get_instance()->match(GET, m_url, strcspn(m_url, "?"), m_params, &m_param_count,
+                                                    &m_allowed);
+        }
+        if(m_route && m_route->m_max_body > 0 && m_content_length > (long long)m_route->m_max_body) {
+            m_linger = false;
+            return PAYLOAD_TOO_LARGE;
+        }
+        if(s_draining.load(std::memory_order_relaxed)) {
+            // 旧进程排空连接时，响应后关闭，客户端重连到新进程
+            m_linger = false;
+        }
+        if(m_chunked || m_content_length > 0 || (m_method == PUT && !m_route)) {
+            if(m_chunked) {
+                m_body.init_chunked();
+            } else {
+                m_body.init_length(m_content_length > 0 ? m_content_length : 0);
+            }
+            m_check_state = CHECK_STATE_CONTENT;
             return NO_REQUEST;
         }
         return GET_REQUEST;
-    }else if(strncasecmp(text, "Host:", 5) == 0) {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
-    }else if(strncasecmp(text, "Connection:", 11) == 0) {
-        text += 11;
-        text += strspn(text, " \t");
-        if(strcasecmp(text, "keep-alive") == 0) {
-            m_linger = true;
-        }
-    }else if(strncasecmp(text, "Content-Length:", 15) == 0) {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
-    }else {
-        printf("unknow header: %s\n", text);
     }
-    
+
+    // 先找到字段名结束的冒号，再用完美哈希识别字段名
+    char *end = text + m_line_length;
+    char *colon = (char *)http_scanner::find_colon(text, end);
+    HEADER_NAME name = colon == end ? HEADER_UNKNOWN : http_scanner::classify_header(text, colon - text);
+    char *value = colon + 1;
+    if(name != HEADER_UNKNOWN) {
+        value += strspn(value, " \t");
+    }
+    switch(name) {
+        case HEADER_HOST:
+            m_host = value;
+            break;
+        case HEADER_CONNECTION:
+            if(strcasecmp(value, "keep-alive") == 0) {
+                m_linger = true;
+            }
+            break;
+        case HEADER_CONTENT_LENGTH: {
+            // 只接受十进制数字，负数和溢出都按格式错误处理
+            char *digits_end = value + strspn(value, "0123456789");
+            if(digits_end == value || digits_end - value > 18 || (*digits_end != '\0' && *digits_end != ' ')) {
+                return BAD_REQUEST;
+            }
+            m_content_length = atoll(value);
+            break;
+        }
+        case HEADER_TRANSFER_ENCODING:
+            // 只支持chunked，其他编码无法确定请求边界
+            if(strcasecmp(value, "chunked") != 0) {
+                return BAD_REQUEST;
+            }
+            m_chunked = true;
+            break;
+        case HEADER_IF_NONE_MATCH:
+            m_if_none_match = value;
+            break;
+        case HEADER_IF_MODIFIED_SINCE:
+            m_if_modified_since = value;
+            break;
+        case HEADER_RANGE:
+            m_range = value;
+            break;
+        case HEADER_IF_RANGE:
+            m_if_range = value;
+            break;
+        case HEADER_ACCEPT_ENCODING:
+            m_accept_encoding = value;
+            break;
+        case HEADER_UNKNOWN:
+            LOG_DEBUG("unknow header: %s", text);
+            break;
+        default:
+            break;
+    }
+
     return NO_REQUEST;
 }
 
-// 解析请求体
-http_conn::HTTP_CODE http_conn::parse_content(char *text) {
-    // if(m_read_index >= (m_content_length + m_checked_index)) {
-    //     m_check_state = CHECK_STATE_REQUESTLINE;
-    //     text[m_content_length] = '\0';
-    //     return GET_REQUEST;
-    // }
-
-    int len = strlen(m_content);
-    int text_len = strlen(text);
-    if(len + text_len >= m_content_length) {
-        m_check_state = CHECK_STATE_REQUESTLINE;
-        strncat(m_content, text, m_content_length-len);
-        printf("\ncontent: \n%s\n", m_content);
-        return GET_REQUEST;
+// 解析请求体：请求体不按行划分，已收到的部分交给接收方后从读缓冲区丢弃，读缓冲区只保留请求头、
+// 尚未解码的数据和之后的流水线请求。上传文件时读缓冲区取空后直接从socket splice到文件
+http_conn::HTTP_CODE http_conn::parse_content() {
+    if(!m_body_sink) {
+        HTTP_CODE ret = open_body_sink();
+        if(ret == SLOW_REQUEST) {
+            return ret;
+        } else if(ret != NO_REQUEST) {
+            // 请求体没有接收，无法确定下一个请求的位置，响应后关闭连接
+            m_linger = false;
+            return ret;
+        }
+    }
+    if(m_inline && m_body_sink->blocking()) {
+        return SLOW_REQUEST;
+    }
+    // 内联处理或io_uring、协程反应堆下socket由反应堆读取，不能splice
+    bool can_splice = !m_inline && !m_reactor_io && m_body_sink->splice_capable();
+    while(true) {
+        body_decoder::RESULT result;
+        int used = m_body.decode(m_read_buf + m_checked_index, m_read_index - m_checked_index, m_body_sink, &result);
+        consume_input(used);
+        if(result == body_decoder::BODY_BAD) {
+            return BAD_REQUEST;
+        } else if(result == body_decoder::BODY_SINK_ERROR) {
+            m_linger = false;
+            return m_body_sink->overflowed() ? PAYLOAD_TOO_LARGE : INTERNAL_ERROR;
+        } else if(result == body_decoder::BODY_DONE) {
+            m_start_line = m_checked_index;
+            if(!m_body_sink->finish()) {
+                return INTERNAL_ERROR;
+            }
+            return GET_REQUEST;
+        }
+
+        // 读缓冲区已取空，分块的框架数据只能经读缓冲区解析
+        unsigned long long left = m_body.raw_left();
+        if(!can_splice || left == 0) {
+            return NO_REQUEST;
+        }
+        ssize_t n = m_body_sink->splice_from(m_sockfd, left);
+        if(n < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                return NO_REQUEST;
+            }
+            m_linger = false;
+            return INTERNAL_ERROR;
+        } else if(n == 0) {
+            // 对方在请求体中途关闭了连接
+            return CLOSE_CONNECTION;
+        }
+        m_body.skip_raw(n);
+    }
+}
+
+// 路由要求时收集到内存，没有路由的PUT写入upload_root下的同名文件，其他请求的请求体丢弃
+http_conn::HTTP_CODE http_conn::open_body_sink() {
+    if(m_route) {
+        if(m_route->m_max_body > 0) {
+            m_body_sink = new memory_sink(m_route->m_max_body);
+        } else {
+            m_body_sink = discard_sink::get_instance();
+        }
+        return NO_REQUEST;
+    }
+    if(m_method != PUT) {
+        m_body_sink = discard_sink::get_instance();
+        return NO_REQUEST;
     }
-    strcat(m_content, text);
+    if(m_inline) {
+        return SLOW_REQUEST;
+    }
+    const char *root = upload_root.load(std::memory_order_acquire);
+    if(!root) {
+        return FORBIDDED_REQUEST;
+    }
+    // 文件路径不含查询串
+    int url_len = strcspn(m_url, "?");
+    char path[MAX_FILE_PATH_SIZE];
+    int root_len = strlen(root);
+    if(root_len + url_len >= MAX_FILE_PATH_SIZE) {
+        return BAD_REQUEST;
+    }
+    memcpy(path, root, root_len);
+    memcpy(path + root_len, m_url, url_len);
+    path[root_len + url_len] = '\0';
+    // 不允许..和隐藏文件，也不能上传目录
+    if(url_len == 0 || strstr(path + root_len, "/.") || path[root_len + url_len - 1] == '/') {
+        return FORBIDDED_REQUEST;
+    }
+
+    file_sink *sink = new file_sink;
+    int err = sink->open(path);
+    if(err != 0) {
+        delete sink;
+        LOG_ERROR("upload %s failed: %s", path, strerror(err));
+        if(err == ENOENT || err == ENOTDIR) {
+            return NO_RESOURCE;
+        }
+        return err == EACCES ? FORBIDDED_REQUEST : INTERNAL_ERROR;
+    }
+    m_body_sink = sink;
     return NO_REQUEST;
 }
 
-// 解析一行数据，判断依据 \r\n
+void http_conn::release_body_sink() {
+    if(m_body_sink && m_body_sink != discard_sink::get_instance()) {
+        delete m_body_sink;
+    }
+    m_body_sink = NULL;
+}
+
+// 丢弃m_checked_index起的len个字节，之后的数据前移；请求体通常整段消耗完，不需要移动
+void http_conn::consume_input(int len) {
+    int rest = m_read_index - m_checked_index - len;
+    if(rest > 0 && len > 0) {
+        memmove(m_read_buf + m_checked_index, m_read_buf + m_checked_index + len, rest);
+    }
+    m_read_index -= len;
+}
+
+// 解析一行数据，判断依据 \r\n，用向量指令查找行结束符
 http_conn::LINE_STATUS http_conn::parse_line() {
-    char tmp;
-    for(; m_checked_index < m_read_index; ++m_checked_index) {
-        tmp = m_read_buf[m_checked_index];
-        if(tmp == '\r') {
-            if(m_checked_index + 1 == m_read_index) {
-                return LINE_OPEN;
-            } else if(m_read_buf[m_checked_index + 1] == '\n') {
-                m_read_buf[m_checked_index++] = '\0';
-                m_read_buf[m_checked_index++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }else if(tmp == '\n') {
-            if(m_checked_index > 1 && m_read_buf[m_checked_index-1] == '\r') {
-                // 未读完继续读时遇到\n
-                m_read_buf[m_checked_index-1] = '\0';
-                m_read_buf[m_checked_index++] = '\0';
-                return LINE_OK;
-            }   
-            return LINE_BAD;
+    char *end = m_read_buf + m_read_index;
+    if(m_checked_index > m_start_line && m_checked_index < m_read_index &&
+       m_read_buf[m_checked_index-1] == '\r' && m_read_buf[m_checked_index] != '\n') {
+        // 上一轮末尾的\r之后不是\n
+        return LINE_BAD;
+    }
+    const char *p = http_scanner::find_line_end(m_read_buf + m_checked_index, end);
+    m_checked_index = p - m_read_buf;
+    if(p == end) {
+        return LINE_OPEN;
+    }
+    if(*p == '\r') {
+        if(m_checked_index + 1 == m_read_index) {
+            // 数据以\r结束，越过它等待\n，读缓冲区中不再有未扫描的数据
+            ++m_checked_index;
+            return LINE_OPEN;
+        } else if(m_read_buf[m_checked_index + 1] == '\n') {
+            m_line_length = m_checked_index - m_start_line;
+            m_read_buf[m_checked_index++] = '\0';
+            m_read_buf[m_checked_index++] = '\0';
+            return LINE_OK;
         }
+        return LINE_BAD;
+    }
+    // 单独的\n
+    if(m_checked_index > 1 && m_read_buf[m_checked_index-1] == '\r') {
+        // 未读完继续读时遇到\n
+        m_line_length = m_checked_index - 1 - m_start_line;
+        m_read_buf[m_checked_index-1] = '\0';
+        m_read_buf[m_checked_index++] = '\0';
+        return LINE_OK;
+    }
+    return LINE_BAD;
+}
+
+// 记录do_request的耗时，解析阶段的耗时中扣除这部分
+http_conn::HTTP_CODE http_conn::timed_do_request() {
+    unsigned long long begin = metrics::now_ns();
+    HTTP_CODE ret = do_request();
+    m_do_request_ns = metrics::now_ns() - begin;
+    metrics::record(STAGE_DO_REQUEST, m_do_request_ns);
+    return ret;
+}
+
+// 处理函数生成的响应体作为动态响应发送，不标记ROUTE_INLINE的处理函数只在工作线程中调用
+http_conn::HTTP_CODE http_conn::route_request() {
+    if(m_inline && !(m_route->m_flags & router::ROUTE_INLINE)) {
+        return SLOW_REQUEST;
+    }
+    http_request req;
+    req.m_method = m_method;
+    req.m_path = m_url;
+    req.m_path_len = strcspn(m_url, "?");
+    req.m_query = m_url[req.m_path_len] == '?' ? m_url + req.m_path_len + 1 : NULL;
+    req.m_host = m_host;
+    req.m_body = NULL;
+    req.m_body_len = 0;
+    if(m_route->m_max_body > 0 && m_body_sink) {
+        memory_sink *body = static_cast<memory_sink *>(m_body_sink);
+        req.m_body = body->data();
+        req.m_body_len = body->size();
+    }
+    req.m_params = m_params;
+    req.m_param_count = m_param_count;
+
+    http_response resp;
+    m_route->m_handler(req, resp, m_route->m_ctx);
+    if(resp.failed()) {
+        return INTERNAL_ERROR;
+    }
+    m_dynamic_buf = resp.detach(&m_dynamic_size, &m_dynamic_len);
+    m_dynamic_status = resp.status();
+    m_content_type = resp.content_type();
+    return DYNAMIC_REQUEST;
+}
+
+// 在读取文件内容之前处理条件请求和范围请求：If-None-Match优先于If-Modified-Since，
+// 校验器匹配时响应304；Range有效且If-Range（如有）仍指向当前文件时记录要发送的范围
+http_conn::HTTP_CODE http_conn::check_preconditions() {
+    http_header::format_etag(m_file_stat, m_etag, sizeof(m_etag));
+    if(m_if_none_match) {
+        if(http_header::etag_list_match(m_if_none_match, m_etag)) {
+            return NOT_MODIFIED;
+        }
+    } else if(m_if_modified_since) {
+        time_t since;
+        if(http_header::parse_date(m_if_modified_since, &since) && m_file_stat.st_mtime <= since) {
+            return NOT_MODIFIED;
+        }
+    }
+
+    // Range只对GET有效
+    m_range_count = 0;
+    if(m_range && m_method == GET && (!m_if_range || http_header::if_range_match(m_if_range, m_etag, m_file_stat.st_mtime))) {
+        int n = http_header::parse_range(m_range, m_file_stat.st_size, m_ranges, MAX_RANGES);
+        if(n < 0) {
+            return RANGE_NOT_SATISFIABLE;
+        }
+        m_range_count = n;
+    }
+    return FILE_REQUEST;
+}
+
+// 压缩版本由compress_cache在后台准备，这里只查表；范围请求总是按原文件处理
+bool http_conn::select_encoding(const char *real_file) {
+    if(!m_accept_encoding || m_range || !http_header::compressible(m_content_type)) {
+        return false;
+    }
+    int encodings = http_header::parse_accept_encoding(m_accept_encoding);
+    int encoding;
+    file_entry *variant = compress_cache::get_instance()->acquire(real_file, m_file_stat, encodings, &encoding);
+    if(!variant) {
+        return false;
     }
-    return LINE_OPEN;
+    if(m_file_entry) {
+        file_cache::get_instance()->release(m_file_entry);
+    }
+    // 条目中已有Content-Encoding、Vary等响应头，m_file_stat的大小为编码后的大小
+    m_file_entry = variant;
+    m_file_stat = variant->m_stat;
+    m_encoded = true;
+    return true;
 }
 
 // 分析目标文件属性，文件存在、有权限、非目录时，将其用mmap映射到内存地址m_file_address处
 http_conn::HTTP_CODE http_conn::do_request() {
+    if(m_route) {
+        return route_request();
+    }
+    // 以下是静态文件
+    if(m_method == PUT) {
+        // 请求体已保存
+        return CREATED_REQUEST;
+    }
+    if(m_method != GET && m_method != HEAD) {
+        return METHOD_NOT_ALLOWED;
+    }
+
     // /index.html
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    strncpy(m_real_file+len, m_url, MAX_FILE_PATH_SIZE-len-1);
-    printf("m_real_file=%s\n", m_real_file);
-    // 获取m_real_file文件的相关状态信息，-1失败、0成功
-    if(stat(m_real_file, &m_file_stat) < 0) {
+    char real_file[MAX_FILE_PATH_SIZE];     // 目标文件完整路径，缓存条目自己保存一份
+    const char *root = doc_root.load(std::memory_order_acquire);
+    strcpy(real_file, root);
+    int len = strlen(root);
+    strncpy(real_file+len, m_url, MAX_FILE_PATH_SIZE-len-1);
+    real_file[MAX_FILE_PATH_SIZE-1] = '\0';
+    LOG_DEBUG("real_file=%s", real_file);
+    m_content_type = http_header::mime_type(real_file);
+
+    // 命中文件缓存时不做任何文件系统调用，借用的条目在响应发送完后归还
+    file_cache *cache = file_cache::get_instance();
+    m_file_entry = cache->acquire(real_file);
+    if(m_file_entry) {
+        m_file_stat = m_file_entry->m_stat;
+        HTTP_CODE ret = check_preconditions();
+        if(ret == FILE_REQUEST || ret == NOT_MODIFIED) {
+            // 304也按200会发送的版本给出校验器
+            select_encoding(real_file);
+        }
+        if(ret != FILE_REQUEST) {
+            cache->release(m_file_entry);
+            m_file_entry = 0;
+        }
+        return ret;
+    }
+    if(m_inline) {
+        // 未命中缓存要访问文件系统，交给线程池
+        return SLOW_REQUEST;
+    }
+
+    // 获取real_file文件的相关状态信息，-1失败、0成功
+    if(stat(real_file, &m_file_stat) < 0) {
         return NO_RESOURCE;
     }
 
@@ -432,64 +1216,315 @@ http_conn::HTTP_CODE http_conn::do_request() {
         return BAD_REQUEST;
     }
 
+    // 304和416不需要读取文件内容，304的校验器按200会发送的版本给出，压缩版本的条目随即归还
+    HTTP_CODE ret = check_preconditions();
+    if(ret == NOT_MODIFIED && select_encoding(real_file)) {
+        cache->release(m_file_entry);
+        m_file_entry = 0;
+    }
+    if(ret != FILE_REQUEST || select_encoding(real_file)) {
+        return ret;
+    }
+
+    // 小文件读入缓存，之后的请求直接从内存发送
+    m_file_entry = cache->load(real_file, m_file_stat);
+    if(m_file_entry) {
+        if(m_file_entry->m_stat.st_mtime != m_file_stat.st_mtime || m_file_entry->m_stat.st_size != m_file_stat.st_size) {
+            // stat之后文件被修改，已按旧版本解析的范围可能失效，按新版本重新判断
+            m_file_stat = m_file_entry->m_stat;
+            ret = check_preconditions();
+            if(ret != FILE_REQUEST) {
+                cache->release(m_file_entry);
+                m_file_entry = 0;
+            }
+        }
+        return ret;
+    }
+    if(m_method == HEAD) {
+        // 大文件的响应头不需要文件内容，不打开文件
+        return FILE_REQUEST;
+    }
+
     // 只读方式打开文件
-    int fd = open(m_real_file, O_RDONLY);
+    int fd = open(real_file, O_RDONLY);
+    if(fd < 0) {
+        return NO_RESOURCE;
+    }
+    if(m_file_stat.st_size >= SENDFILE_THRESHOLD && m_range_count <= 1) {
+        // 大文件不做映射，保留描述符由sendfile按偏移分段发送；多范围响应需要映射
+        m_file_fd = fd;
+        m_file_offset = 0;
+        return FILE_REQUEST;
+    }
     // 创建内存映射
     m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
     return FILE_REQUEST;
 }
 
-// 对内存映射执行munmap操作
+// 对内存映射执行munmap操作，或归还借用的缓存条目，包括本批所有已生成的响应
 void http_conn::unmap() {
+    file_cache *cache = file_cache::get_instance();
+    for(int i=0; i<m_response_count; ++i) {
+        response_body &body = m_bodies[i];
+        if(body.m_file_entry) {
+            cache->release(body.m_file_entry);
+            body.m_file_entry = 0;
+        }
+        if(body.m_file_address) {
+            munmap(body.m_file_address, body.m_file_size);
+            body.m_file_address = 0;
+        }
+        if(body.m_dynamic_buf) {
+            buffer_pool::get_instance()->free(body.m_dynamic_buf, body.m_dynamic_size);
+            body.m_dynamic_buf = 0;
+        }
+    }
+    if(m_dynamic_buf) {
+        buffer_pool::get_instance()->free(m_dynamic_buf, m_dynamic_size);
+        m_dynamic_buf = 0;
+    }
+    if(m_file_entry) {
+        cache->release(m_file_entry);
+        m_file_entry = 0;
+    }
     if(m_file_address) {
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = 0;
     }
+    if(m_file_fd != -1) {
+        close(m_file_fd);
+        m_file_fd = -1;
+    }
+}
+
+// 与文件缓存和压缩缓存预先生成的200响应头中的校验器一致：压缩版本的ETag是弱标签，不支持范围请求
+bool http_conn::add_validators() {
+    char last_modified[http_header::DATE_SIZE];
+    int date_len = http_header::format_date(m_file_stat.st_mtime, last_modified, sizeof(last_modified));
+    if(http_header::compressible(m_content_type) && !append("Vary: Accept-Encoding\r\n")) {
+        return false;
+    }
+    return append(m_encoded ? "ETag: W/" : "ETag: ") && append(m_etag) && append("\r\nLast-Modified: ") &&
+           append(last_modified, date_len) && append(m_encoded ? "\r\n" : "\r\nAccept-Ranges: bytes\r\n");
 }
 
-// 生成响应
+// 生成206响应：单个范围直接引用文件内容中的一段，或由sendfile从范围起点发送；
+// 多个范围按multipart/byteranges组织，各部分的分隔头写入从内存池借用的缓冲区，
+// 与文件内容中的各段交替放入iovec
+bool http_conn::add_ranges(char *data) {
+    off_t size = m_file_stat.st_size;
+    if(m_range_count == 1) {
+        const byte_range &r = m_ranges[0];
+        off_t len = r.m_last - r.m_first + 1;
+        int hdr_start = m_write_idx;
+        if(!add_status_line(206, partial_206_status) || !add_validators() ||
+           !append("Content-Range: bytes ") || !append_uint(r.m_first) || !append("-") ||
+           !append_uint(r.m_last) || !append("/") || !append_uint(size) || !append("\r\n") ||
+           !add_headers(len)) {
+            return false;
+        }
+        add_iv(m_write_buf + hdr_start, m_write_idx - hdr_start);
+        if(m_file_fd == -1) {
+            add_iv(data + r.m_first, len);
+        } else {
+            m_file_offset = r.m_first;
+            m_bytes_to_send += len;
+        }
+        return true;
+    }
+
+    m_dynamic_buf = buffer_pool::get_instance()->alloc(MULTIPART_BUFFER_SIZE, &m_dynamic_size);
+    if(!m_dynamic_buf) {
+        return false;
+    }
+    char boundary[20];
+    snprintf(boundary, sizeof(boundary), "%016llx", metrics::now_ns() ^ ((unsigned long long)size << 20));
+
+    // 先生成各部分的分隔头，算出总长度
+    int part_start[MAX_RANGES + 1];
+    int len = 0;
+    long long content_len = 0;
+    for(int i=0; i<m_range_count; ++i) {
+        const byte_range &r = m_ranges[i];
+        part_start[i] = len;
+        int n = snprintf(m_dynamic_buf + len, m_dynamic_size - len,
+                         "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                         boundary, m_content_type, (long long)r.m_first, (long long)r.m_last, (long long)size);
+        if(n >= (int)m_dynamic_size - len) {
+            return false;
+        }
+        len += n;
+        content_len += n + r.m_last - r.m_first + 1;
+    }
+    part_start[m_range_count] = len;
+    int n = snprintf(m_dynamic_buf + len, m_dynamic_size - len, "\r\n--%s--\r\n", boundary);
+    if(n >= (int)m_dynamic_size - len) {
+        return false;
+    }
+    content_len += n;
+    m_dynamic_len = len + n;
+
+    int hdr_start = m_write_idx;
+    if(!add_status_line(206, partial_206_status) || !add_validators() ||
+       !add_content_length(content_len) ||
+       !append("Content-Type: multipart/byteranges; boundary=") || !append(boundary) || !append("\r\n") ||
+       !add_date() || !add_linger() || !add_blank_line()) {
+        return false;
+    }
+    add_iv(m_write_buf + hdr_start, m_write_idx - hdr_start);
+    for(int i=0; i<m_range_count; ++i) {
+        add_iv(m_dynamic_buf + part_start[i], part_start[i+1] - part_start[i]);
+        add_iv(data + m_ranges[i].m_first, m_ranges[i].m_last - m_ranges[i].m_first + 1);
+    }
+    add_iv(m_dynamic_buf + len, n);
+    return true;
+}
+
+// 生成响应，追加到当前批次：响应头写入写缓冲区，响应体以iovec引用，由write一次发出
 bool http_conn::process_write(HTTP_CODE ret) {
+    int hdr_start = m_write_idx;
     switch (ret) {
         case INTERNAL_ERROR:
-            add_status_line(500, error_500_title);
-            add_headers(strlen(error_500_form));
-            if(!add_content(error_500_form)) {
+            if(!add_error(500)) {
                 return false;
             }
             break;
         case BAD_REQUEST:
-            add_status_line(400, error_400_title);
-            add_headers(strlen(error_400_form));
-            if(!add_content(error_400_form)) {
+            // 无法确定后续请求的边界，响应后关闭连接
+            m_linger = false;
+            if(!add_error(400)) {
                 return false;
             }
             break;
         case NO_RESOURCE:
-            add_status_line(404, error_404_title);
-            add_headers(strlen(error_404_form));
-            if(!add_content(error_404_form)) {
+            if(!add_error(404)) {
                 return false;
             }
             break;
         case FORBIDDED_REQUEST:
-            add_status_line(403, error_403_title);
-            add_headers(strlen(error_403_form));
-            if(!add_content(error_403_form)) {
+            if(!add_error(403)) {
                 return false;
             }
             break;
-        case FILE_REQUEST:
-            add_status_line(200, ok_200_title);
-            add_headers(m_file_stat.st_size);
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
+        case PAYLOAD_TOO_LARGE:
+            if(!add_error(413)) {
+                return false;
+            }
+            break;
+        case METHOD_NOT_ALLOWED:
+            m_content_type = "text/html";
+            if(!add_status_line(405, error_405_status) || !append("Allow: ") || !add_allow() || !append("\r\n") ||
+               !add_headers(sizeof(error_405_form) - 1) || !add_form(error_405_form)) {
+                return false;
+            }
+            break;
+        case CREATED_REQUEST:
+            if(!add_status_line(201, created_201_status) || !add_headers(0)) {
+                return false;
+            }
+            break;
+        case NOT_MODIFIED:
+            // 304没有响应体，只带上校验器
+            if(!add_status_line(304, not_modified_304_status) || !add_validators() ||
+               !add_date() || !add_linger() || !add_blank_line()) {
+                return false;
+            }
+            break;
+        case RANGE_NOT_SATISFIABLE:
+            m_content_type = "text/html";
+            if(!add_status_line(416, error_416_status) || !append("Content-Range: bytes */") ||
+               !append_uint(m_file_stat.st_size) || !append("\r\n") ||
+               !add_headers(sizeof(error_416_form) - 1) || !add_form(error_416_form)) {
+                return false;
+            }
+            break;
+        case FILE_REQUEST: {
+            char *data = m_file_entry ? m_file_entry->m_data : m_file_address;
+            if(m_range_count > 0) {
+                // 范围响应自己添加iovec，多范围的分隔头缓冲区随本批一起释放
+                if(!add_ranges(data)) {
+                    return false;
+                }
+                response_body &body = m_bodies[m_response_count++];
+                body.m_file_entry = m_file_entry;
+                body.m_file_address = m_file_address;
+                body.m_file_size = m_file_stat.st_size;
+                body.m_dynamic_buf = m_dynamic_buf;
+                body.m_dynamic_size = m_dynamic_size;
+                m_file_entry = 0;
+                m_file_address = 0;
+                m_dynamic_buf = 0;
+                m_batch_linger = m_linger;
+                return true;
+            }
+            if(m_file_entry) {
+                // 缓存条目中已有状态行、长度和类型，只需补上连接选项
+                metrics::count_status(200);
+                if(!append(m_file_entry->m_headers, m_file_entry->m_headers_len) || !add_date() ||
+                   !add_linger() || !add_blank_line()) {
+                    return false;
+                }
+            } else {
+                add_status_line(200, ok_200_status);
+                if(!add_validators() || !add_headers(m_file_stat.st_size)) {
+                    return false;
+                }
+            }
+            add_iv(m_write_buf + hdr_start, m_write_idx - hdr_start);
+            response_body &body = m_bodies[m_response_count++];
+            body.m_file_entry = m_file_entry;
+            body.m_file_address = m_file_address;
+            body.m_file_size = m_file_stat.st_size;
+            body.m_dynamic_buf = 0;
+            if(m_method == HEAD) {
+                // 响应头与GET相同，不发送文件内容
+            } else if(m_file_fd == -1) {
+                add_iv(data, m_file_stat.st_size);
+            } else {
+                // 使用sendfile时响应体不在iovec中，发送完响应头后由write改用sendfile
+                m_bytes_to_send += m_file_stat.st_size;
+            }
+            // 响应体的所有权已转移到本批次
+            m_file_entry = 0;
+            m_file_address = 0;
+            m_batch_linger = m_linger;
             return true;
+        }
+        case DYNAMIC_REQUEST: {
+            if(m_dynamic_status == 200) {
+                add_status_line(200, ok_200_status);
+            } else if(!add_status_line(m_dynamic_status)) {
+                return false;
+            }
+            if(!add_headers(m_dynamic_len)) {
+                return false;
+            }
+            add_iv(m_write_buf + hdr_start, m_write_idx - hdr_start);
+            response_body &body = m_bodies[m_response_count++];
+            body.m_file_entry = 0;
+            body.m_file_address = 0;
+            body.m_file_size = 0;
+            body.m_dynamic_buf = m_dynamic_buf;
+            body.m_dynamic_size = m_dynamic_size;
+            if(m_method != HEAD) {
+                add_iv(m_dynamic_buf, m_dynamic_len);
+            }
+            m_dynamic_buf = 0;
+            m_batch_linger = m_linger;
+            return true;
+        }
         default:
             return false;
 
     }
-}
\ No newline at end of file
+    // 错误响应只有写缓冲区中的内容
+    add_iv(m_write_buf + hdr_start, m_write_idx - hdr_start);
+    m_bodies[m_response_count].m_file_entry = 0;
+    m_bodies[m_response_count].m_file_address = 0;
+    m_bodies[m_response_count].m_file_size = 0;
+    m_bodies[m_response_count].m_dynamic_buf = 0;
+    ++m_response_count;
+    m_batch_linger = m_linger;
+    return true;
+}
@@ -1,24 +1,126 @@
 #ifndef HTTPCONNECTION_H
 #define HTTPCONNECTION_H
 
+#include <atomic>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "file_cache.h"
+#include "http_header.h"
+#include "timer_wheel.h"
+#include "request_body.h"
+#include "router.h"
+
+class reactor;
+
+// io_uring反应堆为连接保存的发送状态，epoll模式下不使用
+struct uring_io {
+    struct msghdr m_msg;            // 进行中的sendmsg操作引用的消息头
+    int m_pipe[2];                  // 文件数据经管道splice到socket，只在发送文件期间打开
+    size_t m_pipe_bytes;            // 已读入管道尚未发出的字节数
+    int m_inflight;                 // 尚未完成的发送操作数
+    bool m_failed;                  // 本轮发送中有操作失败
+    bool m_closing;                 // 等发送操作都结束后再关闭
+    std::atomic<unsigned> m_gen;    // 连接每关闭一次加一，用于识别关闭前提交的操作的完成事件
+
+    uring_io() : m_pipe_bytes(0), m_inflight(0), m_failed(false), m_closing(false), m_gen(0) {
+        m_pipe[0] = m_pipe[1] = -1;
+    }
+};
+
 class http_conn {
 public:
-    static int m_epollfd;                               // 所有的socket上的事件都被注册到同一个epoll对象中
-    static int m_user_count;                            // 统计用户的数量
-
-    http_conn(){};
+    http_conn() : m_sockfd(-1), m_owner(NULL), m_reactor_io(false), m_timer_kind(TIMER_HEADER), m_busy(false), m_read_buf(NULL),
+        m_read_size(0), m_body_sink(NULL), m_write_buf(NULL), m_write_size(0), m_inline(false), m_deferred(false) {};
     ~http_conn(){};
+
+    // http请求方法：静态文件只支持GET、HEAD和PUT（上传文件），其他方法须注册路由
+    enum METHOD { GET=0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT };
+
     void process();                                     // 处理客户端请求，并进行响应
-    void init(int sockfd, struct sockaddr_in &addr);    // 初始化新接收的连接
+    // process_inline的结果
+    enum INLINE_RESULT {
+        INLINE_RESPONSE = 0,    // 已生成响应，可以立即发送
+        INLINE_WAIT,            // 请求尚不完整，继续接收
+        INLINE_DEFER,           // 遇到需要读盘的请求，交给线程池继续处理
+        INLINE_ERROR            // 出错，应关闭连接
+    };
+    int process_inline();                               // 在反应堆线程中处理只需内存数据的请求
+    // 初始化新接收的连接，epollfd和user_count属于接收该连接的反应堆owner，epollfd为-1时不注册到epoll；
+    // 工作线程处理完后通过owner交还连接，由它决定下一步；reactor_io为true时socket的读写
+    // 只能由owner的线程发起（io_uring和协程反应堆）
+    void init(int sockfd, struct sockaddr_in &addr, int epollfd, std::atomic<int> *user_count,
+              reactor *owner, bool reactor_io = false);
     void close_conn();                                  //关闭连接
     bool read();                                        // 非阻塞地读
     bool write();                                       // 非阻塞地写
+    bool finish_write();                                // 一批响应发送完后清理，返回false表示应关闭连接
+    static void send_overloaded(int sockfd);            // 过载时回复预先生成的503，不读请求
+    static void set_draining();                         // 此后的响应都带Connection: close
+
+    // 以下供io_uring反应堆代替read、write使用
+    bool append_input(const char *data, int len);       // 把接收到的数据追加到读缓冲区
+    struct iovec *iv() { return m_iv; }
+    int iv_count() const { return m_iv_count; }
+    int file_fd() const { return m_file_fd; }
+    off_t file_offset() const { return m_file_offset; }
+    size_t bytes_to_send() const { return m_bytes_to_send; }
+    void sent(size_t bytes, bool from_file);            // 记录发出的字节，推进iovec或文件偏移
+    uring_io *uring_state() { return &m_uring_io; }
+
+    // 以下供协程反应堆直接接收到读缓冲区
+    bool input_space(char **buf, int *len);             // 读缓冲区的空闲部分，已满时扩大，超过上限返回false
+    void received(int len);                             // 记录接收到input_space中的字节
+    int sockfd() const { return m_sockfd; }
+
+    // 连接当前定时器的用途
+    enum TIMER_KIND {
+        TIMER_HEADER = 0,   // 等待请求头
+        TIMER_IDLE,         // 长连接空闲
+        TIMER_WRITE         // 等待写缓冲可写
+    };
+    timer_node *timer() { return &m_timer; }
+    int timer_kind() const { return m_timer_kind; }
+    void set_timer_kind(int kind) { m_timer_kind = kind; }
+    // 连接交给线程池后到process结束前为忙，此时不能由定时器关闭
+    bool busy() const { return m_busy.load(std::memory_order_acquire); }
+    void set_busy(bool busy) { m_busy.store(busy, std::memory_order_release); }
+    bool writing() const { return m_bytes_to_send > 0; }   // 响应尚未发送完
+    bool has_buffered_input() const { return m_read_index > 0; }              // 读缓冲区中有下一个请求的数据
+    bool has_unparsed_input() const { return m_checked_index < m_read_index; } // 读缓冲区中有尚未解析的数据
+    bool reading_body() const { return m_check_state == CHECK_STATE_CONTENT; }  // 正在接收请求体
+    void set_enqueue_time(unsigned long long ns) { m_enqueue_ns = ns; }        // 交给线程池的时间，用于统计
+
+    // 以下只在内存中的数据上运行请求解析的状态机，不需要socket，也不处理请求，供基准测试和模糊测试使用
+    enum PARSE_RESULT {
+        PARSE_DONE = 0,         // 解析出一个完整的请求（含请求体）
+        PARSE_MORE,             // 请求尚不完整
+        PARSE_ERROR             // 请求有误，或服务器会直接回复错误（400、403、413等）
+    };
+    void reset_parser();                                // 丢弃已接收的数据，读缓冲区保留
+    int parse_input(const char *data, int len);         // 追加数据并继续解析，返回PARSE_RESULT
+    void next_request();                                // 上一个请求完整后，继续解析其后的流水线请求
+    bool parser_consistent() const;                     // 检查读缓冲区的下标和已解析字段的指针
+    int request_bytes() const { return m_checked_index - m_request_start; }  // 当前请求已解析的字节数
+    const char *url() const { return m_url; }
+    METHOD method() const { return m_method; }
 
     
 private:
-    static const int READ_BUFFER_SIZE = 2048;           // 读缓冲大小
-    static const int WRITE_BUFFER_SIZE = 1024;          // 写缓冲大小
+    static const int MAX_READ_BUFFER_SIZE = 64 * 1024;  // 读缓冲最大大小，请求头超过时关闭连接
+    static const int BODY_BUFFER_SIZE = 16 * 1024;      // 接收请求体时读缓冲区最多扩大到的大小
+    static const int WRITE_BUFFER_SIZE = 4096;          // 写缓冲大小，容纳一批流水线响应的响应头
     static const int MAX_FILE_PATH_SIZE = 256;          // 最大路径长度
+    static const int SENDFILE_THRESHOLD = 256 * 1024;   // 不小于该大小的文件用sendfile发送，否则mmap
+    static const int SENDFILE_CHUNK_SIZE = 1024 * 1024; // 每次sendfile的最大字节数
+    static const int MAX_PIPELINE = 16;                 // 一次批量处理的最大流水线请求数
+    static const int MIN_RESPONSE_SPACE = 512;          // 写缓冲剩余空间不足时停止批量处理
+    static const int MAX_RANGES = 8;                    // 一个请求最多的字节范围数，超过时按完整文件响应
+    static const int MULTIPART_BUFFER_SIZE = 4096;      // 多范围响应中各部分分隔头的缓冲大小
+    // 每个响应一段响应头和一段响应体，多范围响应每个范围再多一段分隔头和一段数据
+    static const int IV_CAPACITY = MAX_PIPELINE * 2 + MAX_RANGES * 2 + 2;
 
     // 解析客户端请求时，主状态机的状态
     enum CHECK_STATE {
@@ -34,9 +136,6 @@ private:
         LINE_OPEN   // 行数据尚不完整
     };
 
-    // http请求方法，但代码中只支持GET
-    enum METHOD { GET=0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT };
-    
     // 服务器处理http请求的可能结果
     enum HTTP_CODE {
         NO_REQUEST,             // 请求不完整，需要继续读取客户端数据
@@ -45,57 +144,146 @@ private:
         NO_RESOURCE,            // 服务器没有资源
         FORBIDDED_REQUEST,      // 客户对资源没有足够的访问权限
         FILE_REQUEST,           // 文件请求，获取文件成功
+        NOT_MODIFIED,           // 条件请求的校验器匹配，响应304
+        RANGE_NOT_SATISFIABLE,  // 请求的范围都在文件之外，响应416
+        DYNAMIC_REQUEST,        // 响应体由服务器生成，如内置指标
+        CREATED_REQUEST,        // 上传的文件已保存，响应201
+        METHOD_NOT_ALLOWED,     // 没有处理该方法的路由，静态文件也不支持，响应405
+        PAYLOAD_TOO_LARGE,      // 请求体超过路由的上限，响应413
+        SLOW_REQUEST,           // 内联处理时遇到需要访问文件系统的请求
         INTERNAL_ERROR,         // 表示服务器内部错误
         CLOSE_CONNECTION        // 表示客户端已关闭连接
     };
 
     int m_sockfd;                           // 该http连接的socket
+    int m_epollfd;                          // 该连接注册到的epoll对象（所属反应堆），-1表示不使用epoll
+    reactor *m_owner;                       // 所属反应堆，工作线程处理完后交还给它
+    bool m_reactor_io;                      // socket只由所属反应堆读写（io_uring和协程反应堆）
+    uring_io m_uring_io;
+    std::atomic<int> *m_user_count;         // 所属反应堆的连接计数
+    timer_node m_timer;                     // 由所属反应堆的时间轮管理
+    int m_timer_kind;
+    std::atomic<bool> m_busy;
     sockaddr_in m_address;                  // 通信的socket地址
 
     CHECK_STATE m_check_state;              // 主状态机所处的状态
 
-    char m_read_buf[READ_BUFFER_SIZE];      // 读缓冲区
+    char *m_read_buf;                       // 读缓冲区，从内存池借用，空闲时为NULL
+    int m_read_size;                        // 读缓冲区大小
     int m_read_index;                       // 标识读缓冲区未读数据起始位置
     int m_start_line;                       // 当前正在解析的行的起始位置
     int m_checked_index;                    // 当前正在分析的字符在读缓冲区的位置
+    int m_request_start;                    // 当前请求在读缓冲区中的起始位置
+    int m_line_length;                      // 最近解析出的一行的长度，不含行结束符
 
-    char m_real_file[MAX_FILE_PATH_SIZE];   // 客户请求目标文件完整路径
-    struct stat m_file_stat;                // m_real_file文件的相关状态信息
+    struct stat m_file_stat;                // 目标文件的相关状态信息
     char *m_file_address;                   // 客户请求的目标文件被mmap映射到内存中的起始位置
+    int m_file_fd;                          // 大文件用sendfile发送时打开的描述符，-1表示不使用
+    off_t m_file_offset;                    // sendfile的下一个发送位置
+    file_entry *m_file_entry;               // 命中文件缓存时借用的条目，非空时不使用mmap
+    bool m_encoded;                         // 选用了压缩版本，校验器为原文件ETag的弱形式
+    char m_etag[http_header::ETAG_SIZE];    // 原文件的ETag，由check_preconditions生成
+    char *m_dynamic_buf;                    // 生成的响应体，从内存池借用
+    size_t m_dynamic_size;                  // m_dynamic_buf的大小
+    int m_dynamic_len;                      // 响应体长度
+    const char *m_content_type;             // 响应的Content-Type
+    byte_range m_ranges[MAX_RANGES];        // 要发送的字节范围
+    int m_range_count;                      // 0表示发送完整文件
 
     METHOD m_method;        // 请求方法
     char *m_url;            // 请求目标文件
     char *m_version;        // 请求协议版本，http1.1
     char *m_host;           // 主机名
     bool m_linger;          // http请求是否要保持连接
-    int m_content_length;   // http请求的消息总长度
-    char *m_content;        // 请求体
+    long long m_content_length; // 请求体长度，-1表示没有Content-Length
+    bool m_chunked;             // 请求体使用chunked传输编码
+    body_decoder m_body;        // 请求体的解码状态
+    body_sink *m_body_sink;     // 请求体的接收方，收到请求头后才确定
+    const route *m_route;       // 匹配的路由，NULL表示按静态文件处理
+    route_param m_params[router::MAX_PARAMS];   // 路径参数，指向读缓冲区
+    int m_param_count;
+    unsigned m_allowed;         // 路径匹配但方法不匹配时，路由支持的方法
+    int m_dynamic_status;       // 动态响应的状态码
+    char *m_if_none_match;      // 条件请求和范围请求的字段，指向读缓冲区
+    char *m_if_modified_since;
+    char *m_range;
+    char *m_if_range;
+    char *m_accept_encoding;
 
     int m_write_idx;                        // 待写数据长度
-    char m_write_buf[WRITE_BUFFER_SIZE];    // 写缓冲区
-    struct iovec m_iv[2];                   // 采用writev来执行写操作
-    int m_iv_count;                         // 被写内存块数量
-    
+    char *m_write_buf;                      // 写缓冲区，从内存池借用，只在生成和发送响应期间持有
+    int m_write_size;                       // 写缓冲区大小
+    // 一批流水线响应中各响应体占用的资源，整批发送完后统一释放
+    struct response_body {
+        char *m_file_address;
+        size_t m_file_size;
+        file_entry *m_file_entry;
+        char *m_dynamic_buf;
+        size_t m_dynamic_size;
+    };
+    response_body m_bodies[MAX_PIPELINE];
+    int m_response_count;                   // 本批已生成的响应数
+    bool m_batch_linger;                    // 本批发送完后是否保持连接
+
+    struct iovec m_iv[IV_CAPACITY];         // 采用writev来执行写操作
+    int m_iv_count;                         // 被写内存块数量，部分写入后会跳过已发送的部分
+    size_t m_bytes_to_send;                 // 剩余待发送的字节数（含sendfile部分）
+    size_t m_bytes_have_send;               // 已发送的字节数
+
+    bool m_inline;                          // 正在反应堆线程中内联处理
+    bool m_deferred;                        // 已解析完的请求留给线程池执行do_request
+    unsigned long long m_enqueue_ns;        // 本批请求交给线程池（或开始内联处理）的时间
+    unsigned long long m_do_request_ns;     // 最近一次do_request的耗时
+
 
     void init();                                // 初始化连接其余信息
-    HTTP_CODE process_read();                   // 解析http请求
+    void init_request();                        // 初始化单个请求的解析状态
+    bool build_responses();                     // 为读缓冲区中的请求生成一批响应
+    void init_write();                          // 清空已发送完的一批响应
+    void compact_read_buf();                    // 把剩余的流水线请求移到读缓冲区开头
+    void rebase_read_buf(char *new_buf, int shift);
+    bool grow_read_buf();                       // 借用或扩大读缓冲区
+    bool header_complete() const;               // 读缓冲区中已有完整的请求头
+    void release_read_buf();
+    void release_write_buf();
+    HTTP_CODE process_read();                   // 解析并处理http请求
+    HTTP_CODE parse_request();                  // 只解析，得到完整请求时返回GET_REQUEST
     HTTP_CODE parse_request_line(char *text);   // 解析请求首行
     HTTP_CODE parse_header(char *text);         // 解析请求头
-    HTTP_CODE parse_content(char *text);        // 解析请求体 TODO
+    HTTP_CODE parse_content();                  // 把请求体分片交给接收方
+    HTTP_CODE open_body_sink();                 // 按请求确定请求体的接收方
+    void release_body_sink();
+    void consume_input(int len);                // 丢弃已交给接收方的请求体
     LINE_STATUS parse_line();                   // 解析一行数据
     HTTP_CODE do_request();                     // 做具体处理
-    void unmap();                               // 释放内存映射
+    HTTP_CODE timed_do_request();               // 记录耗时后调用do_request
+    HTTP_CODE route_request();                  // 调用路由处理函数
+    HTTP_CODE check_preconditions();            // 按If-None-Match/If-Modified-Since和Range决定响应方式
+    bool select_encoding(const char *real_file);// 客户端接受压缩且已有压缩版本时改为发送压缩版本
+    void unmap();                               // 释放内存映射或归还缓存条目
+    void rearm(int ev);                         // 告诉所属反应堆下一步等待可读还是可写
     char *get_line() { return m_read_buf + m_start_line;} // 获取一行数据
 
     bool process_write(HTTP_CODE read_ret);     // 生成响应
-    bool add_response(const char *format, ...);
-    bool add_status_line(int status, const char *title);
-    bool add_headers(int content_len);
-    bool add_content_length(int content_len);
+    void advance_iv(size_t bytes);              // 部分写入后推进iovec
+    void add_iv(char *base, size_t len);        // 追加一段待发送数据
+    // 响应头由预先生成的片段拼接，整数用http_header::format_uint转换，不经过printf
+    bool append(const char *data, int len);
+    bool append(const char *str);
+    bool append_uint(unsigned long long v);
+    bool add_status_line(int status, const char *line); // line为完整的状态行
+    bool add_status_line(int status);                   // 按状态码和原因短语生成状态行
+    bool add_allow();                                   // 405响应的Allow
+    bool add_headers(long long content_len);
+    bool add_content_length(long long content_len);
     bool add_content_type();
+    bool add_date();                            // 每个线程每秒生成一次的Date
     bool add_linger();
     bool add_blank_line();
-    bool add_content(const char *content);
+    bool add_error(int status);                 // 预先生成的400/403/404/500/503响应
+    bool add_form(const char *form);            // 错误响应的响应体，HEAD时省略
+    bool add_validators();                      // ETag、Last-Modified和Accept-Ranges
+    bool add_ranges(char *data);                // 生成206响应，data为文件内容，sendfile时为NULL
 };
 
 #endif // HTTPCONNECTION_H
\ No newline at end of file
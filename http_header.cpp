@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "http_header.h"
+
+// 扩展名 -> MIME类型，文本类型带上字符集
+static const struct {
+    const char *m_ext;
+    const char *m_type;
+} mime_table[] = {
+    { "html", "text/html; charset=utf-8" },
+    { "htm", "text/html; charset=utf-8" },
+    { "css", "text/css; charset=utf-8" },
+    { "js", "application/javascript; charset=utf-8" },
+    { "mjs", "application/javascript; charset=utf-8" },
+    { "json", "application/json" },
+    { "map", "application/json" },
+    { "xml", "application/xml" },
+    { "txt", "text/plain; charset=utf-8" },
+    { "md", "text/markdown; charset=utf-8" },
+    { "csv", "text/csv; charset=utf-8" },
+    { "svg", "image/svg+xml" },
+    { "ico", "image/x-icon" },
+    { "png", "image/png" },
+    { "jpg", "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "gif", "image/gif" },
+    { "webp", "image/webp" },
+    { "avif", "image/avif" },
+    { "woff", "font/woff" },
+    { "woff2", "font/woff2" },
+    { "ttf", "font/ttf" },
+    { "otf", "font/otf" },
+    { "wasm", "application/wasm" },
+    { "pdf", "application/pdf" },
+    { "zip", "application/zip" },
+    { "gz", "application/gzip" },
+    { "mp3", "audio/mpeg" },
+    { "mp4", "video/mp4" },
+    { "webm", "video/webm" },
+};
+
+const char *http_header::mime_type(const char *path) {
+    const char *slash = strrchr(path, '/');
+    const char *dot = strrchr(slash ? slash : path, '.');
+    if(dot) {
+        for(size_t i=0; i<sizeof(mime_table) / sizeof(mime_table[0]); ++i) {
+            if(strcasecmp(dot + 1, mime_table[i].m_ext) == 0) {
+                return mime_table[i].m_type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+bool http_header::compressible(const char *mime) {
+    return strncmp(mime, "text/", 5) == 0 || strncmp(mime, "application/javascript", 22) == 0 ||
+           strncmp(mime, "application/json", 16) == 0 || strncmp(mime, "application/xml", 15) == 0 ||
+           strncmp(mime, "application/wasm", 16) == 0 || strncmp(mime, "image/svg+xml", 13) == 0;
+}
+
+int http_header::parse_accept_encoding(const char *value) {
+    int encodings = 0;
+    const char *p = value;
+    while(*p) {
+        p += strspn(p, " \t,");
+        const char *name = p;
+        int len = strcspn(p, " \t,;");
+        p += len;
+        // 参数中只关心q值
+        bool refused = false;
+        while(*p == ';' || *p == ' ' || *p == '\t') {
+            p += strspn(p, " \t;");
+            if((p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+                refused = atof(p + 2) <= 0;
+            }
+            p += strcspn(p, ",;");
+        }
+        if(refused) {
+            continue;
+        }
+        if(len == 4 && strncasecmp(name, "gzip", 4) == 0) {
+            encodings |= ENCODING_GZIP;
+        } else if(len == 2 && strncasecmp(name, "br", 2) == 0) {
+            encodings |= ENCODING_BR;
+        } else if(len == 1 && name[0] == '*') {
+            encodings |= ENCODING_GZIP | ENCODING_BR;
+        }
+    }
+    return encodings;
+}
+
+const char *http_header::encoding_name(int encoding) {
+    return encoding == ENCODING_BR ? "br" : encoding == ENCODING_GZIP ? "gzip" : "identity";
+}
+
+const char *http_header::encoding_suffix(int encoding) {
+    return encoding == ENCODING_BR ? ".br" : encoding == ENCODING_GZIP ? ".gz" : "";
+}
+
+const char *http_header::reason_phrase(int status) {
+    switch(status) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 202: return "Accepted";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 303: return "See Other";
+        case 304: return "Not Modified";
+        case 307: return "Temporary Redirect";
+        case 308: return "Permanent Redirect";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 410: return "Gone";
+        case 413: return "Payload Too Large";
+        case 415: return "Unsupported Media Type";
+        case 416: return "Range Not Satisfiable";
+        case 422: return "Unprocessable Content";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        default: return "Unknown";
+    }
+}
+
+// 两位十进制数的字符表，每次除以100转出两位
+static const char digit_pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+static const char week_names[][4] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char month_names[][4] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static char *put_2digits(char *p, int v) {
+    memcpy(p, digit_pairs + v * 2, 2);
+    return p + 2;
+}
+
+int http_header::format_uint(unsigned long long v, char *buf) {
+    char tmp[UINT_SIZE];
+    char *p = tmp + UINT_SIZE;
+    while(v >= 100) {
+        p -= 2;
+        memcpy(p, digit_pairs + (v % 100) * 2, 2);
+        v /= 100;
+    }
+    if(v >= 10) {
+        p -= 2;
+        memcpy(p, digit_pairs + v * 2, 2);
+    } else {
+        *--p = '0' + v;
+    }
+    int len = tmp + UINT_SIZE - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+int http_header::format_hex(unsigned long long v, char *buf) {
+    static const char hex[] = "0123456789abcdef";
+    char tmp[UINT_SIZE];
+    char *p = tmp + UINT_SIZE;
+    do {
+        *--p = hex[v & 0xf];
+        v >>= 4;
+    } while(v);
+    int len = tmp + UINT_SIZE - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+int http_header::format_etag(const struct stat &st, char *buf, int size) {
+    if(size < ETAG_SIZE) {
+        return 0;
+    }
+    char *p = buf;
+    *p++ = '"';
+    p += format_hex((unsigned long long)st.st_mtime, p);
+    *p++ = '-';
+    p += format_hex((unsigned long long)st.st_size, p);
+    *p++ = '"';
+    *p = '\0';
+    return p - buf;
+}
+
+// 固定格式，不经过strftime的区域设置和格式解析
+int http_header::format_date(time_t t, char *buf, int size) {
+    struct tm tm;
+    if(size < DATE_SIZE || !gmtime_r(&t, &tm) || tm.tm_year + 1900 > 9999) {
+        return 0;
+    }
+    char *p = buf;
+    memcpy(p, week_names[tm.tm_wday], 3);
+    p += 3;
+    *p++ = ',';
+    *p++ = ' ';
+    p = put_2digits(p, tm.tm_mday);
+    *p++ = ' ';
+    memcpy(p, month_names[tm.tm_mon], 3);
+    p += 3;
+    *p++ = ' ';
+    p = put_2digits(p, (tm.tm_year + 1900) / 100);
+    p = put_2digits(p, (tm.tm_year + 1900) % 100);
+    *p++ = ' ';
+    p = put_2digits(p, tm.tm_hour);
+    *p++ = ':';
+    p = put_2digits(p, tm.tm_min);
+    *p++ = ':';
+    p = put_2digits(p, tm.tm_sec);
+    memcpy(p, " GMT", 5);
+    return p + 4 - buf;
+}
+
+const char *http_header::date_line(int *len) {
+    static thread_local time_t cached = 0;
+    static thread_local char line[DATE_SIZE + 8] = "Date: ";
+    static thread_local int line_len = 0;
+    time_t now = time(NULL);
+    if(now != cached) {
+        cached = now;
+        int n = format_date(now, line + 6, DATE_SIZE);
+        memcpy(line + 6 + n, "\r\n", 2);
+        line_len = 6 + n + 2;
+    }
+    *len = line_len;
+    return line;
+}
+
+bool http_header::parse_date(const char *s, time_t *t) {
+    static const char *formats[] = {
+        "%a, %d %b %Y %H:%M:%S GMT",    // IMF-fixdate
+        "%A, %d-%b-%y %H:%M:%S GMT",    // RFC 850
+        "%a %b %e %H:%M:%S %Y"          // asctime
+    };
+    for(size_t i=0; i<sizeof(formats) / sizeof(formats[0]); ++i) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *end = strptime(s, formats[i], &tm);
+        if(end && *end == '\0') {
+            *t = timegm(&tm);
+            return true;
+        }
+    }
+    return false;
+}
+
+// 比较一个实体标签（不含W/前缀）与etag，tag以引号结束
+static bool same_opaque_tag(const char *tag, int len, const char *etag) {
+    return (int)strlen(etag) == len && strncmp(tag, etag, len) == 0;
+}
+
+bool http_header::etag_list_match(const char *list, const char *etag) {
+    const char *p = list;
+    while(*p) {
+        p += strspn(p, " \t,");
+        if(*p == '*') {
+            return true;
+        }
+        if(strncmp(p, "W/", 2) == 0) {
+            p += 2;
+        }
+        if(*p != '"') {
+            // 格式不对，视为不匹配
+            return false;
+        }
+        const char *close = strchr(p + 1, '"');
+        if(!close) {
+            return false;
+        }
+        if(same_opaque_tag(p, close - p + 1, etag)) {
+            return true;
+        }
+        p = close + 1;
+    }
+    return false;
+}
+
+bool http_header::if_range_match(const char *value, const char *etag, time_t mtime) {
+    if(value[0] == '"') {
+        return strcmp(value, etag) == 0;
+    }
+    if(strncmp(value, "W/", 2) == 0) {
+        // 弱标签不能用于If-Range
+        return false;
+    }
+    time_t t;
+    return parse_date(value, &t) && t == mtime;
+}
+
+// 解析一个非负十进制数，至少一位数字
+static bool parse_offset(const char *&p, off_t *v) {
+    if(!isdigit((unsigned char)*p)) {
+        return false;
+    }
+    off_t n = 0;
+    while(isdigit((unsigned char)*p)) {
+        if(n > (off_t)0x7fffffffffffffffll / 10 - 1) {
+            return false;
+        }
+        n = n * 10 + (*p++ - '0');
+    }
+    *v = n;
+    return true;
+}
+
+int http_header::parse_range(const char *value, off_t size, byte_range *ranges, int max) {
+    const char *p = value;
+    if(strncasecmp(p, "bytes=", 6) != 0) {
+        return 0;
+    }
+    p += 6;
+    int count = 0;
+    bool any = false;
+    while(true) {
+        p += strspn(p, " \t");
+        off_t first, last;
+        if(*p == '-') {
+            // 后缀范围：最后n个字节
+            ++p;
+            off_t suffix;
+            if(!parse_offset(p, &suffix)) {
+                return 0;
+            }
+            any = true;
+            if(suffix == 0 || size == 0) {
+                first = 1;
+                last = 0;
+            } else {
+                first = suffix >= size ? 0 : size - suffix;
+                last = size - 1;
+            }
+        } else {
+            if(!parse_offset(p, &first) || *p++ != '-') {
+                return 0;
+            }
+            any = true;
+            if(isdigit((unsigned char)*p)) {
+                if(!parse_offset(p, &last) || last < first) {
+                    return 0;
+                }
+                if(last >= size) {
+                    last = size - 1;
+                }
+            } else {
+                last = size - 1;
+            }
+        }
+        if(first <= last && first < size) {
+            if(count == max) {
+                return 0;
+            }
+            ranges[count].m_first = first;
+            ranges[count].m_last = last;
+            ++count;
+        }
+        p += strspn(p, " \t");
+        if(*p == '\0') {
+            break;
+        }
+        if(*p++ != ',') {
+            return 0;
+        }
+    }
+    if(!any) {
+        return 0;
+    }
+    return count > 0 ? count : -1;
+}
@@ -0,0 +1,64 @@
+#ifndef HTTP_HEADER_H
+#define HTTP_HEADER_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// 请求的一个字节范围，闭区间
+struct byte_range {
+    off_t m_first;
+    off_t m_last;
+};
+
+// 响应可用的内容编码，按位组合表示客户端接受的编码
+enum CONTENT_ENCODING {
+    ENCODING_IDENTITY = 0,
+    ENCODING_GZIP = 1,
+    ENCODING_BR = 2
+};
+
+// 响应头格式化与条件请求、范围请求、内容协商相关的请求头解析
+class http_header {
+public:
+    static const int ETAG_SIZE = 48;
+    static const int DATE_SIZE = 32;
+    static const int UINT_SIZE = 20;        // 64位无符号整数的最大十进制位数
+
+    // 按扩展名查MIME类型，未知扩展名为application/octet-stream
+    static const char *mime_type(const char *path);
+    // 文本类内容值得压缩，图片、视频、字体等已压缩的格式不值得
+    static bool compressible(const char *mime);
+    // 解析Accept-Encoding，返回客户端接受的编码（gzip、br），q=0的编码视为不接受
+    static int parse_accept_encoding(const char *value);
+    // Content-Encoding的取值和压缩文件的扩展名
+    static const char *encoding_name(int encoding);
+    static const char *encoding_suffix(int encoding);
+
+    // 状态码的原因短语，未知状态码为"Unknown"
+    static const char *reason_phrase(int status);
+
+    // 无符号整数转十进制、十六进制，不加结尾的'\0'，buf至少UINT_SIZE字节，返回长度
+    static int format_uint(unsigned long long v, char *buf);
+    static int format_hex(unsigned long long v, char *buf);
+    // 强校验的ETag："修改时间-大小"，均为十六进制，返回长度
+    static int format_etag(const struct stat &st, char *buf, int size);
+    // IMF-fixdate格式的HTTP日期，如 Sun, 06 Nov 1994 08:49:37 GMT，返回长度
+    static int format_date(time_t t, char *buf, int size);
+    // 当前时间的"Date: ...\r\n"响应头，每个线程缓存一份，每秒最多重新生成一次
+    static const char *date_line(int *len);
+    // 解析HTTP日期，接受IMF-fixdate、RFC 850和asctime三种格式
+    static bool parse_date(const char *s, time_t *t);
+
+    // If-None-Match的值是否包含etag，按弱比较（忽略W/前缀），"*"匹配任何实体
+    static bool etag_list_match(const char *list, const char *etag);
+    // If-Range的值是否仍指向当前文件：实体标签按强比较，日期须与修改时间完全相同
+    static bool if_range_match(const char *value, const char *etag, time_t mtime);
+
+    // 解析Range: bytes=0-99,200-,-500，结果按请求顺序写入ranges并截到文件大小之内，
+    // 返回范围个数；格式不对、不是bytes单位或超过max个时返回0，表示忽略Range按完整文件响应；
+    // 所有范围都超出文件大小时返回-1，应响应416
+    static int parse_range(const char *value, off_t size, byte_range *ranges, int max);
+};
+
+#endif // HTTP_HEADER_H
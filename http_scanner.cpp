@@ -0,0 +1,199 @@
+#include <stddef.h>
+#include <strings.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCANNER_X86
+#endif
+
+#include "http_scanner.h"
+
+static const char *find_scalar(const char *p, const char *end, char a, char b) {
+    for(; p < end; ++p) {
+        if(*p == a || *p == b) {
+            return p;
+        }
+    }
+    return end;
+}
+
+#ifdef SCANNER_X86
+// 用字符集比较指令一次检查16个字节
+__attribute__((target("sse4.2")))
+static const char *find_sse42(const char *p, const char *end, char a, char b) {
+    const __m128i set = _mm_setr_epi8(a, b, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for(; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int idx = _mm_cmpestri(set, 2, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if(idx < 16) {
+            return p + idx;
+        }
+    }
+    return find_scalar(p, end, a, b);
+}
+
+// 两次按字节比较后合并成位掩码，一次检查32个字节
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *p, const char *end, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for(; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if(mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_scalar(p, end, a, b);
+}
+#endif
+
+static bool cpu_supports(http_scanner::IMPL impl) {
+#ifdef SCANNER_X86
+    __builtin_cpu_init();
+    switch(impl) {
+        case http_scanner::IMPL_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case http_scanner::IMPL_SSE42:
+            return __builtin_cpu_supports("sse4.2");
+        default:
+            return true;
+    }
+#else
+    return impl == http_scanner::IMPL_SCALAR;
+#endif
+}
+
+static http_scanner::IMPL best_impl() {
+    if(cpu_supports(http_scanner::IMPL_AVX2)) {
+        return http_scanner::IMPL_AVX2;
+    }
+    if(cpu_supports(http_scanner::IMPL_SSE42)) {
+        return http_scanner::IMPL_SSE42;
+    }
+    return http_scanner::IMPL_SCALAR;
+}
+
+http_scanner::IMPL http_scanner::s_impl = IMPL_SCALAR;
+http_scanner::find_func http_scanner::s_find = find_scalar;
+
+// 静态初始化时选择实现
+static bool scanner_initialized = http_scanner::set_impl(best_impl());
+
+bool http_scanner::set_impl(IMPL impl) {
+    if(!cpu_supports(impl)) {
+        return false;
+    }
+    switch(impl) {
+#ifdef SCANNER_X86
+        case IMPL_AVX2:
+            s_find = find_avx2;
+            break;
+        case IMPL_SSE42:
+            s_find = find_sse42;
+            break;
+#endif
+        default:
+            s_find = find_scalar;
+            break;
+    }
+    s_impl = impl;
+    return true;
+}
+
+const char *http_scanner::impl_name(IMPL impl) {
+    switch(impl) {
+        case IMPL_AVX2:
+            return "avx2";
+        case IMPL_SSE42:
+            return "sse4.2";
+        default:
+            return "scalar";
+    }
+}
+
+// 字段名的完美哈希：(长度 + 首字母*20 + 末字母*10) & 63，对下表中的字段名两两不冲突，
+// 字母按小写计算。表由离线搜索系数生成，增删字段时需要重新搜索
+struct header_slot {
+    const char *m_name;
+    int m_len;
+    HEADER_NAME m_id;
+};
+
+static const header_slot header_table[64] = {
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Cache-Control", 13, HEADER_CACHE_CONTROL },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Te", 2, HEADER_TE },
+    { "Via", 3, HEADER_VIA },
+    { "Date", 4, HEADER_DATE },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Trailer", 7, HEADER_TRAILER },
+    { "If-Match", 8, HEADER_IF_MATCH },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Pragma", 6, HEADER_PRAGMA },
+    { "If-None-Match", 13, HEADER_IF_NONE_MATCH },
+    { "Connection", 10, HEADER_CONNECTION },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Accept-Language", 15, HEADER_ACCEPT_LANGUAGE },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Keep-Alive", 10, HEADER_KEEP_ALIVE },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Content-Length", 14, HEADER_CONTENT_LENGTH },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Upgrade", 7, HEADER_UPGRADE },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Range", 5, HEADER_RANGE },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Accept", 6, HEADER_ACCEPT },
+    { "Referer", 7, HEADER_REFERER },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Transfer-Encoding", 17, HEADER_TRANSFER_ENCODING },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Accept-Encoding", 15, HEADER_ACCEPT_ENCODING },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Host", 4, HEADER_HOST },
+    { "Authorization", 13, HEADER_AUTHORIZATION },
+    { "If-Range", 8, HEADER_IF_RANGE },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Expect", 6, HEADER_EXPECT },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Cookie", 6, HEADER_COOKIE },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "User-Agent", 10, HEADER_USER_AGENT },
+    { "If-Modified-Since", 17, HEADER_IF_MODIFIED_SINCE },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "If-Unmodified-Since", 19, HEADER_IF_UNMODIFIED_SINCE },
+    { "Content-Type", 12, HEADER_CONTENT_TYPE },
+    { "Upgrade-Insecure-Requests", 25, HEADER_UPGRADE_INSECURE_REQUESTS },
+    { NULL, 0, HEADER_UNKNOWN },
+    { NULL, 0, HEADER_UNKNOWN },
+    { "Origin", 6, HEADER_ORIGIN },
+    { NULL, 0, HEADER_UNKNOWN },
+};
+
+HEADER_NAME http_scanner::classify_header(const char *name, int len) {
+    if(len <= 0) {
+        return HEADER_UNKNOWN;
+    }
+    unsigned h = (unsigned)len + ((unsigned char)name[0] | 0x20) * 20 + ((unsigned char)name[len-1] | 0x20) * 10;
+    const header_slot &slot = header_table[h & 63];
+    if(slot.m_len != len || strncasecmp(slot.m_name, name, len) != 0) {
+        return HEADER_UNKNOWN;
+    }
+    return slot.m_id;
+}
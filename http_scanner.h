@@ -0,0 +1,72 @@
+#ifndef HTTP_SCANNER_H
+#define HTTP_SCANNER_H
+
+// 已知的请求头字段名，由http_scanner::classify_header用完美哈希识别
+enum HEADER_NAME {
+    HEADER_UNKNOWN = 0,
+    HEADER_HOST,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_EXPECT,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_ACCEPT_LANGUAGE,
+    HEADER_USER_AGENT,
+    HEADER_COOKIE,
+    HEADER_REFERER,
+    HEADER_CACHE_CONTROL,
+    HEADER_PRAGMA,
+    HEADER_UPGRADE_INSECURE_REQUESTS,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_RANGE,
+    HEADER_RANGE,
+    HEADER_ORIGIN,
+    HEADER_UPGRADE,
+    HEADER_AUTHORIZATION,
+    HEADER_KEEP_ALIVE,
+    HEADER_DATE,
+    HEADER_IF_MATCH,
+    HEADER_IF_UNMODIFIED_SINCE,
+    HEADER_TE,
+    HEADER_TRAILER,
+    HEADER_VIA,
+    HEADER_NAME_NUMBER
+};
+
+// http请求的字符扫描：在[p, end)中一次比较16（SSE4.2）或32（AVX2）个字节查找分隔符，
+// 启动时按CPU支持的指令集选择实现，不支持时退化为逐字节扫描。
+// 只读取[p, end)之内的字节，不足一个向量宽度的尾部逐字节处理
+class http_scanner {
+public:
+    enum IMPL { IMPL_SCALAR, IMPL_SSE42, IMPL_AVX2 };
+
+    // 返回[p, end)中第一个等于a或b的字节的位置，没有时返回end
+    static const char *find(const char *p, const char *end, char a, char b) {
+        return s_find(p, end, a, b);
+    }
+    // 行结束符\r或\n
+    static const char *find_line_end(const char *p, const char *end) { return find(p, end, '\r', '\n'); }
+    // 请求首行中的空白分隔符
+    static const char *find_space(const char *p, const char *end) { return find(p, end, ' ', '\t'); }
+    // 请求头字段名结束处的冒号
+    static const char *find_colon(const char *p, const char *end) { return find(p, end, ':', ':'); }
+
+    // 识别长度为len的字段名（不区分大小写），不是已知字段时返回HEADER_UNKNOWN
+    static HEADER_NAME classify_header(const char *name, int len);
+
+    static IMPL impl() { return s_impl; }
+    static const char *impl_name(IMPL impl);
+    // 切换实现，供基准测试对比使用，CPU不支持时返回false
+    static bool set_impl(IMPL impl);
+
+private:
+    typedef const char *(*find_func)(const char *p, const char *end, char a, char b);
+
+    static IMPL s_impl;
+    static find_func s_find;
+};
+
+#endif // HTTP_SCANNER_H
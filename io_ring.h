@@ -0,0 +1,87 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+// 内核头文件提供io_uring接口时默认编译io_uring反应堆，编译时加 -DNO_IO_URING 只保留epoll
+#if !defined(NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <stddef.h>
+#include <atomic>
+#include <linux/io_uring.h>
+
+// io_uring的最小封装：直接用系统调用创建提交队列、完成队列并映射到用户空间，不依赖liburing。
+// 只由一个线程提交和收割，另外管理一组提供给内核的缓冲区，供IOSQE_BUFFER_SELECT的接收操作使用
+class io_ring {
+public:
+    io_ring();
+    ~io_ring();
+
+    // entries为提交队列大小；内核支持时只允许启用队列的线程提交（SINGLE_ISSUER），
+    // 并把完成事件推迟到等待时处理，此时须在提交线程中调用enable()后才能使用
+    bool init(unsigned entries);
+    bool enable();
+    // 分配count个大小为size的缓冲区作为缓冲区组group，随下一次提交交给内核
+    bool setup_buffers(int group, unsigned count, unsigned size);
+
+    // 取一个清零的提交项，提交队列已满时先把已有的提交给内核
+    struct io_uring_sqe *get_sqe();
+    // 提交所有新提交项并等待至少wait_nr个完成事件，timeout_ms<0表示不限时，返回负的错误码表示失败
+    int submit_and_wait(unsigned wait_nr, int timeout_ms);
+    // 依次取出完成事件，处理完一个调用一次cqe_seen
+    struct io_uring_cqe *peek_cqe();
+    void cqe_seen();
+
+    char *buffer(int id) { return m_bufs + (size_t)id * m_buf_size; }
+    unsigned buffer_size() const { return m_buf_size; }
+    void recycle_buffer(int id);            // 把取出数据后的缓冲区还给内核，随下一次提交生效
+
+    unsigned features() const { return m_features; }
+    bool supports(int opcode);              // 内核是否支持该操作
+    // 系统调用次数和提交的操作数，用于与epoll对比
+    unsigned long long enters() const { return m_enters.load(std::memory_order_relaxed); }
+    unsigned long long submitted() const { return m_submitted.load(std::memory_order_relaxed); }
+
+private:
+    int enter(unsigned to_submit, unsigned wait_nr, unsigned flags, int timeout_ms);
+    unsigned flush();                       // 发布新提交项，返回尚未被内核取走的个数
+
+private:
+    int m_fd;
+    unsigned m_setup_flags;
+    unsigned m_features;
+
+    void *m_sq_ptr;                         // 提交队列环的映射
+    size_t m_sq_size;
+    void *m_cq_ptr;                         // 完成队列环的映射，内核支持时与提交队列共用一次映射
+    size_t m_cq_size;
+    struct io_uring_sqe *m_sqes;
+    size_t m_sqes_size;
+
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    unsigned *m_sq_array;
+    unsigned m_sqe_tail;                    // 本地已填写到的位置，flush时发布给内核
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+
+    char *m_bufs;                           // 提供给内核的缓冲区
+    size_t m_bufs_size;
+    unsigned m_buf_size;
+    int m_buf_group;
+
+    std::atomic<unsigned long long> m_enters;
+    std::atomic<unsigned long long> m_submitted;
+};
+
+#endif // HAVE_IO_URING
+
+#endif // IO_RING_H
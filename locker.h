@@ -32,6 +32,32 @@ private:
     pthread_mutex_t m_mutex;
 };
 
+// 读写锁类
+class rwlocker {
+public:
+    rwlocker() {
+        if(pthread_rwlock_init(&m_rwlock, NULL) != 0) {
+            throw std::exception();
+        }
+    }
+    ~rwlocker() {
+        pthread_rwlock_destroy(&m_rwlock);
+    }
+
+    bool rdlock() {
+        return pthread_rwlock_rdlock(&m_rwlock) == 0;
+    }
+    bool wrlock() {
+        return pthread_rwlock_wrlock(&m_rwlock) == 0;
+    }
+    bool unlock() {
+        return pthread_rwlock_unlock(&m_rwlock) == 0;
+    }
+
+private:
+    pthread_rwlock_t m_rwlock;
+};
+
 // 条件变量类
 class cond {
 public:
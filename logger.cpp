@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "logger.h"
+
+static_assert(sizeof(log_record) == log_record::SIZE, "log_record must stay fixed-size");
+
+// 调用init之前不记录任何日志
+std::atomic<int> logger::s_level(LOG_LEVEL_ERROR + 1);
+
+static const char *level_names[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+logger *logger::get_instance() {
+    // 不析构：其他线程退出时仍会访问
+    static logger *instance = new logger();
+    return instance;
+}
+
+logger::logger() : m_next_index(0), m_dead_drops(0), m_reported_drops(0), m_fd(-1), m_thread(0),
+    m_running(false), m_stop(false), m_buf_len(0) {
+}
+
+logger::~logger() {
+}
+
+bool logger::init(const char *path, int level) {
+    if(strcmp(path, "-") == 0) {
+        m_fd = STDOUT_FILENO;
+    } else {
+        m_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if(m_fd < 0) {
+            return false;
+        }
+    }
+    if(pthread_create(&m_thread, NULL, worker, this) != 0) {
+        return false;
+    }
+    m_running = true;
+    s_level.store(level, std::memory_order_relaxed);
+    return true;
+}
+
+void logger::stop() {
+    if(!m_running) {
+        return;
+    }
+    m_stop.store(true, std::memory_order_release);
+    pthread_join(m_thread, NULL);
+    m_running = false;
+}
+
+uint64_t logger::now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+logger::ring_holder::~ring_holder() {
+    if(m_ring) {
+        m_ring->m_closed.store(true, std::memory_order_release);
+    }
+}
+
+log_ring *logger::local_ring() {
+    static thread_local ring_holder holder;
+    if(!holder.m_ring) {
+        holder.m_ring = get_instance()->register_ring();
+    }
+    return holder.m_ring;
+}
+
+log_ring *logger::register_ring() {
+    m_lock.lock();
+    log_ring *ring = new log_ring(m_next_index++);
+    m_rings.push_back(ring);
+    m_lock.unlock();
+    return ring;
+}
+
+unsigned long long logger::drops() const {
+    m_lock.lock();
+    unsigned long long n = m_dead_drops;
+    for(size_t i=0; i<m_rings.size(); ++i) {
+        n += m_rings[i]->m_drops.load(std::memory_order_relaxed);
+    }
+    m_lock.unlock();
+    return n;
+}
+
+void *logger::worker(void *arg) {
+    logger *log = (logger *)arg;
+    log->run();
+    return log;
+}
+
+void logger::run() {
+    while(!m_stop.load(std::memory_order_acquire)) {
+        if(!drain()) {
+            // 没有日志时休眠，日志的输出延迟最多为一个休眠周期
+            struct timespec ts = { 0, 5 * 1000 * 1000 };
+            nanosleep(&ts, NULL);
+        }
+    }
+    drain();
+}
+
+bool logger::drain() {
+    m_lock.lock();
+    std::vector<log_ring *> rings = m_rings;
+    m_lock.unlock();
+
+    bool any = false;
+    unsigned long long drops = m_dead_drops;
+    for(size_t i=0; i<rings.size(); ++i) {
+        log_ring *ring = rings[i];
+        // 先读closed再取记录，保证回收前已取空
+        bool closed = ring->m_closed.load(std::memory_order_acquire);
+        uint32_t head = ring->m_head.load(std::memory_order_relaxed);
+        uint32_t tail = ring->m_tail.load(std::memory_order_acquire);
+        for(; head != tail; ++head) {
+            format(ring->m_records[head & (log_ring::CAPACITY - 1)], ring->m_thread_index);
+            any = true;
+        }
+        ring->m_head.store(head, std::memory_order_release);
+        drops += ring->m_drops.load(std::memory_order_relaxed);
+
+        if(closed) {
+            m_lock.lock();
+            for(size_t j=0; j<m_rings.size(); ++j) {
+                if(m_rings[j] == ring) {
+                    m_rings.erase(m_rings.begin() + j);
+                    break;
+                }
+            }
+            m_dead_drops += ring->m_drops.load(std::memory_order_relaxed);
+            m_lock.unlock();
+            delete ring;
+        }
+    }
+
+    if(drops > m_reported_drops) {
+        char line[96];
+        int len = snprintf(line, sizeof(line), "logger: dropped %llu records (ring full)\n",
+                           drops - m_reported_drops);
+        append(line, len);
+        m_reported_drops = drops;
+        any = true;
+    }
+    flush();
+    return any;
+}
+
+void logger::append(const char *data, int len) {
+    if(m_buf_len + len > (int)sizeof(m_buf)) {
+        flush();
+    }
+    if(len > (int)sizeof(m_buf)) {
+        len = sizeof(m_buf);
+    }
+    memcpy(m_buf + m_buf_len, data, len);
+    m_buf_len += len;
+}
+
+void logger::flush() {
+    int done = 0;
+    while(done < m_buf_len) {
+        ssize_t n = ::write(m_fd, m_buf + done, m_buf_len - done);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    m_buf_len = 0;
+}
+
+// 按格式串逐个转换说明格式化记录中的参数，每个参数单独调用snprintf，
+// 整数统一按long long/unsigned long long保存，这里换掉原有的长度修饰符
+void logger::format(const log_record &r, int thread_index) {
+    char line[2048];
+    int len = 0;
+    const int cap = sizeof(line) - 2;
+
+    time_t sec = r.m_time_ns / 1000000000ull;
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    len += strftime(line, cap, "%Y-%m-%d %H:%M:%S", &tm);
+    len += snprintf(line + len, cap - len, ".%03d %-5s [%d] ", (int)(r.m_time_ns / 1000000 % 1000),
+                    level_names[r.m_level], thread_index);
+
+    int arg = 0;
+    int offset = 0;
+    for(const char *p = r.m_fmt; *p && len < cap; ++p) {
+        if(*p != '%') {
+            line[len++] = *p;
+            continue;
+        }
+        if(p[1] == '%') {
+            line[len++] = '%';
+            ++p;
+            continue;
+        }
+
+        // 解析一个转换说明：%[标志][宽度][.精度][长度]转换字符，*从整数参数中取值
+        char spec[32];
+        int spec_len = 0;
+        int stars[2];
+        int star_count = 0;
+        spec[spec_len++] = '%';
+        const char *q = p + 1;
+        for(; *q && strchr("-+ #0123456789.*hlLqjzt", *q); ++q) {
+            if(*q == '*') {
+                long long v = 0;
+                if(arg < r.m_argc && (r.m_types[arg] == log_record::ARG_INT || r.m_types[arg] == log_record::ARG_UINT)) {
+                    memcpy(&v, r.m_payload + offset, sizeof(v));
+                    offset += sizeof(v);
+                    ++arg;
+                }
+                if(star_count < 2) {
+                    stars[star_count++] = (int)v;
+                }
+            }
+            if(!strchr("hlLqjzt", *q) && spec_len < (int)sizeof(spec) - 4) {
+                spec[spec_len++] = *q;
+            }
+        }
+        char conv = *q;
+        if(!conv) {
+            break;
+        }
+        p = q;
+        if(arg >= r.m_argc) {
+            // 参数被截断
+            len += snprintf(line + len, cap - len, "<?>");
+            continue;
+        }
+
+        int room = cap - len;
+        int n = 0;
+        int type = r.m_types[arg++];
+        const char *value = r.m_payload + offset;
+        if(type == log_record::ARG_STR) {
+            uint16_t slen;
+            memcpy(&slen, value, 2);
+            offset += 2 + slen;
+            // 字符串不以\0结尾，用精度限制长度，保留标志和宽度
+            spec[spec_len] = '\0';
+            char *dot = strchr(spec, '.');
+            int prec = slen;
+            if(dot) {
+                int explicit_prec = dot[1] == '*' ? stars[star_count-1] : atoi(dot + 1);
+                if(explicit_prec >= 0 && explicit_prec < prec) {
+                    prec = explicit_prec;
+                }
+                *dot = '\0';
+            }
+            bool star_width = strchr(spec, '*') != NULL;
+            strcat(spec, ".*s");
+            n = star_width ? snprintf(line + len, room, spec, stars[0], prec, value + 2) :
+                             snprintf(line + len, room, spec, prec, value + 2);
+        } else if(type == log_record::ARG_DOUBLE) {
+            double v;
+            memcpy(&v, value, sizeof(v));
+            offset += sizeof(v);
+            spec[spec_len++] = strchr("fFeEgGaA", conv) ? conv : 'f';
+            spec[spec_len] = '\0';
+            n = star_count == 2 ? snprintf(line + len, room, spec, stars[0], stars[1], v) :
+                star_count == 1 ? snprintf(line + len, room, spec, stars[0], v) :
+                                  snprintf(line + len, room, spec, v);
+        } else if(type == log_record::ARG_PTR) {
+            void *v;
+            memcpy(&v, value, sizeof(v));
+            offset += sizeof(v);
+            n = snprintf(line + len, room, "%p", v);
+        } else {
+            long long v;
+            memcpy(&v, value, sizeof(v));
+            offset += sizeof(v);
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = strchr("diouxXc", conv) ? (conv == 'c' ? 'd' : conv) : 'd';
+            spec[spec_len] = '\0';
+            if(conv == 'c') {
+                n = snprintf(line + len, room, "%c", (int)v);
+            } else {
+                n = star_count == 2 ? snprintf(line + len, room, spec, stars[0], stars[1], v) :
+                    star_count == 1 ? snprintf(line + len, room, spec, stars[0], v) :
+                                      snprintf(line + len, room, spec, v);
+            }
+        }
+        len += n < room ? n : room - 1;
+    }
+    if(len > cap) {
+        len = cap;
+    }
+    line[len++] = '\n';
+    append(line, len);
+}
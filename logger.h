@@ -0,0 +1,174 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+#include "locker.h"
+
+// 日志级别
+enum LOG_LEVEL { LOG_LEVEL_DEBUG = 0, LOG_LEVEL_INFO, LOG_LEVEL_WARN, LOG_LEVEL_ERROR };
+
+// 不以\0结尾的字符串参数，如读缓冲区中的请求数据，按%s输出
+struct log_str {
+    const char *m_data;
+    int m_len;
+
+    log_str(const char *data, int len) : m_data(data), m_len(len) {}
+};
+
+// 定长二进制日志记录：调用处只保存格式串指针、时间和原始参数，由后台线程格式化
+struct log_record {
+    static const int SIZE = 256;
+    static const int MAX_ARGS = 12;
+    enum ARG_TYPE { ARG_INT, ARG_UINT, ARG_DOUBLE, ARG_STR, ARG_PTR };
+
+    uint64_t m_time_ns;                 // CLOCK_REALTIME
+    const char *m_fmt;                  // 必须是字符串常量
+    uint8_t m_level;
+    uint8_t m_argc;
+    uint8_t m_types[MAX_ARGS];
+    uint16_t m_payload_len;
+    char m_payload[SIZE - 8 - sizeof(const char *) - 2 - MAX_ARGS - 2];    // 参数值，字符串为长度+内容，超长截断
+
+    void put(long long v) { put_raw(ARG_INT, &v, sizeof(v)); }
+    void put(unsigned long long v) { put_raw(ARG_UINT, &v, sizeof(v)); }
+    void put(int v) { put((long long)v); }
+    void put(long v) { put((long long)v); }
+    void put(unsigned int v) { put((unsigned long long)v); }
+    void put(unsigned long v) { put((unsigned long long)v); }
+    void put(double v) { put_raw(ARG_DOUBLE, &v, sizeof(v)); }
+    void put(const char *s) { put_str(s ? s : "(null)", s ? (int)strlen(s) : 6); }
+    void put(char *s) { put((const char *)s); }
+    void put(const log_str &s) { put_str(s.m_data, s.m_len); }
+    void put(const void *p) { put_raw(ARG_PTR, &p, sizeof(p)); }
+
+private:
+    void put_raw(ARG_TYPE type, const void *v, int len) {
+        if(m_argc >= MAX_ARGS || m_payload_len + len > (int)sizeof(m_payload)) {
+            return;
+        }
+        m_types[m_argc++] = type;
+        memcpy(m_payload + m_payload_len, v, len);
+        m_payload_len += len;
+    }
+    void put_str(const char *s, int len) {
+        int room = (int)sizeof(m_payload) - m_payload_len - 2;
+        if(m_argc >= MAX_ARGS || room < 0) {
+            return;
+        }
+        uint16_t n = len < room ? len : room;
+        m_types[m_argc++] = ARG_STR;
+        memcpy(m_payload + m_payload_len, &n, 2);
+        memcpy(m_payload + m_payload_len + 2, s, n);
+        m_payload_len += 2 + n;
+    }
+};
+
+// 单生产者单消费者环：生产者是所属线程，消费者是后台写线程
+struct log_ring {
+    static const uint32_t CAPACITY = 1024;
+
+    alignas(64) std::atomic<uint32_t> m_head;       // 消费者读取位置
+    alignas(64) std::atomic<uint32_t> m_tail;       // 生产者写入位置
+    std::atomic<unsigned long long> m_drops;        // 环满时丢弃的记录数
+    std::atomic<bool> m_closed;                     // 所属线程已退出，取空后回收
+    int m_thread_index;
+    log_record m_records[CAPACITY];
+
+    log_ring(int thread_index) : m_head(0), m_tail(0), m_drops(0), m_closed(false),
+        m_thread_index(thread_index) {}
+};
+
+// 异步日志：每个线程把记录写入自己的无锁环，不加锁、不格式化、不做系统调用，
+// 环满时丢弃并计数而不阻塞；后台线程轮询所有环，格式化后成批写入日志文件
+class logger {
+public:
+    static logger *get_instance();
+
+    // path为"-"时写到标准输出
+    bool init(const char *path, int level);
+    void stop();                        // 写完剩余记录后停止后台线程
+
+    static bool enabled(int level) { return level >= s_level.load(std::memory_order_relaxed); }
+    static void set_level(int level) { s_level.store(level, std::memory_order_relaxed); }
+    unsigned long long drops() const;
+
+    template <typename... Args>
+    void write(int level, const char *fmt, const Args &... args) {
+        log_ring *ring = local_ring();
+        uint32_t tail = ring->m_tail.load(std::memory_order_relaxed);
+        if(tail - ring->m_head.load(std::memory_order_acquire) >= log_ring::CAPACITY) {
+            ring->m_drops.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        log_record &r = ring->m_records[tail & (log_ring::CAPACITY - 1)];
+        r.m_time_ns = now_ns();
+        r.m_fmt = fmt;
+        r.m_level = level;
+        r.m_argc = 0;
+        r.m_payload_len = 0;
+        int unused[] = { 0, (r.put(args), 0)... };
+        (void)unused;
+        ring->m_tail.store(tail + 1, std::memory_order_release);
+    }
+
+private:
+    logger();
+    ~logger();
+
+    static uint64_t now_ns();
+    static log_ring *local_ring();
+    log_ring *register_ring();
+    static void *worker(void *arg);
+    void run();
+    bool drain();                       // 取出所有环中的记录并写出，返回是否有记录
+    void format(const log_record &r, int thread_index);
+    void append(const char *data, int len);
+    void flush();
+
+    struct ring_holder {
+        log_ring *m_ring;
+        ring_holder() : m_ring(NULL) {}
+        ~ring_holder();
+    };
+
+private:
+    static std::atomic<int> s_level;
+
+    mutable locker m_lock;              // 保护m_rings，只在线程注册和后台线程轮询时使用
+    std::vector<log_ring *> m_rings;
+    int m_next_index;
+    unsigned long long m_dead_drops;    // 已回收的环上的丢弃数
+    unsigned long long m_reported_drops;
+
+    int m_fd;
+    pthread_t m_thread;
+    bool m_running;
+    std::atomic<bool> m_stop;
+    char m_buf[64 * 1024];              // 后台线程的输出缓冲
+    int m_buf_len;
+};
+
+// 日志宏：编译时加 -DLOG_DISABLED 时展开为空语句，参数不求值，没有任何开销；
+// 否则先按级别过滤，未启用的级别只有一次原子读
+#ifdef LOG_DISABLED
+#define LOG_WRITE(level, fmt, ...) do {} while(0)
+#else
+#define LOG_WRITE(level, fmt, ...) \
+    do { \
+        if(logger::enabled(level)) { \
+            logger::get_instance()->write(level, fmt, ##__VA_ARGS__); \
+        } \
+    } while(0)
+#endif
+
+#define LOG_DEBUG(fmt, ...) LOG_WRITE(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) LOG_WRITE(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...) LOG_WRITE(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...) LOG_WRITE(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+
+#endif // LOGGER_H
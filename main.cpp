@@ -9,122 +9,518 @@
 #include <fcntl.h>
 #include <sys/epoll.h>
 #include <signal.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/signalfd.h>
 
 #include "locker.h"
 #include "threadpool.h"
 #include "http_conn.h"
+#include "reactor.h"
+#include "uring_reactor.h"
+#include "coro_reactor.h"
+#include "file_cache.h"
+#include "compress_cache.h"
+#include "logger.h"
+#include "metrics.h"
+#include "buffer_pool.h"
+#include "admission.h"
+#include "router.h"
+#include "topology.h"
+#include "config.h"
+#include "handoff.h"
 
-#define MAX_FD 65535                // 最大的文件描述符个数
-#define MAX_EVENT_NUMER 10000      // 监听的最大事件数
 // 增加信号捕捉
 void add_sig(int sig, void(handle)(int)) {
     struct sigaction sa;
     memset(&sa, '\0', sizeof(sa));
+    sa.sa_handler = handle;
     sigfillset(&sa.sa_mask);
     sigaction(sig, &sa, NULL);
 }
 
-// 增加文件标识符到epoll中
-extern void addfd(int epollfd, int fd, bool one_shot);
-// 从epoll中删除文件描述符
-extern void removefd(int epollfd, int fd);
-// 修改文件描述符
-extern void modifyfd(int epollfd, int fd, int ev);
+// /__stats中的瞬时值
+struct reactor_list {
+    reactor **m_reactors;
+    int m_number;
+};
+static long long gauge_connections(void *ctx) {
+    reactor_list *list = (reactor_list *)ctx;
+    long long n = 0;
+    for(int i=0; i<list->m_number; ++i) {
+        if(list->m_reactors[i]) {
+            n += list->m_reactors[i]->user_count();
+        }
+    }
+    return n;
+}
+static long long gauge_queue_depth(void *ctx) {
+    return ((http_threadpool *)ctx)->queue_size();
+}
+static long long gauge_cache_bytes(void *) {
+    return file_cache::get_instance()->bytes();
+}
+static long long gauge_cache_hits(void *) {
+    return file_cache::get_instance()->hits();
+}
+static long long gauge_cache_misses(void *) {
+    return file_cache::get_instance()->misses();
+}
+static long long gauge_compress_bytes(void *) {
+    return compress_cache::get_instance()->bytes();
+}
+static long long gauge_buffer_slab_bytes(void *) {
+    return buffer_pool::get_instance()->slab_bytes();
+}
+static long long gauge_log_drops(void *) {
+    return logger::get_instance()->drops();
+}
+static long long gauge_overloaded(void *) {
+    return admission::get_instance()->overloaded();
+}
+static long long gauge_admission_rejects(void *) {
+    return admission::get_instance()->rejected();
+}
+#ifdef HAVE_IO_URING
+// io_uring反应堆的系统调用次数和提交的操作数
+static long long gauge_uring_enters(void *ctx) {
+    reactor_list *list = (reactor_list *)ctx;
+    long long n = 0;
+    for(int i=0; i<list->m_number; ++i) {
+        if(list->m_reactors[i]) {
+            n += ((uring_reactor *)list->m_reactors[i])->enters();
+        }
+    }
+    return n;
+}
+static long long gauge_uring_sqes(void *ctx) {
+    reactor_list *list = (reactor_list *)ctx;
+    long long n = 0;
+    for(int i=0; i<list->m_number; ++i) {
+        if(list->m_reactors[i]) {
+            n += ((uring_reactor *)list->m_reactors[i])->submitted();
+        }
+    }
+    return n;
+}
+#endif
+
+// 内置指标：/__stats输出文本，/__stats?format=json输出JSON，各线程的计数在此时汇总
+static const size_t STATS_BUFFER_SIZE = 16 * 1024;
+static void stats_handler(const http_request &req, http_response &resp, void *) {
+    size_t avail;
+    char *buf = resp.reserve(STATS_BUFFER_SIZE, &avail);
+    if(!buf) {
+        return;
+    }
+    metrics *m = metrics::get_instance();
+    if(req.m_query && strstr(req.m_query, "format=json")) {
+        resp.commit(m->render_json(buf, avail));
+        resp.set_content_type("application/json");
+    } else {
+        resp.commit(m->render_text(buf, avail));
+    }
+}
+
+// 启动时打印拓扑和各线程的位置
+static void print_layout(const std::vector<int> &io_cpus, const std::vector<int> &worker_cpus) {
+    cpu_topology *topo = cpu_topology::get_instance();
+    printf("topology: %d cpus, %d numa nodes\n", topo->cpu_count(), topo->node_count());
+    for(size_t i=0; i<topo->nodes().size(); ++i) {
+        int node = topo->nodes()[i];
+        std::vector<int> cpus = topo->cpus_of(node);
+        std::sort(cpus.begin(), cpus.end());
+        printf("  node %d: cpus %s\n", node, cpu_topology::format_cpu_list(cpus).c_str());
+    }
+    for(size_t i=0; i<io_cpus.size(); ++i) {
+        printf("reactor %d -> cpu %d (node %d)\n", (int)i, io_cpus[i], topo->node_of(io_cpus[i]));
+    }
+    // 工作线程按节点汇总，每个节点一个请求队列
+    for(size_t i=0; i<topo->nodes().size(); ++i) {
+        int node = topo->nodes()[i];
+        std::vector<int> cpus;
+        int n = 0;
+        for(size_t j=0; j<worker_cpus.size(); ++j) {
+            if(topo->node_of(worker_cpus[j]) == node) {
+                cpus.push_back(worker_cpus[j]);
+                ++n;
+            }
+        }
+        if(n > 0) {
+            std::sort(cpus.begin(), cpus.end());
+            cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+            printf("%d workers -> node %d, cpus %s\n", n, node, cpu_topology::format_cpu_list(cpus).c_str());
+        }
+    }
+}
+
+// 网站根目录和上传目录，定义在http_conn.cpp中
+extern std::atomic<const char *> doc_root;
+extern std::atomic<const char *> upload_root;
+
+static const char *OPTIONS = "f:H:o:r:m:z:l:vd:u:i:b:sa:PC:W:I";
+
+static void usage(const char *prog) {
+    printf("按照以下格式运行：%s [-f config_file] [-o key=value] [-r reactor_number] [-m cache_mb] [-z compress_mb] [-l log_file] [-v] [-d doc_root] [-u upload_dir] [-i epoll|uring|coro] [-b backlog] [-s] [-a admission_target_ms] [-P] [-C io_cpus|auto] [-W worker_cpus|auto] [-I] [-H handoff_socket] [port_number]\n", basename(prog));
+}
+
+// 按默认值、-f指定的配置文件、其余命令行参数的顺序生成配置，启动和收到SIGHUP时都调用
+static bool build_config(int argc, char *argv[], server_config &cfg, std::string &err) {
+    cfg = server_config();
+    int opt;
+    optind = 1;
+    opterr = 0;
+    while((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        if(opt == 'f' && !cfg.load(optarg, err)) {
+            return false;
+        }
+    }
+    optind = 1;
+    while((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        bool ok = true;
+        switch(opt) {
+            case 'f':
+                break;
+            case 'o': {
+                const char *eq = strchr(optarg, '=');
+                ok = eq && cfg.set(std::string(optarg, eq - optarg), eq + 1);
+                break;
+            }
+            case 'H': ok = cfg.set("handoff", optarg); break;
+            case 'r': ok = cfg.set("reactors", optarg); break;
+            case 'm': ok = cfg.set("cache_mb", optarg); break;
+            case 'z': ok = cfg.set("compress_mb", optarg); break;
+            case 'l': ok = cfg.set("log_file", optarg); break;
+            case 'v': ok = cfg.set("verbose", "on"); break;
+            case 'd': ok = cfg.set("doc_root", optarg); break;
+            case 'u': ok = cfg.set("upload_dir", optarg); break;
+            case 'i': ok = cfg.set("backend", optarg); break;
+            case 'b': ok = cfg.set("backlog", optarg); break;
+            case 's': ok = cfg.set("shared_listener", "on"); break;
+            case 'a': ok = cfg.set("admission_target_ms", optarg); break;
+            case 'P': ok = cfg.set("inline", "off"); break;
+            case 'C': ok = cfg.set("io_cpus", optarg); break;
+            case 'W': ok = cfg.set("worker_cpus", optarg); break;
+            case 'I': ok = cfg.set("steer_incoming", "on"); break;
+            default: ok = false; break;
+        }
+        if(!ok) {
+            err = std::string("bad option -") + (char)(opt == '?' ? optopt : opt);
+            return false;
+        }
+    }
+    if(optind < argc && !cfg.set("port", argv[optind])) {
+        err = std::string("bad port ") + argv[optind];
+        return false;
+    }
+    return cfg.valid(err);
+}
+
+// 把目录转换为绝对路径。返回的字符串不释放，重新加载后可能仍有请求在使用旧的
+static const char *resolve_dir(const std::string &dir) {
+    char path[PATH_MAX];
+    if(!realpath(dir.c_str(), path)) {
+        printf("%s: %s\n", dir.c_str(), strerror(errno));
+        return NULL;
+    }
+    return strdup(path);
+}
+
+// 应用可以在运行中修改的配置项，目录无效时不做任何修改
+static bool apply_runtime_config(const server_config &cfg) {
+    const char *root = resolve_dir(cfg.m_doc_root);
+    const char *upload = NULL;
+    if(!root || (!cfg.m_upload_dir.empty() && !(upload = resolve_dir(cfg.m_upload_dir)))) {
+        return false;
+    }
+    doc_root.store(root, std::memory_order_release);
+    upload_root.store(upload, std::memory_order_release);
+    logger::set_level(cfg.m_verbose ? LOG_LEVEL_DEBUG : LOG_LEVEL_INFO);
+    admission::get_instance()->set_target(cfg.m_admission_target);
+    return true;
+}
 
 int main(int argc, char* argv[]) {
-    if(argc <= 1) {
-        printf("按照以下格式运行：%s port_number\n", basename(argv[0]));
+    server_config cfg;
+    std::string err;
+    if(!build_config(argc, argv, cfg, err)) {
+        printf("%s\n", err.c_str());
+        usage(argv[0]);
+        exit(-1);
+    }
+    if(!apply_runtime_config(cfg)) {
+        exit(-1);
+    }
+    bool use_uring = cfg.m_backend == "uring";
+    bool use_coro = cfg.m_backend == "coro";
+#ifdef HAVE_IO_URING
+    if(use_uring && !uring_reactor::supported()) {
+        printf("io_uring not supported by this kernel, falling back to epoll\n");
+        use_uring = false;
+    }
+#else
+    if(use_uring) {
+        printf("built without io_uring, falling back to epoll\n");
+        use_uring = false;
+    }
+#endif
+#ifndef HAVE_COROUTINES
+    if(use_coro) {
+        printf("built without coroutines (compile with -std=c++20), falling back to epoll\n");
+        use_coro = false;
+    }
+#endif
+    int port = cfg.m_port;
+    int reactor_number = cfg.m_reactors;
+    bool shared_listener = cfg.m_shared_listener;
+
+    // 有旧进程时接管它的监听socket，端口不同时不接管
+    handoff::listeners inherited;
+    int handoff_conn = -1;
+    if(!cfg.m_handoff.empty()) {
+        handoff_conn = handoff::take_over(cfg.m_handoff.c_str(), inherited);
+        if(handoff_conn >= 0 && inherited.m_port != port) {
+            printf("handoff: old process listens on port %d, not taking over\n", inherited.m_port);
+            for(size_t i=0; i<inherited.m_fds.size(); ++i) {
+                close(inherited.m_fds[i]);
+            }
+            inherited.m_fds.clear();
+            close(handoff_conn);
+            handoff_conn = -1;
+        }
+    }
+    if(handoff_conn >= 0) {
+        // 监听方式沿用旧进程的，SO_REUSEPORT组中的每个socket都要有反应堆接收
+        shared_listener = inherited.m_shared;
+        if(!shared_listener && reactor_number < (int)inherited.m_fds.size()) {
+            printf("handoff: %d listening sockets inherited, using %d reactors\n",
+                   (int)inherited.m_fds.size(), (int)inherited.m_fds.size());
+            reactor_number = inherited.m_fds.size();
+        }
+        printf("handoff: took over %d listening socket(s) on port %d\n", (int)inherited.m_fds.size(), port);
+    }
+
+    // 按CPU拓扑为反应堆和工作线程选择CPU，自动分配时工作线程尽量避开反应堆占用的CPU
+    cpu_topology *topo = cpu_topology::get_instance();
+    topo->init();
+    std::vector<int> io_cpus;
+    std::vector<int> worker_cpus;
+    if((!cfg.m_io_cpus.empty() && !topo->plan(cfg.m_io_cpus.c_str(), reactor_number, std::vector<int>(), io_cpus)) ||
+       (!cfg.m_worker_cpus.empty() && !topo->plan(cfg.m_worker_cpus.c_str(), cfg.m_workers, io_cpus, worker_cpus))) {
+        printf("bad cpu list, online cpus: %s\n", cpu_topology::format_cpu_list(topo->cpus()).c_str());
+        exit(-1);
+    }
+    if(cfg.m_steer_incoming && (io_cpus.empty() || shared_listener)) {
+        printf("-I needs -C and a listening socket per reactor (without -s)\n");
         exit(-1);
     }
-    // 获取端口号
-    int port = atoi(argv[1]);
     
     // 对SIGPIE信号进行处理
     add_sig(SIGPIPE, SIG_IGN);
 
+    // 以下信号由主线程通过signalfd同步处理，先屏蔽再创建其他线程，使所有线程继承该屏蔽字
+    sigset_t sigset;
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGUSR1);    // 打印线程池调度统计
+    sigaddset(&sigset, SIGHUP);     // 重新加载配置
+    sigaddset(&sigset, SIGINT);
+    sigaddset(&sigset, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+    int sigfd = signalfd(-1, &sigset, SFD_CLOEXEC);
+    if(sigfd < 0) {
+        printf("signalfd failure: %s\n", strerror(errno));
+        exit(-1);
+    }
+
+    // 异步日志，后台线程负责格式化和写文件
+    if(!logger::get_instance()->init(cfg.m_log_file.c_str(), cfg.m_verbose ? LOG_LEVEL_DEBUG : LOG_LEVEL_INFO)) {
+        printf("open log file %s failure: %s\n", cfg.m_log_file.c_str(), strerror(errno));
+        exit(-1);
+    }
+
+    // 静态文件缓存，单个文件最大1MB
+    file_cache::get_instance()->init((size_t)cfg.m_cache_mb << 20, 1 << 20);
+    // 压缩版本缓存，后台线程负责读取预压缩文件和gzip压缩，单个文件最大8MB
+    if(!compress_cache::get_instance()->init((size_t)cfg.m_compress_mb << 20, 8 << 20)) {
+        printf("compress cache start failure\n");
+        exit(-1);
+    }
+
+    // 排队时间连续100ms超过目标值时进入过载状态
+    admission::get_instance()->init(cfg.m_admission_target, 100);
+
     // 创建线程池，初始化线程池
     // 任务、信息都放在http_conn中，分开更好
-    threadpool<http_conn> *pool = NULL;
+    http_threadpool *pool = NULL;
     try {
-        pool = new threadpool<http_conn>();  
+        pool = new http_threadpool(cfg.m_workers, cfg.m_queue_size, worker_cpus);
     } catch(...) {
         exit(-1);
     }
 
-    // 创建一个数组用于保存所有的客户端信息
-    http_conn *users = new http_conn[MAX_FD];
-    
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    // 创建连接表保存所有的客户端信息，按fd索引，各反应堆只使用自己接收的连接对应的槽位
+    conn_table *users = new conn_table(cfg.m_max_fd);
+
+    reactor_options options;
+    options.m_header_timeout = cfg.m_header_timeout;
+    options.m_idle_timeout = cfg.m_idle_timeout;
+    options.m_write_timeout = cfg.m_write_timeout;
+    options.m_backlog = cfg.m_backlog;
+    options.m_inline = cfg.m_inline;
+    if(shared_listener && handoff_conn >= 0) {
+        options.m_shared_listenfd = inherited.m_fds[0];
+        listen(options.m_shared_listenfd, cfg.m_backlog);
+    } else if(shared_listener) {
+        options.m_shared_listenfd = reactor::create_listener(port, cfg.m_backlog, false);
+        if(options.m_shared_listenfd < 0) {
+            printf("listen on port %d failure: %s\n", port, strerror(errno));
+            exit(-1);
+        }
+    }
 
-    // 设置端口复用 - 绑定前
-    int reuse = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    // 创建反应堆，每个反应堆拥有自己的（或共用的）监听socket、epoll对象（或io_uring队列）和事件循环线程
+    reactor **reactors = new reactor*[reactor_number]();
 
-    // 绑定
-    struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(port);
-    bind(listenfd, (struct sockaddr*)&address, sizeof(address));
+    // 注册/__stats中的瞬时值
+    reactor_list list = { reactors, reactor_number };
+    metrics *m = metrics::get_instance();
+    m->add_gauge("connections", gauge_connections, &list);
+    m->add_gauge("queue_depth", gauge_queue_depth, pool);
+    m->add_gauge("cache_bytes", gauge_cache_bytes, NULL);
+    m->add_gauge("cache_hits", gauge_cache_hits, NULL);
+    m->add_gauge("cache_misses", gauge_cache_misses, NULL);
+    m->add_gauge("compress_bytes", gauge_compress_bytes, NULL);
+    m->add_gauge("buffer_slab_bytes", gauge_buffer_slab_bytes, NULL);
+    m->add_gauge("log_drops", gauge_log_drops, NULL);
+    m->add_gauge("overloaded", gauge_overloaded, NULL);
+    m->add_gauge("admission_rejects", gauge_admission_rejects, NULL);
+#ifdef HAVE_IO_URING
+    if(use_uring) {
+        m->add_gauge("uring_enters", gauge_uring_enters, &list);
+        m->add_gauge("uring_sqes", gauge_uring_sqes, &list);
+    }
+#endif
 
-    // 监听
-    listen(listenfd, 5);
+    // 内置路由，注册完后编译为只读的前缀树，其余请求按静态文件处理
+    router *routes = router::get_instance();
+    routes->add(http_conn::GET, "/__stats", stats_handler, NULL, router::ROUTE_INLINE);
+    routes->compile();
 
-    // 创建epoll对象，事件数组，添加
-    epoll_event events[MAX_EVENT_NUMER];
-    int epollfd = epoll_create(5);
+    int max_users = cfg.m_max_fd / reactor_number;
+    for(int i=0; i<reactor_number; ++i) {
+        options.m_cpu = io_cpus.empty() ? -1 : io_cpus[i];
+        // 旧进程的SO_REUSEPORT socket按原来的顺序分给前几个反应堆
+        options.m_inherited_listenfd = !shared_listener && i < (int)inherited.m_fds.size() ? inherited.m_fds[i] : -1;
+#ifdef HAVE_IO_URING
+        if(use_uring) {
+            reactors[i] = new uring_reactor(i, port, users, max_users, pool, options);
+        } else
+#endif
+#ifdef HAVE_COROUTINES
+        if(use_coro) {
+            reactors[i] = new coro_reactor(i, port, users, max_users, pool, options);
+        } else
+#endif
+        reactors[i] = new reactor(i, port, users, max_users, pool, options);
+        if(!reactors[i]->start()) {
+            printf("reactor %d start failure\n", i);
+            exit(-1);
+        }
+    }
+    // 监听socket按反应堆的启动顺序加入端口的SO_REUSEPORT组
+    if(cfg.m_steer_incoming) {
+        std::vector<int> listenfds;
+        for(int i=0; i<reactor_number; ++i) {
+            listenfds.push_back(reactors[i]->listen_fd());
+        }
+        if(!reactor::steer_by_cpu(listenfds, io_cpus)) {
+            printf("steer connections by cpu failure: %s\n", strerror(errno));
+        }
+    }
+    if(!io_cpus.empty() || !worker_cpus.empty()) {
+        print_layout(io_cpus, worker_cpus);
+    }
 
-    // 将监听的文件描述符添加到epoll对象中，后续也需要添加别的描述符
-    addfd(epollfd, listenfd, false);
-    http_conn::m_epollfd = epollfd;
+    // 反应堆都已开始接收，通知旧进程停止接收，之后由本进程等待下一次升级
+    if(handoff_conn >= 0 && !handoff::finish(handoff_conn)) {
+        printf("handoff: old process did not confirm\n");
+    }
+    handoff::listeners own;
+    own.m_shared = shared_listener;
+    own.m_port = port;
+    if(shared_listener) {
+        own.m_fds.push_back(options.m_shared_listenfd);
+    } else {
+        for(int i=0; i<reactor_number; ++i) {
+            own.m_fds.push_back(reactors[i]->listen_fd());
+        }
+    }
+    int handoff_fd = -1;
+    if(!cfg.m_handoff.empty()) {
+        handoff_fd = handoff::listen(cfg.m_handoff.c_str());
+        if(handoff_fd < 0) {
+            printf("handoff socket %s: %s\n", cfg.m_handoff.c_str(), strerror(errno));
+        }
+    }
 
-    // 主线程不断循环检测事件
+    // 主线程处理信号和升级请求，收到SIGINT/SIGTERM时退出；监听socket移交后等已有连接结束再退出
+    bool draining = false;
+    unsigned long long drain_deadline = 0;
     while(true) {
-        int num = epoll_wait(epollfd, events, MAX_EVENT_NUMER, -1);  
-        if(num < 0 && errno != EINTR) {
-            printf("epoll failure\n");
+        struct pollfd fds[2] = { { sigfd, POLLIN, 0 }, { handoff_fd, POLLIN, 0 } };
+        int ret = poll(fds, handoff_fd >= 0 ? 2 : 1, draining ? 100 : -1);
+        if(ret < 0 && errno != EINTR) {
             break;
         }
-
-        // 循环遍历事件数组
-        for(int i=0; i<num; ++i) {
-            int sockfd = events[i].data.fd;
-            if(sockfd == listenfd) {
-                // 有客户端连接进来
-                struct sockaddr_in client_address;
-                socklen_t client_addrlen = sizeof(client_address);
-                int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlen);
-                
-                if(http_conn::m_user_count >= MAX_FD) {
-                    // 目前连接数已满，给客户端响应信息（响应报文，如：服务器内部正忙）
-                    close(connfd);
-                    continue;
-                }
-
-                // 将新客户数据初始化后放入数组
-                users[connfd].init(connfd, client_address);
-            } else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                // 对方异常断开或错误等事件
-                users[sockfd].close_conn();
-            } else if(events[i].events & EPOLLIN) {
-                if(users[sockfd].read()) {
-                    // 一次性读完所有数据
-                    pool->append(users + sockfd);
-                }else {
-                    users[sockfd].close_conn();
-                }
-            } else if(events[i].events & EPOLLOUT) {
-                // 一次性写完所有数据
-                if(!users[sockfd].write()) {
-                    users[sockfd].close_conn();
+        if(draining) {
+            long long active = gauge_connections(&list);
+            if(active == 0 || metrics::now_ns() >= drain_deadline) {
+                printf("handoff: exiting with %lld connection(s) open\n", active);
+                break;
+            }
+        }
+        if(ret > 0 && handoff_fd >= 0 && (fds[1].revents & POLLIN)) {
+            int conn = handoff::serve(handoff_fd, own, 10000);
+            if(conn >= 0) {
+                http_conn::set_draining();
+                for(int i=0; i<reactor_number; ++i) {
+                    reactors[i]->stop_accepting();
                 }
+                handoff::confirm(conn);
+                close(handoff_fd);
+                handoff_fd = -1;
+                draining = true;
+                drain_deadline = metrics::now_ns() + (unsigned long long)cfg.m_drain_timeout * 1000000000ull;
+                printf("handoff: listening sockets passed on, draining %lld connection(s)\n",
+                       gauge_connections(&list));
             }
         }
+        if(ret <= 0 || !(fds[0].revents & POLLIN)) {
+            continue;
+        }
+        struct signalfd_siginfo info;
+        if(read(sigfd, &info, sizeof(info)) != sizeof(info)) {
+            continue;
+        }
+        if(info.ssi_signo == SIGUSR1) {
+            queue_stats st = pool->stats();
+            printf("threadpool: queued=%d steals=%llu steal_failures=%llu parks=%llu\n",
+                   pool->queue_size(), st.m_steals, st.m_steal_failures, st.m_parks);
+            printf("logger: dropped=%llu\n", logger::get_instance()->drops());
+        } else if(info.ssi_signo == SIGHUP) {
+            server_config next;
+            if(!build_config(argc, argv, next, err)) {
+                printf("reload: %s, keeping the current config\n", err.c_str());
+            } else if(apply_runtime_config(next)) {
+                std::string names = cfg.restart_needed(next);
+                printf("reload: done%s%s\n", names.empty() ? "" : ", needs an upgrade to change: ", names.c_str());
+            }
+        } else {
+            break;
+        }
+        fflush(stdout);
     }
-
-    close(epollfd);
-    close(listenfd);
-    delete[] users;
-    delete pool;
+    fflush(stdout);
+    logger::get_instance()->stop();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "metrics.h"
+
+static const char *stage_names[STAGE_NUMBER] = {
+    "event_loop", "read", "queue_wait", "parse", "do_request", "write", "response"
+};
+
+latency_histogram::latency_histogram() : m_sum(0), m_max(0) {
+    for(int i=0; i<BUCKETS; ++i) {
+        m_counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+metrics_shard::metrics_shard() : m_bytes_sent(0) {
+    for(int i=0; i<=MAX_STATUS - MIN_STATUS; ++i) {
+        m_status[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+metrics *metrics::get_instance() {
+    // 不析构：线程退出时仍可能写入
+    static metrics *instance = new metrics();
+    return instance;
+}
+
+metrics_shard *metrics::register_shard() {
+    metrics_shard *shard = new metrics_shard();
+    m_lock.lock();
+    m_shards.push_back(shard);
+    m_lock.unlock();
+    return shard;
+}
+
+void metrics::add_gauge(const char *name, gauge_func fn, void *ctx) {
+    gauge g = { name, fn, ctx };
+    m_lock.lock();
+    m_gauges.push_back(g);
+    m_lock.unlock();
+}
+
+// 各分片汇总后的结果
+struct metrics::snapshot {
+    struct stage {
+        uint64_t m_count;
+        uint64_t m_sum;
+        uint64_t m_max;
+        uint64_t m_counts[latency_histogram::BUCKETS];
+
+        // 第q分位数所在档位的上界，不超过最大值
+        uint64_t percentile(double q) const {
+            if(m_count == 0) {
+                return 0;
+            }
+            uint64_t rank = (uint64_t)(q * m_count);
+            if(rank >= m_count) {
+                rank = m_count - 1;
+            }
+            uint64_t seen = 0;
+            for(int i=0; i<latency_histogram::BUCKETS; ++i) {
+                seen += m_counts[i];
+                if(seen > rank) {
+                    uint64_t v = latency_histogram::upper(i);
+                    return v < m_max ? v : m_max;
+                }
+            }
+            return m_max;
+        }
+    };
+
+    stage m_stages[STAGE_NUMBER];
+    uint64_t m_bytes_sent;
+    uint64_t m_requests;
+    uint64_t m_status[metrics_shard::MAX_STATUS - metrics_shard::MIN_STATUS + 1];
+    std::vector<gauge> m_gauges;
+};
+
+void metrics::collect(snapshot &s) {
+    memset(s.m_stages, 0, sizeof(s.m_stages));
+    memset(s.m_status, 0, sizeof(s.m_status));
+    s.m_bytes_sent = 0;
+    s.m_requests = 0;
+
+    m_lock.lock();
+    std::vector<metrics_shard *> shards = m_shards;
+    s.m_gauges = m_gauges;
+    m_lock.unlock();
+
+    for(size_t i=0; i<shards.size(); ++i) {
+        metrics_shard *shard = shards[i];
+        for(int st=0; st<STAGE_NUMBER; ++st) {
+            latency_histogram &h = shard->m_stages[st];
+            snapshot::stage &out = s.m_stages[st];
+            for(int b=0; b<latency_histogram::BUCKETS; ++b) {
+                uint64_t n = h.m_counts[b].load(std::memory_order_relaxed);
+                out.m_counts[b] += n;
+                out.m_count += n;
+            }
+            out.m_sum += h.m_sum.load(std::memory_order_relaxed);
+            uint64_t max = h.m_max.load(std::memory_order_relaxed);
+            if(max > out.m_max) {
+                out.m_max = max;
+            }
+        }
+        s.m_bytes_sent += shard->m_bytes_sent.load(std::memory_order_relaxed);
+        for(int c=0; c<=metrics_shard::MAX_STATUS - metrics_shard::MIN_STATUS; ++c) {
+            uint64_t n = shard->m_status[c].load(std::memory_order_relaxed);
+            s.m_status[c] += n;
+            s.m_requests += n;
+        }
+    }
+}
+
+// 依次追加格式化文本，buf写满后不再追加
+#define APPEND(...) \
+    do { \
+        if(len < size) { \
+            int n = snprintf(buf + len, size - len, __VA_ARGS__); \
+            len += n < size - len ? n : size - len - 1; \
+        } \
+    } while(0)
+
+int metrics::render_text(char *buf, int size) {
+    snapshot *s = new snapshot;
+    collect(*s);
+    int len = 0;
+    buf[0] = '\0';
+
+    for(size_t i=0; i<s->m_gauges.size(); ++i) {
+        APPEND("%s %lld\n", s->m_gauges[i].m_name, s->m_gauges[i].m_fn(s->m_gauges[i].m_ctx));
+    }
+    APPEND("requests %llu\n", (unsigned long long)s->m_requests);
+    APPEND("bytes_sent %llu\n", (unsigned long long)s->m_bytes_sent);
+    for(int c=0; c<=metrics_shard::MAX_STATUS - metrics_shard::MIN_STATUS; ++c) {
+        if(s->m_status[c]) {
+            APPEND("status_%d %llu\n", c + metrics_shard::MIN_STATUS, (unsigned long long)s->m_status[c]);
+        }
+    }
+
+    APPEND("\n%-12s %10s %10s %10s %10s %10s %10s %10s\n", "stage(us)", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for(int st=0; st<STAGE_NUMBER; ++st) {
+        const snapshot::stage &h = s->m_stages[st];
+        APPEND("%-12s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", stage_names[st],
+               (unsigned long long)h.m_count, h.m_count ? h.m_sum / 1000.0 / h.m_count : 0.0,
+               h.percentile(0.5) / 1000.0, h.percentile(0.9) / 1000.0, h.percentile(0.99) / 1000.0,
+               h.percentile(0.999) / 1000.0, h.m_max / 1000.0);
+    }
+    delete s;
+    return len;
+}
+
+int metrics::render_json(char *buf, int size) {
+    snapshot *s = new snapshot;
+    collect(*s);
+    int len = 0;
+    buf[0] = '\0';
+
+    APPEND("{\"gauges\":{");
+    for(size_t i=0; i<s->m_gauges.size(); ++i) {
+        APPEND("%s\"%s\":%lld", i ? "," : "", s->m_gauges[i].m_name, s->m_gauges[i].m_fn(s->m_gauges[i].m_ctx));
+    }
+    APPEND("},\"requests\":%llu,\"bytes_sent\":%llu,\"status\":{",
+           (unsigned long long)s->m_requests, (unsigned long long)s->m_bytes_sent);
+    bool first = true;
+    for(int c=0; c<=metrics_shard::MAX_STATUS - metrics_shard::MIN_STATUS; ++c) {
+        if(s->m_status[c]) {
+            APPEND("%s\"%d\":%llu", first ? "" : ",", c + metrics_shard::MIN_STATUS, (unsigned long long)s->m_status[c]);
+            first = false;
+        }
+    }
+    APPEND("},\"stages_us\":{");
+    for(int st=0; st<STAGE_NUMBER; ++st) {
+        const snapshot::stage &h = s->m_stages[st];
+        APPEND("%s\"%s\":{\"count\":%llu,\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}",
+               st ? "," : "", stage_names[st], (unsigned long long)h.m_count,
+               h.m_count ? h.m_sum / 1000.0 / h.m_count : 0.0,
+               h.percentile(0.5) / 1000.0, h.percentile(0.9) / 1000.0, h.percentile(0.99) / 1000.0,
+               h.percentile(0.999) / 1000.0, h.m_max / 1000.0);
+    }
+    APPEND("}}\n");
+    delete s;
+    return len;
+}
@@ -0,0 +1,110 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <vector>
+
+#include "locker.h"
+#include "histogram.h"
+
+// 请求处理的各个阶段
+enum METRIC_STAGE {
+    STAGE_EVENT_LOOP = 0,   // 反应堆处理一批epoll事件
+    STAGE_READ,             // http_conn::read
+    STAGE_QUEUE_WAIT,       // 连接在线程池队列中等待
+    STAGE_PARSE,            // process_read中除do_request以外的部分
+    STAGE_DO_REQUEST,       // do_request
+    STAGE_WRITE,            // 一次http_conn::write调用
+    STAGE_RESPONSE,         // 从交给线程池到整批响应发送完
+    STAGE_NUMBER
+};
+
+// 阶段耗时直方图，档位划分见log_linear，单位纳秒。
+// 只由所属线程写入，计数用relaxed原子变量，汇总时可以并发读取
+struct latency_histogram : log_linear {
+    std::atomic<uint64_t> m_counts[BUCKETS];
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_max;
+
+    latency_histogram();
+    void add(uint64_t v) {
+        bump(m_counts[index(v)], 1);
+        bump(m_sum, v);
+        if(v > m_max.load(std::memory_order_relaxed)) {
+            m_max.store(v, std::memory_order_relaxed);
+        }
+    }
+
+    // 只有一个写者，不需要原子加法
+    static void bump(std::atomic<uint64_t> &c, uint64_t n) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+// 每个线程一份的计数器
+struct metrics_shard {
+    static const int MIN_STATUS = 100;
+    static const int MAX_STATUS = 599;
+
+    latency_histogram m_stages[STAGE_NUMBER];
+    std::atomic<uint64_t> m_bytes_sent;
+    std::atomic<uint64_t> m_status[MAX_STATUS - MIN_STATUS + 1];
+
+    metrics_shard();
+};
+
+// 内置指标：热路径只写本线程的分片，没有锁也没有共享缓存行；
+// 查询/__stats时才遍历所有分片汇总，队列长度、连接数等瞬时值由注册的回调读取
+class metrics {
+public:
+    typedef long long (*gauge_func)(void *ctx);
+
+    static metrics *get_instance();
+
+    static uint64_t now_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+    static void record(int stage, uint64_t ns) { local().m_stages[stage].add(ns); }
+    static void add_bytes_sent(uint64_t n) { latency_histogram::bump(local().m_bytes_sent, n); }
+    static void count_status(int status) {
+        if(status >= metrics_shard::MIN_STATUS && status <= metrics_shard::MAX_STATUS) {
+            latency_histogram::bump(local().m_status[status - metrics_shard::MIN_STATUS], 1);
+        }
+    }
+
+    // 注册瞬时值，name必须是字符串常量，应在服务启动前注册
+    void add_gauge(const char *name, gauge_func fn, void *ctx);
+
+    // 汇总后以文本或JSON写入buf，返回长度，buf不够时截断
+    int render_text(char *buf, int size);
+    int render_json(char *buf, int size);
+
+private:
+    metrics() {}
+
+    static metrics_shard &local() {
+        static thread_local metrics_shard *shard = get_instance()->register_shard();
+        return *shard;
+    }
+    metrics_shard *register_shard();
+
+    struct snapshot;
+    void collect(snapshot &s);
+
+    struct gauge {
+        const char *m_name;
+        gauge_func m_fn;
+        void *m_ctx;
+    };
+
+private:
+    locker m_lock;
+    std::vector<metrics_shard *> m_shards;      // 线程退出后分片保留，计数不丢失
+    std::vector<gauge> m_gauges;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,143 @@
+#ifndef MPMC_RING_H
+#define MPMC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <new>
+
+#define CACHELINE_SIZE 64           // 缓存行大小，用于避免伪共享
+
+// 忙等循环中让出流水线，降低自旋对同核超线程的影响
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// 有界多生产者多消费者无锁环形队列（Vyukov算法）
+// 每个槽位带一个序号：序号等于入队位置时可写，等于入队位置+1时可读，
+// 生产者和消费者只在各自的位置计数器上CAS，互不争用同一缓存行
+template<typename T>
+class mpmc_ring {
+public:
+    // 槽位数向上取整为2的幂，以便用掩码代替取模；入队时仍以capacity为上限
+    explicit mpmc_ring(size_t capacity);
+    ~mpmc_ring();
+
+    bool try_push(const T &data);   // 队列中已有capacity个元素时返回false
+    bool try_pop(T &data);          // 队列空时返回false
+    size_t capacity() const { return m_capacity; }
+    size_t size() const;            // 近似的元素个数，仅用于统计
+
+private:
+    mpmc_ring(const mpmc_ring &);
+    mpmc_ring &operator=(const mpmc_ring &);
+
+    // 每个槽位独占一个缓存行，相邻槽位上的生产者和消费者不会互相干扰
+    struct alignas(CACHELINE_SIZE) cell {
+        std::atomic<size_t> m_sequence;
+        T m_data;
+    };
+
+    cell *m_buffer;
+    size_t m_mask;
+    size_t m_capacity;              // 设定的容量，不超过槽位数
+    alignas(CACHELINE_SIZE) std::atomic<size_t> m_enqueue_pos;     // 下一个入队位置
+    alignas(CACHELINE_SIZE) std::atomic<size_t> m_dequeue_pos;     // 下一个出队位置
+};
+
+template<typename T>
+mpmc_ring<T>::mpmc_ring(size_t capacity) : m_buffer(NULL), m_mask(0), m_capacity(capacity), m_enqueue_pos(0),
+    m_dequeue_pos(0) {
+    if(capacity == 0) {
+        throw std::exception();
+    }
+    // 至少两个槽位：只有一个槽位时，可读序号pos+1与下一个入队位置相同
+    size_t size = 2;
+    while(size < capacity) {
+        size <<= 1;
+    }
+    m_buffer = new (std::nothrow) cell[size];
+    if(!m_buffer) {
+        throw std::exception();
+    }
+    m_mask = size - 1;
+    for(size_t i=0; i<size; ++i) {
+        m_buffer[i].m_sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<typename T>
+mpmc_ring<T>::~mpmc_ring() {
+    delete[] m_buffer;
+}
+
+template<typename T>
+bool mpmc_ring<T>::try_push(const T &data) {
+    cell *c;
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    while(true) {
+        c = &m_buffer[pos & m_mask];
+        size_t seq = c->m_sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if(diff == 0) {
+            // 槽位数多于设定的容量时，另按出队位置判断是否已满；pos可能已过时，
+            // 差值为负时交给下面的CAS失败重试
+            if(m_capacity <= m_mask &&
+               (intptr_t)(pos - m_dequeue_pos.load(std::memory_order_acquire)) >= (intptr_t)m_capacity) {
+                return false;
+            }
+            // 槽位空闲，抢占该入队位置
+            if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if(diff < 0) {
+            // 槽位仍有上一轮未被取走的数据，队列已满
+            return false;
+        } else {
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    c->m_data = data;
+    c->m_sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template<typename T>
+bool mpmc_ring<T>::try_pop(T &data) {
+    cell *c;
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    while(true) {
+        c = &m_buffer[pos & m_mask];
+        size_t seq = c->m_sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if(diff == 0) {
+            // 槽位已写入数据，抢占该出队位置
+            if(m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if(diff < 0) {
+            // 队列为空
+            return false;
+        } else {
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    data = c->m_data;
+    // 序号推进一整圈，留给下一轮的生产者
+    c->m_sequence.store(pos + m_mask + 1, std::memory_order_release);
+    return true;
+}
+
+template<typename T>
+size_t mpmc_ring<T>::size() const {
+    size_t tail = m_enqueue_pos.load(std::memory_order_relaxed);
+    size_t head = m_dequeue_pos.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+#endif // MPMC_RING_H
@@ -0,0 +1,486 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <linux/filter.h>
+
+#include "reactor.h"
+#include "logger.h"
+#include "metrics.h"
+#include "admission.h"
+#include "topology.h"
+
+// 修改文件描述符，重置socket上的EPOLLONESHOT事件
+extern void modifyfd(int epollfd, int fd, int ev);
+
+unsigned long long reactor::now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+conn_table::conn_table(int size) : m_size(size) {
+    m_conns = new std::atomic<http_conn *>[size];
+    for(int i=0; i<size; ++i) {
+        m_conns[i].store(NULL, std::memory_order_relaxed);
+    }
+}
+
+conn_table::~conn_table() {
+    for(int i=0; i<m_size; ++i) {
+        delete m_conns[i].load(std::memory_order_relaxed);
+    }
+    delete[] m_conns;
+}
+
+// 只由接收该fd的反应堆线程调用；fd关闭后可能被另一个反应堆接收，所以用原子指针发布
+http_conn *conn_table::get_or_create(int fd) {
+    http_conn *conn = m_conns[fd].load(std::memory_order_acquire);
+    if(!conn) {
+        conn = new http_conn;
+        m_conns[fd].store(conn, std::memory_order_release);
+    }
+    return conn;
+}
+
+reactor::reactor(int id, int port, conn_table *users, int max_users, http_threadpool *pool,
+                 const reactor_options &options) :
+    m_id(id), m_port(port), m_listenfd(-1), m_own_listener(false), m_accept_pending(false), m_accept_stopped(false),
+    m_last_accept(0),
+    m_epollfd(-1), m_thread(0),
+    m_users(users), m_max_users(max_users), m_user_count(0), m_pool(pool),
+    m_options(options), m_timers(options.m_timer_tick, now_ms()), m_now(now_ms()), m_eventfd(-1) {
+}
+
+reactor::~reactor() {
+    if(m_eventfd != -1) {
+        close(m_eventfd);
+    }
+    if(m_epollfd != -1) {
+        close(m_epollfd);
+    }
+    if(m_listenfd != -1 && m_own_listener) {
+        close(m_listenfd);
+    }
+}
+
+bool reactor::start() {
+    if(!listen_socket()) {
+        return false;
+    }
+
+    // 创建epoll对象，将监听的文件描述符添加到epoll对象中
+    // 监听socket用边缘触发，每次通知后循环接收直到队列取空或达到本轮上限；
+    // 共用的监听socket加EPOLLEXCLUSIVE，新连接只唤醒其中一个反应堆
+    m_epollfd = epoll_create(5);
+    if(m_epollfd < 0) {
+        return false;
+    }
+    epoll_event event;
+    event.data.fd = m_listenfd;
+    event.events = EPOLLIN | EPOLLET | (m_own_listener ? 0 : EPOLLEXCLUSIVE);
+    if(epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_listenfd, &event) < 0) {
+        return false;
+    }
+    // 工作线程交还连接的eventfd与连接socket注册在同一个epoll对象中；边缘触发下每次写入都会再通知一次，
+    // 而交还队列由空变为非空时才写入，所以取出整批连接时不必读出计数
+    m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_eventfd < 0) {
+        return false;
+    }
+    event.data.fd = m_eventfd;
+    event.events = EPOLLIN | EPOLLET;
+    if(epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_eventfd, &event) < 0) {
+        return false;
+    }
+
+    return pthread_create(&m_thread, NULL, worker, this) == 0;
+}
+
+bool reactor::listen_socket() {
+    if(m_options.m_shared_listenfd != -1) {
+        m_listenfd = m_options.m_shared_listenfd;
+        m_own_listener = false;
+        return true;
+    }
+    if(m_options.m_inherited_listenfd != -1) {
+        // 按本进程的设置更新监听队列长度
+        m_listenfd = m_options.m_inherited_listenfd;
+        m_own_listener = true;
+        listen(m_listenfd, m_options.m_backlog);
+        return true;
+    }
+    m_listenfd = create_listener(m_port, m_options.m_backlog, true);
+    m_own_listener = true;
+    return m_listenfd != -1;
+}
+
+int reactor::create_listener(int port, int backlog, bool reuse_port) {
+    int fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return -1;
+    }
+
+    // 设置端口复用 - 绑定前
+    // SO_REUSEPORT使每个反应堆都能绑定同一端口，由内核按四元组哈希分发连接
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if(reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+        LOG_ERROR("listen %d: SO_REUSEPORT failed: %s", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // 绑定
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+    if(bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        LOG_ERROR("listen %d: bind failed: %s", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // 监听
+    if(listen(fd, backlog) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 内核在同一SO_REUSEPORT组内按哈希选择监听socket，不看SO_INCOMING_CPU，所以再给组挂一个经典BPF程序：
+// 按收到连接的CPU依次比较，相等时返回对应的监听socket序号，都不相等时返回的序号越界，内核改用哈希选择
+bool reactor::steer_by_cpu(const std::vector<int> &listenfds, const std::vector<int> &cpus) {
+    // 跳转偏移只有8位
+    int n = cpus.size();
+    if(n == 0 || n > 255 || listenfds.size() != cpus.size()) {
+        return false;
+    }
+    for(int i=0; i<n; ++i) {
+        int cpu = cpus[i];
+        if(setsockopt(listenfds[i], SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0) {
+            return false;
+        }
+    }
+    // 第i个比较与第i个返回指令之间隔着n条指令
+    std::vector<sock_filter> code;
+    sock_filter load = BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (__u32)(SKF_AD_OFF + SKF_AD_CPU));
+    code.push_back(load);
+    for(int i=0; i<n; ++i) {
+        sock_filter cmp = BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (__u32)cpus[i], (__u8)n, 0);
+        code.push_back(cmp);
+    }
+    sock_filter miss = BPF_STMT(BPF_RET | BPF_K, (__u32)n);
+    code.push_back(miss);
+    for(int i=0; i<n; ++i) {
+        sock_filter ret = BPF_STMT(BPF_RET | BPF_K, (__u32)i);
+        code.push_back(ret);
+    }
+    sock_fprog prog;
+    prog.len = code.size();
+    prog.filter = &code[0];
+    return setsockopt(listenfds[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0;
+}
+
+// epoll_ctl可以在其他线程中调用，摘掉监听socket后不会再有接收事件，正在进行的一轮接收看到标志后停止
+void reactor::stop_accepting() {
+    m_accept_stopped.store(true, std::memory_order_release);
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, NULL);
+}
+
+void reactor::join() {
+    if(m_thread) {
+        pthread_join(m_thread, NULL);
+    }
+}
+
+void *reactor::worker(void *arg) {
+    reactor *r = (reactor *)arg;
+    r->place();
+    r->loop();
+    return r;
+}
+
+void reactor::place() {
+    if(m_options.m_cpu < 0) {
+        return;
+    }
+    cpu_topology *topo = cpu_topology::get_instance();
+    if(!topo->pin_current_thread(m_options.m_cpu)) {
+        LOG_ERROR("reactor %d: bind to cpu %d failed", m_id, m_options.m_cpu);
+        return;
+    }
+    // 反应堆对象由主线程创建，其中的事件数组占了大部分
+    topo->bind_memory(m_events, sizeof(m_events), topo->node_of(m_options.m_cpu));
+}
+
+// 有客户端连接进来：边缘触发下要把监听队列取空，accept4直接得到非阻塞的socket；
+// 一轮最多接收m_accept_batch个，剩下的留到下一轮，期间不再等待事件。
+// 线程池过载时每个目标排队时间最多接收一批，其余连接留在监听队列中，
+// 避免被拒绝后立即重连的客户端占满反应堆线程
+void reactor::accept_conn() {
+    if(m_accept_stopped.load(std::memory_order_acquire)) {
+        m_accept_pending = false;
+        return;
+    }
+    admission *adm = admission::get_instance();
+    if(adm->overloaded() && m_now - m_last_accept < (unsigned long long)adm->target_ms()) {
+        m_accept_pending = true;
+        return;
+    }
+    m_last_accept = m_now;
+    m_accept_pending = false;
+    for(int i=0; i<m_options.m_accept_batch; ++i) {
+        struct sockaddr_in client_address;
+        socklen_t client_addrlen = sizeof(client_address);
+        int connfd = accept4(m_listenfd, (struct sockaddr*)&client_address, &client_addrlen,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(connfd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                // 如EMFILE，连接留在队列中，等下一个新连接的通知再试
+                LOG_ERROR("reactor %d: accept failed: %s", m_id, strerror(errno));
+            }
+            return;
+        }
+
+        if(connfd >= m_users->size() || m_user_count.load(std::memory_order_relaxed) >= m_max_users) {
+            // 目前连接数已满，回复503后关闭
+            admission::get_instance()->count_rejected();
+            http_conn::send_overloaded(connfd);
+            close(connfd);
+            continue;
+        }
+
+        // 将新客户数据初始化后放入连接表
+        open_conn(m_users->get_or_create(connfd), connfd, client_address);
+    }
+    m_accept_pending = true;
+}
+
+void reactor::open_conn(http_conn *conn, int connfd, struct sockaddr_in &addr) {
+    conn->init(connfd, addr, m_epollfd, &m_user_count, this);
+    arm_timer(conn, http_conn::TIMER_HEADER);
+}
+
+// 内联处理的响应立即发送，发完后读缓冲区中还有请求时继续处理，直到要等待新数据或交给线程池
+void reactor::handle_request(http_conn *conn) {
+    if(!m_options.m_inline) {
+        submit(conn);
+        return;
+    }
+    do {
+        int ret = conn->process_inline();
+        if(ret == http_conn::INLINE_ERROR) {
+            close_conn(conn);
+            return;
+        } else if(ret == http_conn::INLINE_DEFER) {
+            submit(conn);
+            return;
+        } else if(ret == http_conn::INLINE_WAIT) {
+            modifyfd(m_epollfd, conn->sockfd(), EPOLLIN);
+            return;
+        }
+    } while(write_conn(conn));
+}
+
+bool reactor::write_conn(http_conn *conn) {
+    // 一次性写完所有数据
+    unsigned long long begin = metrics::now_ns();
+    bool ok = conn->write();
+    metrics::record(STAGE_WRITE, metrics::now_ns() - begin);
+    if(!ok) {
+        close_conn(conn);
+    } else if(conn->writing()) {
+        // 写缓冲已满，有进展就重新计时
+        arm_timer(conn, http_conn::TIMER_WRITE);
+    } else if(conn->has_unparsed_input()) {
+        // 读缓冲区中还有流水线请求，不再等待可读事件
+        arm_timer(conn, http_conn::TIMER_HEADER);
+        return true;
+    } else {
+        // 只收到下一个请求的一部分时仍按请求头时限计时
+        arm_timer(conn, conn->has_buffered_input() ? http_conn::TIMER_HEADER : http_conn::TIMER_IDLE);
+    }
+    return false;
+}
+
+// 把读到完整数据的连接交给线程池；过载或队列已满时由反应堆直接回复503，请求不入队
+void reactor::submit(http_conn *conn) {
+    if(!enqueue(conn)) {
+        reject(conn);
+    }
+}
+
+bool reactor::enqueue(http_conn *conn) {
+    admission *adm = admission::get_instance();
+    if(adm->overloaded() && !adm->admit(m_pool->queue_size())) {
+        return false;
+    }
+    conn->set_enqueue_time(metrics::now_ns());
+    conn->set_busy(true);
+    if(!m_pool->append(conn)) {
+        conn->set_busy(false);
+        return false;
+    }
+    return true;
+}
+
+void reactor::reject(http_conn *conn) {
+    admission::get_instance()->count_rejected();
+    http_conn::send_overloaded(conn->sockfd());
+    close_conn(conn);
+}
+
+// 连接只在所属反应堆线程中关闭，工作线程遇到错误时通过shutdown触发EPOLLHUP交给这里处理
+void reactor::close_conn(http_conn *conn) {
+    m_timers.remove(conn->timer());
+    conn->close_conn();
+}
+
+void reactor::post(http_conn *conn, int ev) {
+    posted_conn p = { conn, ev };
+    m_post_lock.lock();
+    bool was_empty = m_posted.empty();
+    m_posted.push_back(p);
+    m_post_lock.unlock();
+    // 反应堆线程自己交还的连接在下一轮循环开头处理，不需要唤醒；
+    // 队列原本非空时已有人唤醒过，反应堆取走整批之前不会再等待
+    if(was_empty && !pthread_equal(pthread_self(), m_thread)) {
+        uint64_t one = 1;
+        ::write(m_eventfd, &one, sizeof(one));
+    }
+}
+
+void reactor::take_posted() {
+    m_post_lock.lock();
+    m_draining.swap(m_posted);
+    m_post_lock.unlock();
+}
+
+// 工作线程处理完的连接：有响应时立即发送，否则等待更多请求数据
+void reactor::drain_posted() {
+    take_posted();
+    for(size_t i=0; i<m_draining.size(); ++i) {
+        http_conn *conn = m_draining[i].m_conn;
+        conn->set_busy(false);
+        if(!(m_draining[i].m_ev & EPOLLOUT)) {
+            modifyfd(m_epollfd, conn->sockfd(), EPOLLIN);
+        } else if(write_conn(conn)) {
+            handle_request(conn);
+        }
+    }
+    m_draining.clear();
+}
+
+void reactor::arm_timer(http_conn *conn, int kind) {
+    int timeout = m_options.m_header_timeout;
+    if(kind == http_conn::TIMER_IDLE) {
+        timeout = m_options.m_idle_timeout;
+    } else if(kind == http_conn::TIMER_WRITE) {
+        timeout = m_options.m_write_timeout;
+    }
+    conn->set_timer_kind(kind);
+    conn->timer()->m_data = conn;
+    m_timers.add(conn->timer(), timeout);
+}
+
+void reactor::expire_timers() {
+    timer_node *node = m_timers.advance(m_now);
+    while(node) {
+        timer_node *next = node->m_next;
+        http_conn *conn = (http_conn *)node->m_data;
+        if(conn->busy()) {
+            // 请求正在线程池中处理，稍后再检查
+            m_timers.add(node, m_options.m_timer_tick);
+        } else {
+            close_conn(conn);
+        }
+        node = next;
+    }
+}
+
+void reactor::handle_event(int sockfd, unsigned events) {
+    http_conn *conn = m_users->get(sockfd);
+    if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        // 对方异常断开或错误等事件
+        close_conn(conn);
+    } else if(events & EPOLLIN) {
+        if(conn->timer_kind() == http_conn::TIMER_IDLE || conn->reading_body()) {
+            // 长连接上开始了新的请求，请求头时限从现在算起，之后的读事件不再延长；
+            // 接收请求体期间每次有数据到达都重新计时
+            arm_timer(conn, http_conn::TIMER_HEADER);
+        }
+        unsigned long long begin = metrics::now_ns();
+        bool ok = conn->read();
+        metrics::record(STAGE_READ, metrics::now_ns() - begin);
+        if(ok) {
+            // 一次性读完所有数据
+            handle_request(conn);
+        }else {
+            close_conn(conn);
+        }
+    } else if(events & EPOLLOUT) {
+        if(write_conn(conn)) {
+            handle_request(conn);
+        }
+    }
+}
+
+// 反应堆线程不断循环检测事件
+void reactor::loop() {
+    while(true) {
+        // 等待到下一个定时器到期，监听队列中还有连接时只收集已就绪的事件，过载时最多等到下一次接收
+        int timeout = m_timers.next_timeout(m_now);
+        if(m_accept_pending) {
+            admission *adm = admission::get_instance();
+            if(!adm->overloaded()) {
+                timeout = 0;
+            } else if(timeout < 0 || timeout > adm->target_ms()) {
+                timeout = adm->target_ms();
+            }
+        }
+        int num = epoll_wait(m_epollfd, m_events, MAX_EVENT_NUMER, timeout);
+        if(num < 0 && errno != EINTR) {
+            LOG_ERROR("reactor %d: epoll failure", m_id);
+            break;
+        }
+        unsigned long long loop_begin = metrics::now_ns();
+        // 先推进时间轮，之后挂入的定时器都以当前时间为起点
+        m_now = now_ms();
+        expire_timers();
+
+        // 循环遍历事件数组
+        bool accepted = false;
+        for(int i=0; i<num; ++i) {
+            int sockfd = m_events[i].data.fd;
+            if(sockfd == m_listenfd) {
+                accept_conn();
+                accepted = true;
+                continue;
+            } else if(sockfd == m_eventfd) {
+                drain_posted();
+                continue;
+            }
+            handle_event(sockfd, m_events[i].events);
+        }
+        if(m_accept_pending && !accepted) {
+            // 已有连接的事件处理完后继续接收上一轮剩下的连接
+            accept_conn();
+        }
+        if(num > 0) {
+            metrics::record(STAGE_EVENT_LOOP, metrics::now_ns() - loop_begin);
+        }
+    }
+}
@@ -0,0 +1,144 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include <sys/epoll.h>
+
+#include "locker.h"
+#include "threadpool.h"
+#include "http_conn.h"
+#include "timer_wheel.h"
+
+#define MAX_FD 65535                // 默认的最大文件描述符个数，即连接表大小
+#define MAX_EVENT_NUMER 10000      // 监听的最大事件数
+
+// 线程池的请求队列实现，默认使用无锁环形队列，编译时加 -DPOOL_LIST_QUEUE 切回链表+互斥锁队列，
+// 加 -DPOOL_WORK_STEALING 使用每个工作线程一个Chase-Lev双端队列的工作窃取调度
+#if defined(POOL_LIST_QUEUE)
+typedef threadpool<http_conn, list_queue<http_conn> > http_threadpool;
+#elif defined(POOL_WORK_STEALING)
+typedef threadpool<http_conn, steal_queue<http_conn> > http_threadpool;
+#else
+typedef threadpool<http_conn, ring_queue<http_conn> > http_threadpool;
+#endif
+
+// 反应堆设置，超时均为毫秒
+struct reactor_options {
+    int m_header_timeout;           // 从连接建立或请求的第一个字节起，收齐请求头的时限
+    int m_idle_timeout;             // 长连接两次请求之间的空闲时限
+    int m_write_timeout;            // 发送响应时连续无进展的时限
+    int m_timer_tick;               // 时间轮精度
+    int m_backlog;                  // 监听队列长度，实际不超过net.core.somaxconn
+    int m_accept_batch;             // 每轮事件循环最多接收的新连接数，避免连接风暴时饿死已有连接
+    int m_shared_listenfd;          // 所有反应堆共用的监听socket，-1表示各自创建SO_REUSEPORT监听socket
+    int m_inherited_listenfd;       // 平滑升级时从旧进程取得的本反应堆的监听socket，-1表示新建
+    bool m_inline;                  // 只需内存数据的请求在反应堆线程中直接处理并发送，不经过线程池
+    int m_cpu;                      // 事件循环线程绑定的CPU，-1表示不绑定
+
+    reactor_options() : m_header_timeout(10000), m_idle_timeout(15000),
+        m_write_timeout(10000), m_timer_tick(100), m_backlog(1024), m_accept_batch(64),
+        m_shared_listenfd(-1), m_inherited_listenfd(-1), m_inline(true), m_cpu(-1) {}
+};
+
+// 连接表：按fd索引，连接对象在第一次使用该fd时才创建，之后随fd复用，
+// 空闲连接不持有读写缓冲区，只占用对象本身
+class conn_table {
+public:
+    explicit conn_table(int size);
+    ~conn_table();
+
+    http_conn *get(int fd) const { return m_conns[fd].load(std::memory_order_acquire); }
+    http_conn *get_or_create(int fd);
+    int size() const { return m_size; }
+
+private:
+    std::atomic<http_conn *> *m_conns;
+    int m_size;
+};
+
+// 反应堆：每个反应堆线程独占一个epoll对象和一个SO_REUSEPORT监听socket，
+// 由内核在各监听socket之间分发新连接，连接的读写事件始终由接收它的反应堆处理。
+// 也可以共用一个监听socket，以EPOLLEXCLUSIVE注册，每个新连接只唤醒一个空闲的反应堆
+class reactor {
+public:
+    reactor(int id, int port, conn_table *users, int max_users, http_threadpool *pool,
+            const reactor_options &options);
+    virtual ~reactor();
+    virtual bool start();           // 创建监听socket和epoll对象，启动事件循环线程
+    void join();                    // 等待事件循环线程结束
+
+    int user_count() const { return m_user_count.load(std::memory_order_relaxed); }
+    int listen_fd() const { return m_listenfd; }
+
+    // 平滑升级时由主线程调用：不再接收新连接，监听socket保持打开，已有的连接照常处理
+    virtual void stop_accepting();
+
+    // 工作线程处理完连接后交还给反应堆，io_uring和协程反应堆的连接在其他线程中也通过它继续读写，
+    // ev为EPOLLIN时继续接收，EPOLLOUT时发送响应。连接在反应堆取出之前保持忙，不会被定时器关闭
+    void post(http_conn *conn, int ev);
+
+    // 创建非阻塞的监听socket，reuse_port为true时可与其他反应堆绑定同一端口，失败返回-1
+    static int create_listener(int port, int backlog, bool reuse_port);
+    // 各反应堆用自己的SO_REUSEPORT监听socket时，让新连接交给收到它的CPU上的反应堆：
+    // listenfds按加入端口的先后排列，cpus[i]为其所属反应堆绑定的CPU，其他CPU上的连接仍按哈希分发
+    static bool steer_by_cpu(const std::vector<int> &listenfds, const std::vector<int> &cpus);
+
+protected:
+    struct posted_conn {
+        http_conn *m_conn;
+        int m_ev;
+    };
+
+    static unsigned long long now_ms();
+    static void *worker(void *arg);
+    // 在事件循环线程中调用：绑定到m_options.m_cpu，并把反应堆频繁访问的内存迁移到所在节点
+    virtual void place();
+    bool listen_socket();           // 创建本反应堆的监听socket，或使用共用的监听socket
+    virtual void loop();            // 事件循环
+    void accept_conn();             // 接收新连接，一次最多m_accept_batch个
+    virtual void open_conn(http_conn *conn, int connfd, struct sockaddr_in &addr);  // 初始化新连接
+    virtual void handle_event(int sockfd, unsigned events);    // 处理连接socket上的事件
+    // 读缓冲区中有新的请求数据：开启内联处理时先在本线程尝试，否则交给线程池
+    virtual void handle_request(http_conn *conn);
+    void submit(http_conn *conn);   // 交给线程池处理，过载时回复503
+    bool enqueue(http_conn *conn);  // 交给线程池处理，过载或队列已满时返回false
+    bool write_conn(http_conn *conn);   // 发送响应，发完后读缓冲区中还有流水线请求时返回true
+    void reject(http_conn *conn);   // 回复503并关闭连接
+    virtual void close_conn(http_conn *conn);
+    void arm_timer(http_conn *conn, int kind);
+    void expire_timers();           // 关闭超时的连接
+    void take_posted();             // 把交还的连接整批移到m_draining
+    virtual void drain_posted();    // 取出交还的连接，清除忙标志后继续发送或接收
+
+protected:
+    int m_id;                       // 反应堆编号
+    int m_port;                     // 监听端口
+    int m_listenfd;                 // 本反应堆的监听socket
+    bool m_own_listener;            // 监听socket是否由本反应堆创建和关闭
+    bool m_accept_pending;          // 上一轮达到接收上限，监听队列中可能还有连接
+    std::atomic<bool> m_accept_stopped; // 已将监听socket移交给新进程
+    unsigned long long m_last_accept;   // 上一次接收新连接的时间，过载时据此控制接收速度
+    int m_epollfd;                  // 本反应堆独占的epoll对象
+    pthread_t m_thread;             // 事件循环线程
+
+    // 连接表由所有反应堆共享、按fd索引，fd在进程内唯一，
+    // 所以每个反应堆只会访问自己accept到的那部分槽位
+    conn_table *m_users;
+    int m_max_users;                // 本反应堆允许的最大连接数
+    std::atomic<int> m_user_count;  // 本反应堆上的连接数
+
+    http_threadpool *m_pool;
+    reactor_options m_options;
+    timer_wheel m_timers;           // 本反应堆所有连接的超时定时器
+    unsigned long long m_now;       // 本轮事件循环的时间（毫秒）
+    epoll_event m_events[MAX_EVENT_NUMER];
+
+    int m_eventfd;                              // 交还连接时唤醒反应堆
+    locker m_post_lock;                         // 保护m_posted
+    std::vector<posted_conn> m_posted;          // 工作线程交还的连接
+    std::vector<posted_conn> m_draining;        // 反应堆线程正在处理的一批，与m_posted交换
+};
+
+#endif // REACTOR_H
@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "request_body.h"
+#include "buffer_pool.h"
+
+static const size_t SPLICE_CHUNK = 64 * 1024;      // 每次splice不超过默认的管道容量
+
+ssize_t body_sink::splice_from(int sockfd, size_t len) {
+    errno = EINVAL;
+    return -1;
+}
+
+discard_sink *discard_sink::get_instance() {
+    static discard_sink instance;
+    return &instance;
+}
+
+memory_sink::memory_sink(size_t max_size) : m_buf(NULL), m_capacity(0), m_len(0), m_max_size(max_size),
+    m_overflowed(false) {
+}
+
+memory_sink::~memory_sink() {
+    if(m_buf) {
+        buffer_pool::get_instance()->free(m_buf, m_capacity);
+    }
+}
+
+bool memory_sink::write(const char *data, size_t len) {
+    if(m_len + len > m_max_size) {
+        m_overflowed = true;
+        return false;
+    }
+    if(m_capacity - m_len < len) {
+        size_t capacity;
+        char *buf = buffer_pool::get_instance()->alloc(m_len + len, &capacity);
+        if(!buf) {
+            return false;
+        }
+        if(m_buf) {
+            memcpy(buf, m_buf, m_len);
+            buffer_pool::get_instance()->free(m_buf, m_capacity);
+        }
+        m_buf = buf;
+        m_capacity = capacity;
+    }
+    memcpy(m_buf + m_len, data, len);
+    m_len += len;
+    return true;
+}
+
+file_sink::file_sink() : m_fd(-1), m_done(false) {
+    m_pipe[0] = m_pipe[1] = -1;
+    m_path[0] = '\0';
+    m_tmp_path[0] = '\0';
+}
+
+file_sink::~file_sink() {
+    if(m_fd != -1) {
+        close(m_fd);
+    }
+    if(m_pipe[0] != -1) {
+        close(m_pipe[0]);
+        close(m_pipe[1]);
+    }
+    if(!m_done && m_tmp_path[0] != '\0') {
+        // 请求体不完整，不留下半个文件
+        unlink(m_tmp_path);
+    }
+}
+
+// 临时文件与目标文件在同一目录，改名是原子的，上传过程中读到的始终是旧版本
+int file_sink::open(const char *path) {
+    if(strlen(path) >= sizeof(m_path)) {
+        return ENAMETOOLONG;
+    }
+    strcpy(m_path, path);
+    snprintf(m_tmp_path, sizeof(m_tmp_path), "%s.upload-XXXXXX", path);
+    m_fd = mkostemp(m_tmp_path, O_CLOEXEC);
+    if(m_fd < 0) {
+        m_tmp_path[0] = '\0';
+        return errno;
+    }
+    // 上传的文件可以作为静态文件访问
+    fchmod(m_fd, 0644);
+    return 0;
+}
+
+bool file_sink::write(const char *data, size_t len) {
+    while(len > 0) {
+        ssize_t n = ::write(m_fd, data, len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool file_sink::finish() {
+    int ret = close(m_fd);
+    m_fd = -1;
+    if(ret < 0 || rename(m_tmp_path, m_path) < 0) {
+        return false;
+    }
+    m_done = true;
+    return true;
+}
+
+// socket中的数据先进管道再进文件，socket暂时没有数据时返回-1和EAGAIN
+ssize_t file_sink::splice_from(int sockfd, size_t len) {
+    if(m_pipe[0] == -1 && pipe2(m_pipe, O_CLOEXEC) < 0) {
+        return -1;
+    }
+    if(len > SPLICE_CHUNK) {
+        len = SPLICE_CHUNK;
+    }
+    ssize_t n = splice(sockfd, NULL, m_pipe[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(n <= 0) {
+        return n;
+    }
+    size_t left = n;
+    while(left > 0) {
+        ssize_t m = splice(m_pipe[0], NULL, m_fd, NULL, left, SPLICE_F_MOVE);
+        if(m < 0 && errno == EINTR) {
+            continue;
+        }
+        if(m <= 0) {
+            // 管道中剩下的数据已无法写入文件，上传失败
+            if(m == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        left -= m;
+    }
+    return n;
+}
+
+void body_decoder::init_length(unsigned long long length) {
+    m_state = STATE_DATA;
+    m_chunked = false;
+    m_left = length;
+    m_received = 0;
+    m_digits = 0;
+    m_line = 0;
+}
+
+void body_decoder::init_chunked() {
+    init_length(0);
+    m_state = STATE_SIZE;
+    m_chunked = true;
+}
+
+void body_decoder::end_data() {
+    m_state = m_chunked ? STATE_DATA_CR : STATE_DONE;
+}
+
+void body_decoder::skip_raw(unsigned long long n) {
+    m_left -= n;
+    m_received += n;
+}
+
+static int hex_value(char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+size_t body_decoder::decode(const char *data, size_t len, body_sink *sink, RESULT *result) {
+    size_t pos = 0;
+    *result = BODY_MORE;
+    while(m_state != STATE_DONE) {
+        if(m_state == STATE_DATA) {
+            // 数据部分整段交给接收方
+            if(m_left == 0) {
+                end_data();
+                continue;
+            }
+            if(pos == len) {
+                break;
+            }
+            size_t n = len - pos < m_left ? len - pos : m_left;
+            if(!sink->write(data + pos, n)) {
+                *result = BODY_SINK_ERROR;
+                return pos;
+            }
+            pos += n;
+            m_left -= n;
+            m_received += n;
+            continue;
+        }
+        if(pos == len) {
+            break;
+        }
+
+        // 分块的框架逐字节解析，行结束符必须是CRLF
+        char c = data[pos++];
+        bool bad = false;
+        switch(m_state) {
+            case STATE_SIZE: {
+                int v = hex_value(c);
+                if(v >= 0) {
+                    bad = ++m_digits > MAX_SIZE_DIGITS;
+                    m_left = m_left * 16 + v;
+                } else if(m_digits == 0) {
+                    bad = true;
+                } else if(c == ';' || c == ' ' || c == '\t') {
+                    m_state = STATE_EXT;
+                    m_line = 0;
+                } else if(c == '\r') {
+                    m_state = STATE_SIZE_LF;
+                } else {
+                    bad = true;
+                }
+                break;
+            }
+            case STATE_EXT:
+                if(c == '\r') {
+                    m_state = STATE_SIZE_LF;
+                } else {
+                    bad = ++m_line > MAX_LINE_SIZE;
+                }
+                break;
+            case STATE_SIZE_LF:
+                bad = c != '\n';
+                // 大小为0的块是最后一块，之后是尾部字段
+                m_state = m_left == 0 ? STATE_TRAILER : STATE_DATA;
+                break;
+            case STATE_DATA_CR:
+                bad = c != '\r';
+                m_state = STATE_DATA_LF;
+                break;
+            case STATE_DATA_LF:
+                bad = c != '\n';
+                m_state = STATE_SIZE;
+                m_digits = 0;
+                m_left = 0;
+                break;
+            case STATE_TRAILER:
+                if(c == '\r') {
+                    m_state = STATE_END_LF;
+                } else {
+                    m_state = STATE_TRAILER_LINE;
+                    m_line = 1;
+                }
+                break;
+            case STATE_TRAILER_LINE:
+                if(c == '\r') {
+                    m_state = STATE_TRAILER_LF;
+                } else {
+                    bad = ++m_line > MAX_LINE_SIZE;
+                }
+                break;
+            case STATE_TRAILER_LF:
+                bad = c != '\n';
+                m_state = STATE_TRAILER;
+                break;
+            case STATE_END_LF:
+                bad = c != '\n';
+                m_state = STATE_DONE;
+                break;
+            default:
+                bad = true;
+                break;
+        }
+        if(bad) {
+            *result = BODY_BAD;
+            return pos;
+        }
+    }
+    if(m_state == STATE_DONE) {
+        *result = BODY_DONE;
+    }
+    return pos;
+}
@@ -0,0 +1,121 @@
+#ifndef REQUEST_BODY_H
+#define REQUEST_BODY_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// 请求体的接收方：解码后的请求体按到达的顺序分片交给它，不在内存中拼接
+class body_sink {
+public:
+    virtual ~body_sink() {}
+    virtual bool write(const char *data, size_t len) = 0;  // 一片请求体，失败返回false
+    virtual bool finish() { return true; }                  // 请求体已完整
+    virtual bool blocking() const { return false; }         // 会访问文件系统，不能在反应堆线程中调用
+    // 能否从socket直接splice，以及splice最多len个字节，返回实际字节数，失败返回-1并设置errno
+    virtual bool splice_capable() const { return false; }
+    virtual ssize_t splice_from(int sockfd, size_t len);
+    virtual bool overflowed() const { return false; }       // 写入失败是因为请求体超过上限
+};
+
+// 丢弃请求体，用于不需要请求体的请求，所有连接共用一个
+class discard_sink : public body_sink {
+public:
+    static discard_sink *get_instance();
+    bool write(const char *data, size_t len) { return true; }
+};
+
+// 收集到内存中交给路由处理函数，缓冲区从内存池借用，超过max_size时写入失败
+class memory_sink : public body_sink {
+public:
+    explicit memory_sink(size_t max_size);
+    ~memory_sink();
+
+    bool write(const char *data, size_t len);
+    bool overflowed() const { return m_overflowed; }
+    const char *data() const { return m_buf; }
+    size_t size() const { return m_len; }
+
+private:
+    char *m_buf;
+    size_t m_capacity;
+    size_t m_len;
+    size_t m_max_size;
+    bool m_overflowed;
+};
+
+// 上传文件：先写到同一目录下的临时文件，请求体完整后改名为目标文件，中途断开时删除临时文件。
+// 读缓冲区中没有剩余数据时，由socket经管道splice到文件，不经过用户态缓冲区
+class file_sink : public body_sink {
+public:
+    file_sink();
+    ~file_sink();
+
+    int open(const char *path);     // 创建临时文件，成功返回0，否则返回errno
+    bool write(const char *data, size_t len);
+    bool finish();
+    bool blocking() const { return true; }
+    bool splice_capable() const { return true; }
+    ssize_t splice_from(int sockfd, size_t len);
+
+private:
+    static const int MAX_PATH_SIZE = 256;
+
+    int m_fd;
+    int m_pipe[2];                  // 第一次splice时创建
+    bool m_done;                    // 已改名为目标文件
+    char m_path[MAX_PATH_SIZE];
+    char m_tmp_path[MAX_PATH_SIZE + 16];
+};
+
+// 请求体的增量解码：Content-Length或chunked。每次传入读缓冲区中新到的数据，
+// 请求体数据直接以读缓冲区中的片段交给接收方，分块的边界和尾部字段在这里逐字节解析，
+// 已消耗的数据由调用者从读缓冲区丢弃，所以请求体多大都只占用一个读缓冲区
+class body_decoder {
+public:
+    enum RESULT {
+        BODY_MORE = 0,      // 请求体尚未结束，需要更多数据
+        BODY_DONE,          // 请求体已结束，之后的数据属于下一个请求
+        BODY_BAD,           // 分块格式错误
+        BODY_SINK_ERROR     // 接收方写入失败
+    };
+
+    body_decoder() { init_length(0); }
+    void init_length(unsigned long long length);
+    void init_chunked();
+
+    // 解码data开头最多len个字节，返回消耗的字节数
+    size_t decode(const char *data, size_t len, body_sink *sink, RESULT *result);
+    // 可以不经解码直接交给接收方的原始字节数：Content-Length的剩余部分或当前块的剩余数据
+    unsigned long long raw_left() const { return m_state == STATE_DATA ? m_left : 0; }
+    void skip_raw(unsigned long long n);        // 调用者已把n个原始字节直接交给接收方
+    unsigned long long received() const { return m_received; }
+
+private:
+    enum STATE {
+        STATE_DATA = 0,     // 请求体数据，剩余m_left个字节
+        STATE_SIZE,         // 块大小（十六进制）
+        STATE_EXT,          // 块扩展，忽略
+        STATE_SIZE_LF,
+        STATE_DATA_CR,      // 块数据之后的CRLF
+        STATE_DATA_LF,
+        STATE_TRAILER,      // 尾部字段的行首，空行结束请求体
+        STATE_TRAILER_LINE,
+        STATE_TRAILER_LF,
+        STATE_END_LF,
+        STATE_DONE
+    };
+
+    static const int MAX_SIZE_DIGITS = 15;      // 块大小最多15位十六进制数，不会溢出
+    static const int MAX_LINE_SIZE = 4096;      // 块扩展和每行尾部字段的最大长度
+
+    void end_data();
+
+    int m_state;
+    bool m_chunked;
+    unsigned long long m_left;
+    unsigned long long m_received;              // 已交给接收方的字节数
+    int m_digits;                               // 块大小已读的位数
+    int m_line;                                 // 块扩展或尾部字段行已读的字节数
+};
+
+#endif // REQUEST_BODY_H
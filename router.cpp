@@ -0,0 +1,338 @@
+#include <string.h>
+
+#include "router.h"
+#include "buffer_pool.h"
+#include "http_header.h"
+
+const char *http_request::param(const char *name, int *len) const {
+    for(int i=0; i<m_param_count; ++i) {
+        if(strcmp(m_params[i].m_name, name) == 0) {
+            *len = m_params[i].m_len;
+            return m_params[i].m_value;
+        }
+    }
+    return NULL;
+}
+
+http_response::http_response() : m_buf(NULL), m_size(0), m_len(0), m_status(200),
+    m_content_type("text/plain"), m_failed(false) {
+}
+
+http_response::~http_response() {
+    if(m_buf) {
+        buffer_pool::get_instance()->free(m_buf, m_size);
+    }
+}
+
+// 换一块更大的缓冲区，超过内存池的最大块时失败，之后的写入都被忽略
+bool http_response::grow(size_t need) {
+    if(m_failed) {
+        return false;
+    }
+    size_t capacity;
+    char *buf = buffer_pool::get_instance()->alloc(need, &capacity);
+    if(!buf) {
+        m_failed = true;
+        return false;
+    }
+    if(m_buf) {
+        memcpy(buf, m_buf, m_len);
+        buffer_pool::get_instance()->free(m_buf, m_size);
+    }
+    m_buf = buf;
+    m_size = capacity;
+    return true;
+}
+
+bool http_response::append(const char *data, size_t len) {
+    if(m_size - m_len < len && !grow(m_len + len)) {
+        return false;
+    }
+    memcpy(m_buf + m_len, data, len);
+    m_len += len;
+    return true;
+}
+
+bool http_response::append(const char *str) {
+    return append(str, strlen(str));
+}
+
+bool http_response::append_uint(unsigned long long v) {
+    char buf[http_header::UINT_SIZE];
+    return append(buf, http_header::format_uint(v, buf));
+}
+
+char *http_response::reserve(size_t size, size_t *avail) {
+    if(m_size - m_len < size && !grow(m_len + size)) {
+        return NULL;
+    }
+    *avail = m_size - m_len;
+    return m_buf + m_len;
+}
+
+char *http_response::detach(size_t *size, int *len) {
+    char *buf = m_buf;
+    *size = m_size;
+    *len = m_len;
+    m_buf = NULL;
+    m_size = 0;
+    m_len = 0;
+    return buf;
+}
+
+router::build_node::build_node() : m_param(NULL), m_wildcard(NULL) {
+    for(int i=0; i<METHOD_NUMBER; ++i) {
+        m_routes[i] = -1;
+    }
+}
+
+router::build_node::~build_node() {
+    for(size_t i=0; i<m_children.size(); ++i) {
+        delete m_children[i];
+    }
+    delete m_param;
+    delete m_wildcard;
+}
+
+router *router::get_instance() {
+    static router instance;
+    return &instance;
+}
+
+router::~router() {
+}
+
+bool router::add(int method, const char *pattern, route_handler handler, void *ctx, int flags, size_t max_body) {
+    if(m_compiled || method < 0 || method >= METHOD_NUMBER || pattern[0] != '/' || !handler ||
+       max_body > buffer_pool::MAX_SIZE) {
+        return false;
+    }
+    // 参数个数不能超过MAX_PARAMS，通配只能在最后一段
+    int params = 0;
+    for(const char *p = pattern + 1; *p; ++p) {
+        if(p[-1] == '/' && (*p == ':' || *p == '*')) {
+            ++params;
+            if(*p == '*' && strchr(p, '/')) {
+                return false;
+            }
+        }
+    }
+    if(params > MAX_PARAMS) {
+        return false;
+    }
+    route r = { handler, ctx, flags, max_body };
+    if(!insert(&m_root, pattern, method, m_routes.size())) {
+        return false;
+    }
+    m_routes.push_back(r);
+    return true;
+}
+
+// 把模式的剩余部分p插入到n之下；只有紧跟在'/'之后的':'和'*'表示参数
+bool router::insert(build_node *n, const char *p, int method, int route_index) {
+    if(*p == '\0') {
+        if(n->m_routes[method] != -1) {
+            return false;
+        }
+        n->m_routes[method] = route_index;
+        return true;
+    }
+
+    if(p[-1] == '/' && (*p == ':' || *p == '*')) {
+        const char *name = p + 1;
+        const char *name_end = strchrnul(name, '/');
+        if(name_end == name) {
+            return false;
+        }
+        build_node *&child = *p == ':' ? n->m_param : n->m_wildcard;
+        if(!child) {
+            child = new build_node;
+            child->m_param_name.assign(name, name_end - name);
+        } else if(child->m_param_name.compare(0, std::string::npos, name, name_end - name) != 0) {
+            // 同一位置的参数必须同名
+            return false;
+        }
+        return insert(child, name_end, method, route_index);
+    }
+
+    // 字面量一直到下一个参数
+    const char *end = p;
+    while(*end && !(end[-1] == '/' && (*end == ':' || *end == '*'))) {
+        ++end;
+    }
+    int len = end - p;
+    for(size_t i=0; i<n->m_children.size(); ++i) {
+        build_node *c = n->m_children[i];
+        if(c->m_label[0] != p[0]) {
+            continue;
+        }
+        int common = 0;
+        while(common < len && common < (int)c->m_label.size() && c->m_label[common] == p[common]) {
+            ++common;
+        }
+        if(common < (int)c->m_label.size()) {
+            // 在公共前缀处拆开已有的边
+            build_node *mid = new build_node;
+            mid->m_label = c->m_label.substr(0, common);
+            c->m_label.erase(0, common);
+            mid->m_children.push_back(c);
+            n->m_children[i] = mid;
+            c = mid;
+        }
+        return insert(c, p + common, method, route_index);
+    }
+    build_node *c = new build_node;
+    c->m_label.assign(p, len);
+    n->m_children.push_back(c);
+    return insert(c, end, method, route_index);
+}
+
+void router::compile() {
+    if(m_compiled) {
+        return;
+    }
+    m_nodes.push_back(node());
+    m_keys.push_back(0);
+    flatten_into(0, &m_root);
+    m_compiled = true;
+
+    // 注册期间的树不再需要
+    for(size_t i=0; i<m_root.m_children.size(); ++i) {
+        delete m_root.m_children[i];
+    }
+    m_root.m_children.clear();
+    delete m_root.m_param;
+    delete m_root.m_wildcard;
+    m_root.m_param = NULL;
+    m_root.m_wildcard = NULL;
+}
+
+// 先为b的所有子节点占好连续的位置，再递归填充各子节点
+void router::flatten_into(int index, build_node *b) {
+    int first = m_nodes.size();
+    for(size_t i=0; i<b->m_children.size(); ++i) {
+        m_nodes.push_back(node());
+        m_keys.push_back(b->m_children[i]->m_label[0]);
+    }
+    int param = -1;
+    if(b->m_param) {
+        param = m_nodes.size();
+        m_nodes.push_back(node());
+        m_keys.push_back(0);
+    }
+    int wildcard = -1;
+    if(b->m_wildcard) {
+        wildcard = m_nodes.size();
+        m_nodes.push_back(node());
+        m_keys.push_back(0);
+    }
+
+    node &n = m_nodes[index];
+    n.m_label = m_labels.size();
+    n.m_label_len = b->m_label.size();
+    m_labels.append(b->m_label);
+    n.m_name = m_labels.size();
+    m_labels.append(b->m_param_name);
+    m_labels.push_back('\0');
+    n.m_first_child = first;
+    n.m_child_count = b->m_children.size();
+    n.m_param = param;
+    n.m_wildcard = wildcard;
+    n.m_routes = -1;
+    for(int i=0; i<METHOD_NUMBER; ++i) {
+        if(b->m_routes[i] != -1) {
+            n.m_routes = m_route_sets.size();
+            m_route_sets.insert(m_route_sets.end(), b->m_routes, b->m_routes + METHOD_NUMBER);
+            break;
+        }
+    }
+
+    for(size_t i=0; i<b->m_children.size(); ++i) {
+        flatten_into(first + i, b->m_children[i]);
+    }
+    if(param != -1) {
+        flatten_into(param, b->m_param);
+    }
+    if(wildcard != -1) {
+        flatten_into(wildcard, b->m_wildcard);
+    }
+}
+
+unsigned router::methods_of(const node &n) const {
+    unsigned mask = 0;
+    if(n.m_routes >= 0) {
+        for(int i=0; i<METHOD_NUMBER; ++i) {
+            if(m_route_sets[n.m_routes + i] != -1) {
+                mask |= 1u << i;
+            }
+        }
+    }
+    return mask;
+}
+
+const route *router::match(int method, const char *path, int len, route_param *params, int *param_count,
+                           unsigned *allowed) const {
+    *param_count = 0;
+    *allowed = 0;
+    if(!m_compiled || method < 0 || method >= METHOD_NUMBER) {
+        return NULL;
+    }
+    int r = walk(0, path, path + len, method, params, param_count, allowed);
+    return r >= 0 ? &m_routes[r] : NULL;
+}
+
+// n的边已匹配，p为路径剩余部分；依次尝试字面量、参数、通配子节点，前者匹配不到时回退
+int router::walk(int n, const char *p, const char *end, int method, route_param *params, int *count,
+                 unsigned *allowed) const {
+    const node &nd = m_nodes[n];
+    if(p == end) {
+        if(nd.m_routes >= 0) {
+            int r = m_route_sets[nd.m_routes + method];
+            if(r >= 0) {
+                return r;
+            }
+            *allowed |= methods_of(nd);
+        }
+    } else if(nd.m_child_count > 0) {
+        const char *keys = &m_keys[0];
+        const char *k = (const char *)memchr(keys + nd.m_first_child, *p, nd.m_child_count);
+        if(k) {
+            int c = k - keys;
+            const node &cn = m_nodes[c];
+            if(end - p >= cn.m_label_len && memcmp(p, m_labels.data() + cn.m_label, cn.m_label_len) == 0) {
+                int r = walk(c, p + cn.m_label_len, end, method, params, count, allowed);
+                if(r >= 0) {
+                    return r;
+                }
+            }
+        }
+    }
+    if(nd.m_param >= 0 && p != end && *p != '/') {
+        const char *seg_end = (const char *)memchr(p, '/', end - p);
+        if(!seg_end) {
+            seg_end = end;
+        }
+        route_param &param = params[(*count)++];
+        param.m_name = m_labels.data() + m_nodes[nd.m_param].m_name;
+        param.m_value = p;
+        param.m_len = seg_end - p;
+        int r = walk(nd.m_param, seg_end, end, method, params, count, allowed);
+        if(r >= 0) {
+            return r;
+        }
+        --*count;
+    }
+    if(nd.m_wildcard >= 0) {
+        const node &w = m_nodes[nd.m_wildcard];
+        int r = m_route_sets[w.m_routes + method];
+        if(r >= 0) {
+            route_param &param = params[(*count)++];
+            param.m_name = m_labels.data() + w.m_name;
+            param.m_value = p;
+            param.m_len = end - p;
+            return r;
+        }
+        *allowed |= methods_of(w);
+    }
+    return -1;
+}
@@ -0,0 +1,146 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// 路径参数，值指向请求的url
+struct route_param {
+    const char *m_name;
+    const char *m_value;
+    int m_len;
+};
+
+// 处理函数看到的请求，指针都指向连接的缓冲区，只在调用期间有效
+struct http_request {
+    int m_method;                       // http_conn::METHOD
+    const char *m_path;                 // 不含查询串，不以'\0'结尾
+    int m_path_len;
+    const char *m_query;                // ?之后的部分，没有时为NULL
+    const char *m_host;                 // 没有Host时为NULL
+    const char *m_body;                 // 注册时max_body大于0才收集请求体
+    size_t m_body_len;
+    const route_param *m_params;
+    int m_param_count;
+
+    // 按名字取路径参数，没有时返回NULL
+    const char *param(const char *name, int *len) const;
+};
+
+// 处理函数生成的响应，默认200、text/plain；响应体从内存池借用，最大buffer_pool::MAX_SIZE
+class http_response {
+public:
+    http_response();
+    ~http_response();
+
+    void set_status(int status) { m_status = status; }
+    void set_content_type(const char *type) { m_content_type = type; }     // 须为字符串常量
+    bool append(const char *data, size_t len);
+    bool append(const char *str);
+    bool append_uint(unsigned long long v);
+    // 直接写入响应体：reserve给出至少size字节的空间，写完后用commit提交实际长度
+    char *reserve(size_t size, size_t *avail);
+    void commit(size_t len) { m_len += len; }
+
+    int status() const { return m_status; }
+    const char *content_type() const { return m_content_type; }
+    bool failed() const { return m_failed; }
+    // 取走响应体的所有权，size为缓冲区实际大小，用buffer_pool::free归还
+    char *detach(size_t *size, int *len);
+
+private:
+    bool grow(size_t need);
+
+    char *m_buf;
+    size_t m_size;
+    size_t m_len;
+    int m_status;
+    const char *m_content_type;
+    bool m_failed;                      // 响应体超过上限
+};
+
+// 处理函数，ctx为注册时给出的参数
+typedef void (*route_handler)(const http_request &req, http_response &resp, void *ctx);
+
+struct route {
+    route_handler m_handler;
+    void *m_ctx;
+    int m_flags;
+    size_t m_max_body;                  // 0表示丢弃请求体
+};
+
+// 路由表：方法加路径模式映射到处理函数，没有匹配的请求按静态文件处理。
+// 启动时注册，compile后变为只读的压缩前缀树（radix trie），节点、边上的字符串和路由都放在连续的数组中，
+// 查找时按首字节在子节点中选边，只比较一条路径，耗时与路径长度有关，与路由数无关
+class router {
+public:
+    static const int METHOD_NUMBER = 8;
+    static const int MAX_PARAMS = 8;
+
+    enum FLAG {
+        ROUTE_INLINE = 1        // 不阻塞、只用内存数据的处理函数，可以在反应堆线程中直接调用
+    };
+
+    static router *get_instance();
+
+    // 路径模式：/users 按字面匹配；/users/:id 的:id匹配一个非空的路径段；
+    // 末尾的/static/*rest 匹配剩余的全部路径（可为空）。同一位置字面量优先于参数，参数优先于通配。
+    // 模式格式错误、参数名冲突或重复注册时返回false。只能在compile之前调用
+    bool add(int method, const char *pattern, route_handler handler, void *ctx, int flags = 0,
+             size_t max_body = 0);
+    void compile();             // 注册完后调用一次，之后可在多个线程中并发查找
+
+    // 查找path（长度len，不含查询串），返回匹配的路由，参数写入params；
+    // 没有匹配时返回NULL，*allowed为路径匹配但方法不匹配时可用方法的位掩码，路径不匹配时为0
+    const route *match(int method, const char *path, int len, route_param *params, int *param_count,
+                       unsigned *allowed) const;
+
+    size_t route_count() const { return m_routes.size(); }
+    size_t node_count() const { return m_nodes.size(); }
+
+private:
+    router() : m_compiled(false) {}
+    ~router();
+
+    // 注册期间使用的树
+    struct build_node {
+        std::string m_label;                    // 边上的字面量
+        std::vector<build_node *> m_children;   // 字面量子节点，首字节各不相同
+        build_node *m_param;                    // :name子节点
+        build_node *m_wildcard;                 // *name子节点，只能是叶子
+        std::string m_param_name;
+        int m_routes[METHOD_NUMBER];            // 各方法的路由下标，-1表示没有
+
+        build_node();
+        ~build_node();
+    };
+
+    // 编译后的节点，子节点连续存放，m_keys中是它们的首字节
+    struct node {
+        int m_label;                // 边上字面量在m_labels中的位置
+        int m_label_len;
+        int m_first_child;          // 第一个字面量子节点的下标
+        int m_child_count;
+        int m_param;                // 参数子节点，-1表示没有
+        int m_wildcard;             // 通配子节点，-1表示没有
+        int m_name;                 // 参数名在m_labels中的位置，以'\0'结尾
+        int m_routes;               // 在m_route_sets中的位置，-1表示该节点没有路由
+    };
+
+    bool insert(build_node *n, const char *p, int method, int route_index);
+    void flatten_into(int index, build_node *b);    // 把b及其子树编译到m_nodes[index]起的位置
+    unsigned methods_of(const node &n) const;       // 节点上有路由的方法的位掩码
+    int walk(int n, const char *p, const char *end, int method, route_param *params, int *count,
+             unsigned *allowed) const;
+
+    bool m_compiled;
+    build_node m_root;
+    std::vector<route> m_routes;
+    std::vector<node> m_nodes;
+    std::vector<char> m_keys;           // 与m_nodes对应，每个节点作为子节点时的首字节
+    std::string m_labels;
+    std::vector<int> m_route_sets;      // 每个有路由的节点METHOD_NUMBER个路由下标
+};
+
+#endif // ROUTER_H
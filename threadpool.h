@@ -3,28 +3,113 @@
 
 #include <pthread.h>
 #include <list>
+#include <vector>
+#include <atomic>
+#include <algorithm>
 #include <exception>
 #include <cstdio>
 #include "locker.h"
+#include "mpmc_ring.h"
+#include "ws_deque.h"
+#include "topology.h"
 
-// 线程池类，定义成模板以实现代码复用，模板参数T是任务类
-template<typename T>
-class  threadpool{
+// 请求队列的调度统计，用于调优
+struct queue_stats {
+    unsigned long long m_steals;            // 成功窃取的请求数
+    unsigned long long m_steal_failures;    // 窃取时遇到空队列或竞争失败的次数
+    unsigned long long m_parks;             // 工作线程自旋后仍无请求而休眠的次数
+};
+
+// 空闲工作线程的登记与唤醒：工作线程先登记再复查队列，生产者发布请求后只在
+// 存在登记线程时才post信号量，两侧之间的seq_cst顺序保证不会丢失唤醒
+class idle_waiters {
 public:
-    threadpool(int thread_number = 8, int max_requests = 10000);
-    ~threadpool();
-    bool append(T *request);
-    void run();
+    idle_waiters() : m_idle(0), m_parks(0) {}
+
+    // 生产者发布请求后调用
+    void notify_one() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int idle = m_idle.load(std::memory_order_relaxed);
+        while(idle > 0) {
+            // 认领一个休眠线程再唤醒它，避免多个生产者重复post
+            if(m_idle.compare_exchange_weak(idle, idle - 1)) {
+                m_sem.post();
+                break;
+            }
+        }
+    }
+
+    // 登记为休眠线程，之后调用者必须复查队列
+    void prepare_wait() {
+        m_idle.fetch_add(1);
+    }
+
+    // 复查时取到了请求，撤销登记；若已被生产者认领，多出的一次post只会造成一次空唤醒
+    void cancel_wait() {
+        int idle = m_idle.load(std::memory_order_relaxed);
+        while(idle > 0 && !m_idle.compare_exchange_weak(idle, idle - 1)) {
+        }
+    }
+
+    void wait() {
+        m_parks.fetch_add(1, std::memory_order_relaxed);
+        m_sem.wait();
+    }
+
+    unsigned long long parks() const { return m_parks.load(std::memory_order_relaxed); }
 
 private:
-    static void* worker(void *arg);
-private:
-    // 线程数量
-    int m_thread_number;
+    alignas(CACHELINE_SIZE) std::atomic<int> m_idle;       // 休眠中的工作线程数量
+    std::atomic<unsigned long long> m_parks;
+    sem m_sem;
+};
 
-    // 线程池数组，大小为 m_thread_number
-    pthread_t *m_threads;
+// 链表+互斥锁的请求队列：每次入队一次堆分配、一次加解锁和一次信号量post
+template<typename T>
+class list_queue {
+public:
+    list_queue(int thread_number, int max_requests) : m_max_requests(max_requests) {}
+
+    // 队列中已有max_requests个请求时拒绝入队
+    bool push(T *request) {
+        m_queuelocker.lock();
+        if((int)m_workqueue.size() >= m_max_requests) {
+            m_queuelocker.unlock();
+            return false;
+        }
+        m_workqueue.push_back(request);
+        m_queuelocker.unlock();
+        m_queuestat.post();
+        return true;
+    }
+
+    // 阻塞直到取到请求，返回NULL表示被唤醒但队列为空
+    T *pop(int worker) {
+        m_queuestat.wait();
+        m_queuelocker.lock();
+        if(m_workqueue.empty()) {
+            m_queuelocker.unlock();
+            return NULL;
+        }
+        T *request = m_workqueue.front();
+        m_workqueue.pop_front();
+        m_queuelocker.unlock();
+        return request;
+    }
+
+    int size() {
+        m_queuelocker.lock();
+        int size = m_workqueue.size();
+        m_queuelocker.unlock();
+        return size;
+    }
 
+    queue_stats stats() {
+        queue_stats st = {0, 0, 0};
+        return st;
+    }
+
+private:
     // 请求队列中最多允许的等待请求的数量
     int m_max_requests;
 
@@ -36,19 +121,317 @@ private:
 
     // 信号量用来判断是否有任务需要处理
     sem m_queuestat;
+};
+
+// 基于有界无锁环形队列的请求队列：入队出队无锁、无堆分配，
+// 空闲的工作线程先自旋一段时间，仍取不到请求才在信号量上休眠，
+// 只有存在休眠线程时生产者才会post信号量
+template<typename T>
+class ring_queue {
+public:
+    static const int SPIN_COUNT = 256;      // 休眠前的自旋次数
+
+    ring_queue(int thread_number, int max_requests) : m_ring(max_requests) {}
+
+    // 队列中已有max_requests个请求时拒绝入队
+    bool push(T *request) {
+        if(!m_ring.try_push(request)) {
+            return false;
+        }
+        m_waiters.notify_one();
+        return true;
+    }
+
+    // 阻塞直到取到请求，返回NULL表示被唤醒但请求已被其他线程取走
+    T *pop(int worker) {
+        T *request;
+        for(int i=0; i<SPIN_COUNT; ++i) {
+            if(m_ring.try_pop(request)) {
+                return request;
+            }
+            cpu_relax();
+        }
+
+        // 先登记为休眠线程，再复查一次队列
+        m_waiters.prepare_wait();
+        if(m_ring.try_pop(request)) {
+            m_waiters.cancel_wait();
+            return request;
+        }
+        m_waiters.wait();
+        return NULL;
+    }
+
+    int size() {
+        return m_ring.size();
+    }
+
+    queue_stats stats() {
+        queue_stats st = {0, 0, m_waiters.parks()};
+        return st;
+    }
+
+private:
+    mpmc_ring<T*> m_ring;
+    idle_waiters m_waiters;
+};
+
+// 工作窃取请求队列：每个工作线程有一个收件箱（无锁环形队列，反应堆投递请求）和一个
+// Chase-Lev双端队列。工作线程从收件箱批量搬运请求到自己的双端队列并从底部处理，
+// 空闲时从其他工作线程的双端队列顶部或收件箱窃取，避免所有线程争用同一个队头
+template<typename T>
+class steal_queue {
+public:
+    static const int SPIN_COUNT = 64;       // 休眠前的自旋轮数，每轮尝试本地队列和窃取
+    static const int REFILL_BATCH = 32;     // 每次从收件箱搬运的最大请求数
+    static const int MAX_SUBMITTERS = 64;   // 分别记录轮转位置的提交线程数，更多的线程共用位置
+
+    steal_queue(int thread_number, int max_requests);
+    ~steal_queue();
+
+    // 投递给调用线程轮转选中的工作线程，其收件箱满时依次尝试下一个
+    bool push(T *request);
+    T *pop(int worker);
+    int size();
+    queue_stats stats();
+
+private:
+    steal_queue(const steal_queue &);
+    steal_queue &operator=(const steal_queue &);
+
+    struct alignas(CACHELINE_SIZE) worker_slot {
+        mpmc_ring<T*> *m_inbox;
+        ws_deque<T*> *m_deque;
+        unsigned m_seed;                                // 选择窃取对象的随机数种子
+        std::atomic<unsigned long long> m_steals;
+        std::atomic<unsigned long long> m_steal_failures;
+    };
+
+    // 一个提交线程在本队列中的轮转位置
+    struct alignas(CACHELINE_SIZE) submit_cursor {
+        std::atomic<unsigned> m_next;
+    };
+
+    // 调用线程的编号，首次调用时分配
+    static int submitter_id() {
+        static std::atomic<int> next_id(0);
+        static thread_local int id = next_id.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+
+    bool take_local(worker_slot &self, T *&request);    // 从自己的双端队列或收件箱取请求
+    bool steal(int worker, T *&request);                // 从其他工作线程窃取
+
+    int m_thread_number;
+    worker_slot *m_slots;
+    submit_cursor m_cursors[MAX_SUBMITTERS];            // 按提交线程编号取模
+    idle_waiters m_waiters;
+};
+
+template<typename T>
+steal_queue<T>::steal_queue(int thread_number, int max_requests) :
+    m_thread_number(thread_number > 0 ? thread_number : 1), m_slots(NULL) {
+    // 各提交线程从不同的工作线程开始轮转
+    for(int i=0; i<MAX_SUBMITTERS; ++i) {
+        m_cursors[i].m_next.store(i, std::memory_order_relaxed);
+    }
+    // 总容量max_requests平均分给各工作线程的收件箱，余数分给前几个，每个至少1
+    int per_worker = max_requests / m_thread_number;
+    int remainder = max_requests % m_thread_number;
+    m_slots = new worker_slot[m_thread_number];
+    for(int i=0; i<m_thread_number; ++i) {
+        int share = per_worker + (i < remainder ? 1 : 0);
+        m_slots[i].m_inbox = new mpmc_ring<T*>(share > 0 ? share : 1);
+        m_slots[i].m_deque = new ws_deque<T*>(REFILL_BATCH);
+        m_slots[i].m_seed = 2654435761u * (i + 1);
+        m_slots[i].m_steals = 0;
+        m_slots[i].m_steal_failures = 0;
+    }
+}
+
+template<typename T>
+steal_queue<T>::~steal_queue() {
+    for(int i=0; i<m_thread_number; ++i) {
+        delete m_slots[i].m_inbox;
+        delete m_slots[i].m_deque;
+    }
+    delete[] m_slots;
+}
+
+template<typename T>
+bool steal_queue<T>::push(T *request) {
+    // 每个提交线程（反应堆）在每个队列中各有一个轮转位置，不共享计数器
+    std::atomic<unsigned> &cursor = m_cursors[submitter_id() % MAX_SUBMITTERS].m_next;
+    unsigned next = cursor.load(std::memory_order_relaxed);
+    for(int i=0; i<m_thread_number; ++i) {
+        unsigned idx = next++ % m_thread_number;
+        if(m_slots[idx].m_inbox->try_push(request)) {
+            cursor.store(next, std::memory_order_relaxed);
+            m_waiters.notify_one();
+            return true;
+        }
+    }
+    cursor.store(next, std::memory_order_relaxed);
+    return false;
+}
+
+template<typename T>
+bool steal_queue<T>::take_local(worker_slot &self, T *&request) {
+    if(self.m_deque->pop(request)) {
+        return true;
+    }
+    // 双端队列为空，从收件箱批量搬运，第一个直接返回
+    if(!self.m_inbox->try_pop(request)) {
+        return false;
+    }
+    T *more;
+    for(int i=1; i<REFILL_BATCH && self.m_inbox->try_pop(more); ++i) {
+        if(!self.m_deque->push(more)) {
+            // 不会发生：双端队列此时为空且容量为REFILL_BATCH，放回收件箱兜底
+            while(!self.m_inbox->try_push(more)) {
+                cpu_relax();
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+template<typename T>
+bool steal_queue<T>::steal(int worker, T *&request) {
+    worker_slot &self = m_slots[worker];
+    self.m_seed = self.m_seed * 1103515245u + 12345u;
+    int start = (self.m_seed >> 16) % m_thread_number;
+    for(int i=0; i<m_thread_number; ++i) {
+        int victim = (start + i) % m_thread_number;
+        if(victim == worker) {
+            continue;
+        }
+        worker_slot &v = m_slots[victim];
+        typename ws_deque<T*>::steal_result ret = v.m_deque->steal(request);
+        if(ret == ws_deque<T*>::STEAL_ABORT) {
+            ret = v.m_deque->steal(request);
+        }
+        if(ret == ws_deque<T*>::STEAL_OK || v.m_inbox->try_pop(request)) {
+            self.m_steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    self.m_steal_failures.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+template<typename T>
+T *steal_queue<T>::pop(int worker) {
+    worker_slot &self = m_slots[worker];
+    T *request;
+    for(int i=0; i<SPIN_COUNT; ++i) {
+        if(take_local(self, request) || steal(worker, request)) {
+            return request;
+        }
+        cpu_relax();
+    }
+
+    // 先登记为休眠线程，再复查一次所有队列
+    m_waiters.prepare_wait();
+    if(take_local(self, request) || steal(worker, request)) {
+        m_waiters.cancel_wait();
+        return request;
+    }
+    m_waiters.wait();
+    return NULL;
+}
+
+template<typename T>
+int steal_queue<T>::size() {
+    size_t size = 0;
+    for(int i=0; i<m_thread_number; ++i) {
+        size += m_slots[i].m_inbox->size() + m_slots[i].m_deque->size();
+    }
+    return (int)size;
+}
+
+template<typename T>
+queue_stats steal_queue<T>::stats() {
+    queue_stats st = {0, 0, m_waiters.parks()};
+    for(int i=0; i<m_thread_number; ++i) {
+        st.m_steals += m_slots[i].m_steals.load(std::memory_order_relaxed);
+        st.m_steal_failures += m_slots[i].m_steal_failures.load(std::memory_order_relaxed);
+    }
+    return st;
+}
+
+// 线程池类，定义成模板以实现代码复用，模板参数T是任务类，Queue是请求队列的实现。
+// 给出cpus时第i个工作线程绑定到cpus[i]；这些CPU分属多个NUMA节点时每个节点一个请求队列，
+// 请求进入提交线程所在节点的队列，只由该节点的工作线程处理，没有工作线程的节点借用其他节点的队列
+template<typename T, typename Queue = list_queue<T> >
+class  threadpool{
+public:
+    threadpool(int thread_number = 8, int max_requests = 10000, const std::vector<int> &cpus = std::vector<int>());
+    ~threadpool();
+    bool append(T *request);            // 请求队列满时返回false
+    int queue_size();
+    queue_stats stats();
+
+private:
+    static void* worker(void *arg);
+    void run(int worker);
+private:
+    // 线程数量
+    int m_thread_number;
+
+    // 下一个启动的工作线程的编号
+    std::atomic<int> m_next_worker;
+
+    // 线程池数组，大小为 m_thread_number
+    pthread_t *m_threads;
+
+    // 各工作线程绑定的CPU，为空时不绑定
+    std::vector<int> m_cpus;
+
+    // 请求队列，每个有工作线程的节点一个，共最多容纳max_requests个等待处理的请求
+    std::vector<Queue *> m_queues;
+    int m_node_queue[cpu_topology::MAX_NODES];  // 各节点使用的队列
+    std::vector<int> m_worker_queue;            // 各工作线程所属的队列
+    std::vector<int> m_worker_index;            // 工作线程在所属队列中的编号
 
     // 是否结束线程
     bool m_stop;
 };
 
-template<typename T>
-threadpool<T>::threadpool(int thread_number, int max_requests) : 
-    m_thread_number(thread_number), m_max_requests(max_requests), m_workqueue(), 
-    m_queuelocker(), m_queuestat(), m_stop(false) {
-    if(thread_number <= 0 || max_requests <= 0) {
+template<typename T, typename Queue>
+threadpool<T, Queue>::threadpool(int thread_number, int max_requests, const std::vector<int> &cpus) :
+    m_thread_number(thread_number), m_next_worker(0), m_cpus(cpus), m_stop(false) {
+    if(thread_number <= 0 || max_requests <= 0 || (!cpus.empty() && (int)cpus.size() != thread_number)) {
         throw std::exception();
     }
 
+    // 按工作线程所在的节点分组，未绑定CPU时都在一个队列中
+    cpu_topology *topo = cpu_topology::get_instance();
+    std::vector<int> nodes;
+    std::vector<int> node_threads;
+    for(int i=0; i<thread_number; ++i) {
+        int node = cpus.empty() ? 0 : topo->node_of(cpus[i]);
+        size_t q = std::find(nodes.begin(), nodes.end(), node) - nodes.begin();
+        if(q == nodes.size()) {
+            nodes.push_back(node);
+            node_threads.push_back(0);
+        }
+        m_worker_queue.push_back(q);
+        m_worker_index.push_back(node_threads[q]++);
+    }
+    // 总容量max_requests平均分给各节点的队列，余数分给前几个，每个至少1
+    int per_node = max_requests / (int)nodes.size();
+    int remainder = max_requests % (int)nodes.size();
+    for(size_t q=0; q<nodes.size(); ++q) {
+        int share = per_node + ((int)q < remainder ? 1 : 0);
+        m_queues.push_back(new Queue(node_threads[q], share > 0 ? share : 1));
+    }
+    for(int node=0; node<cpu_topology::MAX_NODES; ++node) {
+        size_t q = std::find(nodes.begin(), nodes.end(), node) - nodes.begin();
+        m_node_queue[node] = q < nodes.size() ? q : node % nodes.size();
+    }
+
     m_threads = new pthread_t[m_thread_number];
     if(!m_threads) {
         throw std::exception();
@@ -69,47 +452,54 @@ threadpool<T>::threadpool(int thread_number, int max_requests) :
     }
 }
 
-template<typename T>
-threadpool<T>::~threadpool() {
+template<typename T, typename Queue>
+threadpool<T, Queue>::~threadpool() {
     delete[] m_threads;
     m_stop = true;
 }
 
-template<typename T>
-bool threadpool<T>::append(T *request) {
-    m_queuelocker.lock();
-    if(m_workqueue.size() > m_max_requests) {
-        m_queuelocker.unlock();
-        return false;
+template<typename T, typename Queue>
+bool threadpool<T, Queue>::append(T *request) {
+    return m_queues[m_node_queue[cpu_topology::current_node()]]->push(request);
+}
+
+template<typename T, typename Queue>
+int threadpool<T, Queue>::queue_size() {
+    int size = 0;
+    for(size_t q=0; q<m_queues.size(); ++q) {
+        size += m_queues[q]->size();
     }
+    return size;
+}
 
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post();
-    return true;
+template<typename T, typename Queue>
+queue_stats threadpool<T, Queue>::stats() {
+    queue_stats st = {0, 0, 0};
+    for(size_t q=0; q<m_queues.size(); ++q) {
+        queue_stats s = m_queues[q]->stats();
+        st.m_steals += s.m_steals;
+        st.m_steal_failures += s.m_steal_failures;
+        st.m_parks += s.m_parks;
+    }
+    return st;
 }
 
-template<typename T>
-void *threadpool<T>::worker(void *arg) {
+template<typename T, typename Queue>
+void *threadpool<T, Queue>::worker(void *arg) {
     threadpool *pool = (threadpool *)arg;
-    pool->run();
+    pool->run(pool->m_next_worker.fetch_add(1));
     return pool;
 }
 
-template<typename T>
-void threadpool<T>::run() {
+template<typename T, typename Queue>
+void threadpool<T, Queue>::run(int worker) {
+    if(!m_cpus.empty() && !cpu_topology::get_instance()->pin_current_thread(m_cpus[worker])) {
+        printf("worker %d: bind to cpu %d failure\n", worker, m_cpus[worker]);
+    }
+    Queue *queue = m_queues[m_worker_queue[worker]];
+    int index = m_worker_index[worker];
     while(!m_stop) {
-        m_queuestat.wait();
-        m_queuelocker.lock();
-        if(m_workqueue.empty()) {
-            m_queuelocker.unlock();
-            continue;
-        }
-
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
-
+        T* request = queue->pop(index);
         if(!request) {
             continue;
         }
@@ -0,0 +1,154 @@
+#include <string.h>
+
+#include "timer_wheel.h"
+
+timer_wheel::timer_wheel(int tick_ms, unsigned long long now_ms) :
+    m_tick_ms(tick_ms > 0 ? tick_ms : 1), m_count(0), m_level1_count(0) {
+    m_current = now_ms / m_tick_ms;
+    memset(m_level0, 0, sizeof(m_level0));
+    memset(m_level1, 0, sizeof(m_level1));
+    memset(m_bitmap, 0, sizeof(m_bitmap));
+}
+
+void timer_wheel::add(timer_node *node, int timeout_ms) {
+    remove(node);
+    unsigned long long ticks = (timeout_ms + m_tick_ms - 1) / m_tick_ms;
+    if(ticks == 0) {
+        ticks = 1;
+    }
+    if(ticks > MAX_TICKS) {
+        ticks = MAX_TICKS;
+    }
+    node->m_expire = m_current + ticks;
+    link(node);
+    ++m_count;
+}
+
+// 根据到期tick与当前tick的距离放入对应级别的槽
+void timer_wheel::link(timer_node *node) {
+    slot *s;
+    if(node->m_expire - m_current < (unsigned long long)LEVEL0_SIZE) {
+        int idx = node->m_expire & (LEVEL0_SIZE - 1);
+        s = &m_level0[idx];
+        m_bitmap[idx >> 6] |= 1ull << (idx & 63);
+        node->m_level1 = false;
+    } else {
+        s = &m_level1[(node->m_expire >> LEVEL0_BITS) & (LEVEL1_SIZE - 1)];
+        ++m_level1_count;
+        node->m_level1 = true;
+    }
+    node->m_prev = 0;
+    node->m_next = s->m_head;
+    if(s->m_head) {
+        s->m_head->m_prev = node;
+    }
+    s->m_head = node;
+    node->m_armed = true;
+}
+
+void timer_wheel::remove(timer_node *node) {
+    if(!node->m_armed) {
+        return;
+    }
+    bool level0 = !node->m_level1;
+    slot *s;
+    int idx = 0;
+    if(level0) {
+        idx = node->m_expire & (LEVEL0_SIZE - 1);
+        s = &m_level0[idx];
+    } else {
+        s = &m_level1[(node->m_expire >> LEVEL0_BITS) & (LEVEL1_SIZE - 1)];
+        --m_level1_count;
+    }
+    if(node->m_prev) {
+        node->m_prev->m_next = node->m_next;
+    } else {
+        s->m_head = node->m_next;
+    }
+    if(node->m_next) {
+        node->m_next->m_prev = node->m_prev;
+    }
+    if(level0 && !s->m_head) {
+        m_bitmap[idx >> 6] &= ~(1ull << (idx & 63));
+    }
+    node->m_prev = node->m_next = 0;
+    node->m_armed = false;
+    --m_count;
+}
+
+// 第一级转完一圈，把第二级当前槽中的定时器迁移到第一级
+void timer_wheel::cascade() {
+    slot *s = &m_level1[(m_current >> LEVEL0_BITS) & (LEVEL1_SIZE - 1)];
+    timer_node *node = s->m_head;
+    s->m_head = 0;
+    while(node) {
+        timer_node *next = node->m_next;
+        --m_level1_count;
+        link(node);
+        node = next;
+    }
+}
+
+timer_node *timer_wheel::advance(unsigned long long now_ms) {
+    unsigned long long target = now_ms / m_tick_ms;
+    timer_node *expired = 0;
+    if(m_count == 0) {
+        // 没有定时器时直接跳到当前时间
+        if(target > m_current) {
+            m_current = target;
+        }
+        return 0;
+    }
+    while(m_current < target) {
+        ++m_current;
+        int idx = m_current & (LEVEL0_SIZE - 1);
+        if(idx == 0 && m_level1_count > 0) {
+            cascade();
+        }
+        timer_node *node = m_level0[idx].m_head;
+        if(!node) {
+            continue;
+        }
+        m_level0[idx].m_head = 0;
+        m_bitmap[idx >> 6] &= ~(1ull << (idx & 63));
+        while(node) {
+            timer_node *next = node->m_next;
+            node->m_prev = 0;
+            node->m_armed = false;
+            node->m_next = expired;
+            expired = node;
+            --m_count;
+            node = next;
+        }
+    }
+    return expired;
+}
+
+int timer_wheel::next_timeout(unsigned long long now_ms) const {
+    if(m_count == 0) {
+        return -1;
+    }
+    // 在第一级位图中从当前槽之后查找第一个非空槽，找不到则等到下一次迁移
+    unsigned long long ticks = LEVEL0_SIZE - (m_current & (LEVEL0_SIZE - 1));
+    int start = (m_current + 1) & (LEVEL0_SIZE - 1);
+    // 起始字要查两次：先查起点之后的位，绕一圈后再查起点之前的位
+    for(int i=0; i<=LEVEL0_SIZE / 64; ++i) {
+        int word = ((start >> 6) + i) % (LEVEL0_SIZE / 64);
+        unsigned long long bits = m_bitmap[word];
+        if(i == 0) {
+            bits &= ~0ull << (start & 63);
+        } else if(i == LEVEL0_SIZE / 64) {
+            bits &= ~(~0ull << (start & 63));
+        }
+        if(bits) {
+            int idx = (word << 6) + __builtin_ctzll(bits);
+            ticks = (idx - start + LEVEL0_SIZE) % LEVEL0_SIZE + 1;
+            break;
+        }
+    }
+    if(ticks > LEVEL0_SIZE - (m_current & (LEVEL0_SIZE - 1)) && m_level1_count > 0) {
+        ticks = LEVEL0_SIZE - (m_current & (LEVEL0_SIZE - 1));
+    }
+    long long ms = (long long)(m_current + ticks) * m_tick_ms - (long long)now_ms;
+    return ms > 0 ? (int)ms : 0;
+}
@@ -0,0 +1,57 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+// 定时器节点，嵌入到拥有者对象中，挂入/摘除时不分配内存
+struct timer_node {
+    timer_node *m_prev;
+    timer_node *m_next;
+    unsigned long long m_expire;    // 到期的tick
+    void *m_data;                   // 拥有者对象
+    bool m_armed;
+    bool m_level1;                  // 是否位于第二级
+
+    timer_node() : m_prev(0), m_next(0), m_expire(0), m_data(0), m_armed(false), m_level1(false) {}
+};
+
+// 两级分层时间轮，只由一个线程（所属反应堆）使用，不加锁
+// 第一级256个槽、每槽1个tick；第二级64个槽、每槽256个tick，
+// 第一级转完一圈时把第二级对应槽中的定时器迁移到第一级。
+// 挂入、摘除都是O(1)，第一级用位图记录非空槽，可以O(1)求出下一个到期时间
+class timer_wheel {
+public:
+    static const int LEVEL0_BITS = 8;
+    static const int LEVEL1_BITS = 6;
+    static const int LEVEL0_SIZE = 1 << LEVEL0_BITS;
+    static const int LEVEL1_SIZE = 1 << LEVEL1_BITS;
+    // 可表示的最长超时，更长的超时按此截断
+    static const unsigned long long MAX_TICKS = (unsigned long long)LEVEL0_SIZE * LEVEL1_SIZE - 1;
+
+    // tick_ms为时间轮的精度，now_ms为当前时间
+    timer_wheel(int tick_ms, unsigned long long now_ms);
+
+    void add(timer_node *node, int timeout_ms);     // 挂入或重新挂入定时器
+    void remove(timer_node *node);                  // 摘除定时器，未挂入时无操作
+    // 推进到now_ms，返回已到期并摘除的定时器链表（以m_next相连）
+    timer_node *advance(unsigned long long now_ms);
+    // 距离下一个需要处理的tick的毫秒数，没有定时器时返回-1，可直接作为epoll_wait的超时
+    int next_timeout(unsigned long long now_ms) const;
+    int size() const { return m_count; }
+
+private:
+    void link(timer_node *node);
+    void cascade();
+
+    struct slot {
+        timer_node *m_head;
+    };
+
+    int m_tick_ms;
+    unsigned long long m_current;                   // 已处理到的tick
+    int m_count;
+    int m_level1_count;
+    slot m_level0[LEVEL0_SIZE];
+    slot m_level1[LEVEL1_SIZE];
+    unsigned long long m_bitmap[LEVEL0_SIZE / 64];  // 第一级非空槽位图
+};
+
+#endif // TIMER_WHEEL_H
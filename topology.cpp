@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <algorithm>
+
+#include "topology.h"
+
+static thread_local int t_node = 0;
+
+// 读取sysfs中的一行，去掉换行
+static bool read_line(const char *path, char *buf, size_t size) {
+    FILE *fp = fopen(path, "r");
+    if(!fp) {
+        return false;
+    }
+    bool ok = fgets(buf, size, fp) != NULL;
+    fclose(fp);
+    if(ok) {
+        buf[strcspn(buf, "\n")] = '\0';
+    }
+    return ok;
+}
+
+cpu_topology *cpu_topology::get_instance() {
+    static cpu_topology instance;
+    return &instance;
+}
+
+bool cpu_topology::init(const char *sysfs) {
+    char path[256];
+    char line[1024];
+    snprintf(path, sizeof(path), "%s/online", sysfs);
+    if(!read_line(path, line, sizeof(line)) || !parse_cpu_list(line, m_cpus) || m_cpus.empty()) {
+        // 读不到时按sysconf给出的CPU数处理
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        m_cpus.clear();
+        for(long i=0; i<(n > 0 ? n : 1); ++i) {
+            m_cpus.push_back(i);
+        }
+    }
+    m_info.assign(m_cpus.back() + 1, cpu_info());
+
+    for(size_t i=0; i<m_cpus.size(); ++i) {
+        int cpu = m_cpus[i];
+        cpu_info &info = m_info[cpu];
+        info.m_node = 0;
+        info.m_sibling = 0;
+
+        // cpuN目录下的nodeM链接指向所属节点
+        snprintf(path, sizeof(path), "%s/cpu%d", sysfs, cpu);
+        DIR *dir = opendir(path);
+        if(dir) {
+            struct dirent *e;
+            while((e = readdir(dir)) != NULL) {
+                int node;
+                char tail;
+                if(sscanf(e->d_name, "node%d%c", &node, &tail) == 1 && node >= 0 && node < MAX_NODES) {
+                    info.m_node = node;
+                    break;
+                }
+            }
+            closedir(dir);
+        }
+
+        snprintf(path, sizeof(path), "%s/cpu%d/topology/thread_siblings_list", sysfs, cpu);
+        std::vector<int> siblings;
+        if(read_line(path, line, sizeof(line)) && parse_cpu_list(line, siblings)) {
+            info.m_sibling = std::find(siblings.begin(), siblings.end(), cpu) - siblings.begin();
+        }
+    }
+
+    m_nodes.clear();
+    for(int i=0; i<MAX_NODES; ++i) {
+        m_node_cpus[i].clear();
+    }
+    for(size_t i=0; i<m_cpus.size(); ++i) {
+        m_node_cpus[m_info[m_cpus[i]].m_node].push_back(m_cpus[i]);
+    }
+    for(int node=0; node<MAX_NODES; ++node) {
+        std::vector<int> &cpus = m_node_cpus[node];
+        if(cpus.empty()) {
+            continue;
+        }
+        m_nodes.push_back(node);
+        // 先排各物理核的第一个超线程，自动分配时线程先占满物理核
+        std::stable_sort(cpus.begin(), cpus.end(), [this](int a, int b) {
+            return m_info[a].m_sibling < m_info[b].m_sibling;
+        });
+    }
+    return true;
+}
+
+int cpu_topology::node_of(int cpu) const {
+    return cpu >= 0 && cpu < (int)m_info.size() ? m_info[cpu].m_node : 0;
+}
+
+bool cpu_topology::plan(const char *spec, int n, const std::vector<int> &exclude, std::vector<int> &cpus) const {
+    cpus.clear();
+    if(strcmp(spec, "auto") != 0) {
+        std::vector<int> list;
+        if(!parse_cpu_list(spec, list) || list.empty()) {
+            return false;
+        }
+        for(size_t i=0; i<list.size(); ++i) {
+            if(!std::binary_search(m_cpus.begin(), m_cpus.end(), list[i])) {
+                return false;
+            }
+        }
+        for(int i=0; i<n; ++i) {
+            cpus.push_back(list[i % list.size()]);
+        }
+        return true;
+    }
+
+    // 每个节点先排不在exclude中的CPU，再排其余的，依次轮流取用
+    std::vector<std::vector<int> > order(m_nodes.size());
+    for(size_t k=0; k<m_nodes.size(); ++k) {
+        const std::vector<int> &node_cpus = m_node_cpus[m_nodes[k]];
+        for(int pass=0; pass<2; ++pass) {
+            for(size_t i=0; i<node_cpus.size(); ++i) {
+                bool excluded = std::find(exclude.begin(), exclude.end(), node_cpus[i]) != exclude.end();
+                if(excluded == (pass == 1)) {
+                    order[k].push_back(node_cpus[i]);
+                }
+            }
+        }
+    }
+    for(int i=0; i<n; ++i) {
+        const std::vector<int> &o = order[i % order.size()];
+        cpus.push_back(o[(i / order.size()) % o.size()]);
+    }
+    return true;
+}
+
+bool cpu_topology::pin_current_thread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        return false;
+    }
+    t_node = node_of(cpu);
+    return true;
+}
+
+int cpu_topology::current_node() {
+    return t_node;
+}
+
+bool cpu_topology::bind_memory(void *addr, size_t len, int node) const {
+    if(!numa() || len == 0) {
+        return true;
+    }
+    // 只处理完整落在范围内的页，不影响相邻的对象
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)addr + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)addr + len) & ~(page - 1);
+    if(end <= start) {
+        return true;
+    }
+    unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    mask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+    return syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, mask, MAX_NODES + 1, MPOL_MF_MOVE) == 0;
+}
+
+bool cpu_topology::parse_cpu_list(const char *s, std::vector<int> &cpus) {
+    cpus.clear();
+    while(*s) {
+        char *end;
+        long first = strtol(s, &end, 10);
+        if(end == s || first < 0) {
+            return false;
+        }
+        long last = first;
+        s = end;
+        if(*s == '-') {
+            last = strtol(s + 1, &end, 10);
+            if(end == s + 1 || last < first) {
+                return false;
+            }
+            s = end;
+        }
+        if(last >= CPU_SETSIZE) {
+            return false;
+        }
+        for(long cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+        if(*s == ',') {
+            ++s;
+        } else if(*s) {
+            return false;
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return true;
+}
+
+std::string cpu_topology::format_cpu_list(const std::vector<int> &cpus) {
+    std::string s;
+    char buf[32];
+    for(size_t i=0; i<cpus.size(); ) {
+        size_t j = i;
+        while(j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            ++j;
+        }
+        if(j == i) {
+            snprintf(buf, sizeof(buf), "%s%d", s.empty() ? "" : ",", cpus[i]);
+        } else {
+            snprintf(buf, sizeof(buf), "%s%d-%d", s.empty() ? "" : ",", cpus[i], cpus[j]);
+        }
+        s += buf;
+        i = j + 1;
+    }
+    return s;
+}
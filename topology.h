@@ -0,0 +1,58 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// CPU拓扑：启动时从/sys/devices/system/cpu读取在线的CPU、所属的NUMA节点和同一物理核上的超线程，
+// 据此为反应堆和工作线程选择CPU。线程绑定CPU后记住自己的节点，内存池、线程池队列按节点划分，
+// 使请求的数据在同一节点内分配和访问。读不到节点信息时所有CPU都属于节点0
+class cpu_topology {
+public:
+    static const int MAX_NODES = 64;        // 节点号不小于该值的CPU按节点0处理
+
+    static cpu_topology *get_instance();
+
+    bool init(const char *sysfs = "/sys/devices/system/cpu");
+
+    int cpu_count() const { return m_cpus.size(); }
+    const std::vector<int> &cpus() const { return m_cpus; }
+    int node_count() const { return m_nodes.size(); }
+    bool numa() const { return m_nodes.size() > 1; }
+    const std::vector<int> &nodes() const { return m_nodes; }
+    const std::vector<int> &cpus_of(int node) const { return m_node_cpus[node]; }
+    int node_of(int cpu) const;
+
+    // 为n个线程各选一个CPU。spec为CPU列表（如"0-3,8"）时依次轮流使用；为"auto"时线程在各节点间轮流，
+    // 节点内先用各物理核的第一个超线程，跳过exclude中的CPU，都用完后再重复使用。
+    // spec格式错误或含有不在线的CPU时返回false
+    bool plan(const char *spec, int n, const std::vector<int> &exclude, std::vector<int> &cpus) const;
+
+    // 把调用线程绑定到cpu，之后current_node返回cpu所在的节点
+    bool pin_current_thread(int cpu);
+    // 调用线程所在的节点，未绑定的线程为节点0
+    static int current_node();
+
+    // 把[addr, addr+len)中完整的页绑定到node，已分配的页迁移过去；单节点时什么也不做
+    bool bind_memory(void *addr, size_t len, int node) const;
+
+    // 解析"0-3,8,10-11"格式的CPU列表
+    static bool parse_cpu_list(const char *s, std::vector<int> &cpus);
+    static std::string format_cpu_list(const std::vector<int> &cpus);
+
+private:
+    cpu_topology() {}
+
+    struct cpu_info {
+        int m_node;
+        int m_sibling;              // 在同一物理核的超线程中的序号，0为第一个
+    };
+
+    std::vector<int> m_cpus;                        // 在线的CPU
+    std::vector<cpu_info> m_info;                   // 按CPU编号索引
+    std::vector<int> m_nodes;                       // 有在线CPU的节点
+    std::vector<int> m_node_cpus[MAX_NODES];        // 各节点的CPU，先各物理核的第一个超线程
+};
+
+#endif // TOPOLOGY_H
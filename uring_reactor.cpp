@@ -0,0 +1,475 @@
+#include "uring_reactor.h"
+
+#ifdef HAVE_IO_URING
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+
+#include "logger.h"
+#include "admission.h"
+#include "metrics.h"
+#include "topology.h"
+
+// user_data的高16位是连接的代数，低48位是连接对象的地址和操作类型
+static const unsigned long long GEN_SHIFT = 48;
+static const unsigned long long PTR_MASK = ((1ull << GEN_SHIFT) - 1) & ~7ull;
+
+uring_reactor::uring_reactor(int id, int port, conn_table *users, int max_users, http_threadpool *pool,
+                             const reactor_options &options) :
+    reactor(id, port, users, max_users, pool, options), m_wakeup_value(0), m_pipe_size(0),
+    m_accept_cancelled(false) {
+}
+
+uring_reactor::~uring_reactor() {
+}
+
+// 多次接收的accept与IORING_OP_SOCKET同在5.19加入，以后者判断
+bool uring_reactor::supported() {
+    io_ring ring;
+    return ring.init(8) && (ring.features() & IORING_FEAT_EXT_ARG) && ring.supports(IORING_OP_SOCKET);
+}
+
+// 队列在这里创建，提供缓冲区的操作也先放进提交队列，到事件循环线程中才启用并提交，之后只有该线程提交
+bool uring_reactor::start() {
+    if(!listen_socket()) {
+        return false;
+    }
+    if(!m_ring.init(RING_ENTRIES) || !m_ring.setup_buffers(BUFFER_GROUP, BUFFER_COUNT, BUFFER_SIZE)) {
+        LOG_ERROR("reactor %d: io_uring setup failed: %s", m_id, strerror(errno));
+        return false;
+    }
+    m_eventfd = eventfd(0, EFD_CLOEXEC);
+    if(m_eventfd < 0) {
+        return false;
+    }
+    return pthread_create(&m_thread, NULL, worker, this) == 0;
+}
+
+unsigned long long uring_reactor::encode(http_conn *conn, int op) {
+    unsigned long long gen = conn ? conn->uring_state()->m_gen.load(std::memory_order_relaxed) & 0xffff : 0;
+    return (gen << GEN_SHIFT) | (uintptr_t)conn | op;
+}
+
+void uring_reactor::drain_posted() {
+    take_posted();
+    for(size_t i=0; i<m_draining.size(); ++i) {
+        http_conn *conn = m_draining[i].m_conn;
+        conn->set_busy(false);
+        if(m_draining[i].m_ev & EPOLLOUT) {
+            start_send(conn);
+        } else {
+            start_recv(conn);
+        }
+    }
+    m_draining.clear();
+}
+
+// 多次接收的accept：一次提交，每个新连接产生一个完成事件，直到出错才需要重新提交
+void uring_reactor::arm_accept() {
+    struct io_uring_sqe *sqe = m_ring.get_sqe();
+    if(!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = encode(NULL, OP_ACCEPT);
+}
+
+// 取消多次接收的accept，已完成的连接仍会照常交付
+void uring_reactor::cancel_accept() {
+    struct io_uring_sqe *sqe = m_ring.get_sqe();
+    if(!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = encode(NULL, OP_ACCEPT);
+    sqe->user_data = encode(NULL, OP_CANCEL);
+    m_accept_cancelled = true;
+}
+
+// accept挂在环上，只能由反应堆线程取消，这里唤醒它
+void uring_reactor::stop_accepting() {
+    m_accept_stopped.store(true, std::memory_order_release);
+    uint64_t one = 1;
+    if(write(m_eventfd, &one, sizeof(one)) < 0) {
+        LOG_ERROR("reactor %d: eventfd write failed: %s", m_id, strerror(errno));
+    }
+}
+
+void uring_reactor::arm_wakeup() {
+    struct io_uring_sqe *sqe = m_ring.get_sqe();
+    if(!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_eventfd;
+    sqe->addr = (unsigned long long)&m_wakeup_value;
+    sqe->len = sizeof(m_wakeup_value);
+    sqe->user_data = encode(NULL, OP_WAKEUP);
+}
+
+// 由内核在数据到达时从缓冲区组中挑一个缓冲区，等待期间连接不占用任何缓冲区
+void uring_reactor::start_recv(http_conn *conn) {
+    struct io_uring_sqe *sqe = m_ring.get_sqe();
+    if(!sqe) {
+        close_conn(conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->sockfd();
+    sqe->len = BUFFER_SIZE;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = encode(conn, OP_RECV);
+}
+
+// 发送剩余的响应：响应头和内存中的响应体一次sendmsg，后面有文件数据时链接splice，
+// 文件数据先进管道再进socket，每轮不超过管道容量；任一操作未完成全部数据时链中后续操作被取消，
+// 所有操作结束后从断点继续
+void uring_reactor::start_send(http_conn *conn) {
+    uring_io *io = conn->uring_state();
+    if(!conn->writing()) {
+        send_done(conn);
+        return;
+    }
+    io->m_failed = false;
+
+    size_t iv_bytes = 0;
+    for(int i=0; i<conn->iv_count(); ++i) {
+        iv_bytes += conn->iv()[i].iov_len;
+    }
+    // 还没有读入管道的文件数据
+    size_t file_left = conn->bytes_to_send() - iv_bytes - io->m_pipe_bytes;
+    if(conn->file_fd() != -1 && io->m_pipe[0] == -1 && !open_pipe(io)) {
+        close_conn(conn);
+        return;
+    }
+    size_t chunk = file_left < (size_t)m_pipe_size ? file_left : m_pipe_size;
+
+    // 先取齐所需的提交项，取不到时已取的保持为空操作
+    struct io_uring_sqe *sqes[3];
+    int count = (conn->iv_count() > 0 ? 1 : 0) + (io->m_pipe_bytes > 0 ? 1 : file_left > 0 ? 2 : 0);
+    for(int i=0; i<count; ++i) {
+        sqes[i] = m_ring.get_sqe();
+        if(!sqes[i]) {
+            close_conn(conn);
+            return;
+        }
+    }
+
+    int n = 0;
+    if(conn->iv_count() > 0) {
+        struct io_uring_sqe *sqe = sqes[n++];
+        memset(&io->m_msg, 0, sizeof(io->m_msg));
+        io->m_msg.msg_iov = conn->iv();
+        io->m_msg.msg_iovlen = conn->iv_count();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn->sockfd();
+        sqe->addr = (unsigned long long)&io->m_msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (file_left > 0 ? MSG_MORE : 0);
+        if(file_left > 0) {
+            sqe->flags = IOSQE_IO_LINK;
+        }
+        sqe->user_data = encode(conn, OP_SEND);
+    }
+    if(io->m_pipe_bytes == 0 && file_left > 0) {
+        // 管道为空，发送偏移就是下一次读文件的偏移
+        struct io_uring_sqe *sqe = sqes[n++];
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->fd = io->m_pipe[1];
+        sqe->off = (unsigned long long)-1;
+        sqe->splice_fd_in = conn->file_fd();
+        sqe->splice_off_in = conn->file_offset();
+        sqe->len = chunk;
+        sqe->splice_flags = SPLICE_F_MOVE;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = encode(conn, OP_SPLICE_IN);
+    } else {
+        chunk = io->m_pipe_bytes;
+    }
+    if(chunk > 0) {
+        struct io_uring_sqe *sqe = sqes[n++];
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->fd = conn->sockfd();
+        sqe->off = (unsigned long long)-1;
+        sqe->splice_fd_in = io->m_pipe[0];
+        sqe->splice_off_in = (unsigned long long)-1;
+        sqe->len = chunk;
+        sqe->splice_flags = SPLICE_F_MOVE;
+        sqe->user_data = encode(conn, OP_SPLICE_OUT);
+    }
+    io->m_inflight += n;
+}
+
+void uring_reactor::send_done(http_conn *conn) {
+    close_pipe(conn->uring_state());
+    bool ok = conn->finish_write();
+    if(!ok) {
+        close_conn(conn);
+    } else if(conn->has_unparsed_input()) {
+        // 读缓冲区中还有流水线请求，不再等待接收
+        arm_timer(conn, http_conn::TIMER_HEADER);
+        handle_request(conn);
+    } else {
+        // 只收到下一个请求的一部分时仍按请求头时限计时
+        arm_timer(conn, conn->has_buffered_input() ? http_conn::TIMER_HEADER : http_conn::TIMER_IDLE);
+        start_recv(conn);
+    }
+}
+
+void uring_reactor::on_accept(int res, unsigned flags) {
+    if(!(flags & IORING_CQE_F_MORE) && !m_accept_stopped.load(std::memory_order_acquire)) {
+        // 多次接收的accept出错后内核不再产生完成事件，需要重新提交
+        arm_accept();
+    }
+    if(res < 0) {
+        return;
+    }
+    int connfd = res;
+    if(connfd >= m_users->size() || m_user_count.load(std::memory_order_relaxed) >= m_max_users) {
+        // 目前连接数已满，回复503后关闭
+        admission::get_instance()->count_rejected();
+        http_conn::send_overloaded(connfd);
+        close(connfd);
+        return;
+    }
+    struct sockaddr_in client_address;
+    socklen_t client_addrlen = sizeof(client_address);
+    memset(&client_address, 0, sizeof(client_address));
+    getpeername(connfd, (struct sockaddr *)&client_address, &client_addrlen);
+
+    http_conn *conn = m_users->get_or_create(connfd);
+    conn->init(connfd, client_address, -1, &m_user_count, this, true);
+    arm_timer(conn, http_conn::TIMER_HEADER);
+    start_recv(conn);
+}
+
+void uring_reactor::on_recv(http_conn *conn, int res, unsigned flags) {
+    if(res == -ENOBUFS) {
+        // 提供缓冲区暂时用完，本轮收割的接收已归还缓冲区，重新提交即可
+        start_recv(conn);
+        return;
+    }
+    if(res <= 0) {
+        // 对方关闭连接或出错
+        close_conn(conn);
+        return;
+    }
+    if(conn->timer_kind() == http_conn::TIMER_IDLE || conn->reading_body()) {
+        // 长连接上开始了新的请求，请求头时限从现在算起；接收请求体期间每次有数据到达都重新计时
+        arm_timer(conn, http_conn::TIMER_HEADER);
+    }
+    int id = flags >> IORING_CQE_BUFFER_SHIFT;
+    unsigned long long begin = metrics::now_ns();
+    bool ok = conn->append_input(m_ring.buffer(id), res);
+    m_ring.recycle_buffer(id);
+    metrics::record(STAGE_READ, metrics::now_ns() - begin);
+    if(ok) {
+        handle_request(conn);
+    } else {
+        close_conn(conn);
+    }
+}
+
+// 内联生成的响应直接提交发送，发送完成后由send_done继续处理后面的请求
+void uring_reactor::handle_request(http_conn *conn) {
+    if(!m_options.m_inline) {
+        submit(conn);
+        return;
+    }
+    int ret = conn->process_inline();
+    if(ret == http_conn::INLINE_ERROR) {
+        close_conn(conn);
+    } else if(ret == http_conn::INLINE_DEFER) {
+        submit(conn);
+    } else if(ret == http_conn::INLINE_WAIT) {
+        start_recv(conn);
+    } else {
+        start_send(conn);
+    }
+}
+
+void uring_reactor::on_send(http_conn *conn, int op, int res) {
+    uring_io *io = conn->uring_state();
+    --io->m_inflight;
+    if(io->m_closing) {
+        if(io->m_inflight == 0) {
+            io->m_closing = false;
+            close_conn(conn);
+        }
+        return;
+    }
+    if(res == -ECANCELED) {
+        // 链中前一个操作没有完成全部数据，本操作未执行
+    } else if(res < 0) {
+        io->m_failed = true;
+    } else if(op == OP_SEND) {
+        conn->sent(res, false);
+    } else if(op == OP_SPLICE_IN) {
+        if(res == 0) {
+            // 文件在发送过程中被截断，无法补齐Content-Length
+            io->m_failed = true;
+        }
+        io->m_pipe_bytes += res;
+    } else {
+        if(res == 0) {
+            io->m_failed = true;
+        }
+        io->m_pipe_bytes -= res;
+        conn->sent(res, true);
+    }
+    if(io->m_inflight > 0) {
+        return;
+    }
+
+    if(io->m_failed) {
+        close_conn(conn);
+    } else if(conn->writing()) {
+        // 有进展就重新计时
+        arm_timer(conn, http_conn::TIMER_WRITE);
+        start_send(conn);
+    } else {
+        send_done(conn);
+    }
+}
+
+bool uring_reactor::open_pipe(uring_io *io) {
+    if(pipe2(io->m_pipe, O_CLOEXEC) < 0) {
+        io->m_pipe[0] = io->m_pipe[1] = -1;
+        return false;
+    }
+    if(m_pipe_size == 0) {
+        // 超过/proc/sys/fs/pipe-max-size时用默认容量
+        fcntl(io->m_pipe[1], F_SETPIPE_SZ, PIPE_SIZE);
+        m_pipe_size = fcntl(io->m_pipe[1], F_GETPIPE_SZ);
+        if(m_pipe_size <= 0) {
+            m_pipe_size = 65536;
+        }
+    } else if(m_pipe_size > 65536) {
+        fcntl(io->m_pipe[1], F_SETPIPE_SZ, m_pipe_size);
+    }
+    io->m_pipe_bytes = 0;
+    return true;
+}
+
+void uring_reactor::close_pipe(uring_io *io) {
+    if(io->m_pipe[0] != -1) {
+        close(io->m_pipe[0]);
+        close(io->m_pipe[1]);
+        io->m_pipe[0] = io->m_pipe[1] = -1;
+    }
+    io->m_pipe_bytes = 0;
+}
+
+// 先shutdown让仍在等待的接收、发送操作立即结束；链接在后面的splice执行时才解析fd，
+// 所以还有发送操作未结束时推迟关闭，避免它们作用到复用了同一fd的新连接上
+void uring_reactor::close_conn(http_conn *conn) {
+    uring_io *io = conn->uring_state();
+    if(conn->sockfd() != -1) {
+        shutdown(conn->sockfd(), SHUT_RDWR);
+    }
+    if(io->m_inflight > 0) {
+        m_timers.remove(conn->timer());
+        io->m_closing = true;
+        return;
+    }
+    io->m_gen.fetch_add(1, std::memory_order_relaxed);
+    close_pipe(io);
+    reactor::close_conn(conn);
+}
+
+void uring_reactor::dispatch(unsigned long long data, int res, unsigned flags) {
+    int op = data & 7;
+    if(op == OP_ACCEPT) {
+        on_accept(res, flags);
+        return;
+    }
+    if(op == OP_WAKEUP) {
+        if(res < 0) {
+            LOG_ERROR("reactor %d: eventfd read failed: %s", m_id, strerror(-res));
+        }
+        arm_wakeup();
+        return;
+    }
+    http_conn *conn = (http_conn *)(uintptr_t)(data & PTR_MASK);
+    if(!conn) {
+        // 取提交项失败时留下的空操作
+        return;
+    }
+    unsigned gen = data >> GEN_SHIFT;
+    if((conn->uring_state()->m_gen.load(std::memory_order_relaxed) & 0xffff) != gen) {
+        // 连接已关闭，fd可能已被新连接复用，只归还缓冲区
+        if(flags & IORING_CQE_F_BUFFER) {
+            m_ring.recycle_buffer(flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+        return;
+    }
+    if(op == OP_RECV) {
+        on_recv(conn, res, flags);
+    } else {
+        on_send(conn, op, res);
+    }
+}
+
+// 提供给内核的接收缓冲区也迁移到所在节点
+void uring_reactor::place() {
+    reactor::place();
+    if(m_options.m_cpu >= 0) {
+        cpu_topology *topo = cpu_topology::get_instance();
+        topo->bind_memory(m_ring.buffer(0), (size_t)BUFFER_COUNT * BUFFER_SIZE, topo->node_of(m_options.m_cpu));
+    }
+}
+
+// 反应堆线程不断循环：提交上一轮准备的操作并等待完成事件，再逐个处理
+void uring_reactor::loop() {
+    if(!m_ring.enable()) {
+        LOG_ERROR("reactor %d: io_uring enable failed: %s", m_id, strerror(errno));
+        return;
+    }
+    arm_accept();
+    arm_wakeup();
+    while(true) {
+        drain_posted();
+        if(!m_accept_cancelled && m_accept_stopped.load(std::memory_order_acquire)) {
+            cancel_accept();
+        }
+        // 等待到下一个定时器到期
+        int timeout = m_timers.next_timeout(m_now);
+        int ret = m_ring.submit_and_wait(1, timeout);
+        if(ret < 0 && ret != -EINTR && ret != -ETIME && ret != -EAGAIN && ret != -EBUSY) {
+            LOG_ERROR("reactor %d: io_uring_enter failure: %s", m_id, strerror(-ret));
+            break;
+        }
+        unsigned long long loop_begin = metrics::now_ns();
+        // 先推进时间轮，之后挂入的定时器都以当前时间为起点
+        m_now = now_ms();
+        expire_timers();
+
+        int num = 0;
+        struct io_uring_cqe *cqe;
+        while((cqe = m_ring.peek_cqe()) != NULL) {
+            unsigned long long data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            m_ring.cqe_seen();
+            dispatch(data, res, flags);
+            ++num;
+        }
+        if(num > 0) {
+            metrics::record(STAGE_EVENT_LOOP, metrics::now_ns() - loop_begin);
+        }
+    }
+}
+
+#endif // HAVE_IO_URING
@@ -0,0 +1,75 @@
+#ifndef URING_REACTOR_H
+#define URING_REACTOR_H
+
+#include "io_ring.h"
+
+#ifdef HAVE_IO_URING
+
+#include "reactor.h"
+
+// io_uring反应堆：与epoll反应堆共用监听socket、连接表、时间轮和线程池，只把等待就绪再读写换成
+// 直接提交操作、收割完成事件。监听socket上挂一个多次接收的accept；连接空闲时挂一个从提供缓冲区环
+// 取缓冲区的recv，收到数据后复制进连接的读缓冲区，缓冲区立即归还；响应头和内存中的响应体用sendmsg
+// 发送，大文件的响应体用链接在其后的两个splice（文件到管道、管道到socket）发送。
+// 每轮循环只调用一次io_uring_enter，同时完成提交和等待
+class uring_reactor : public reactor {
+public:
+    uring_reactor(int id, int port, conn_table *users, int max_users, http_threadpool *pool,
+                  const reactor_options &options);
+    ~uring_reactor();
+    bool start();
+
+    // 内核是否支持本反应堆用到的功能（提供缓冲区环、多次接收的accept等，5.19起）
+    static bool supported();
+
+    unsigned long long enters() const { return m_ring.enters(); }
+    unsigned long long submitted() const { return m_ring.submitted(); }
+
+private:
+    static const unsigned RING_ENTRIES = 1024;      // 提交队列大小
+    static const unsigned BUFFER_COUNT = 1024;      // 提供缓冲区个数，须为2的幂
+    static const unsigned BUFFER_SIZE = 4096;       // 每个提供缓冲区的大小
+    static const int BUFFER_GROUP = 0;
+    static const int PIPE_SIZE = 1024 * 1024;       // 希望的管道容量，每次splice不超过管道容量
+
+    // 操作类型放在user_data的低3位，连接对象至少8字节对齐
+    enum OP {
+        OP_ACCEPT = 1,
+        OP_WAKEUP,          // 读eventfd，工作线程交还连接时唤醒
+        OP_RECV,
+        OP_SEND,
+        OP_SPLICE_IN,       // 文件到管道
+        OP_SPLICE_OUT,      // 管道到socket
+        OP_CANCEL           // 取消多次接收的accept，完成事件不需要处理
+    };
+
+    void loop();
+    void place();
+    void stop_accepting();
+    void cancel_accept();
+    void close_conn(http_conn *conn);
+    void handle_request(http_conn *conn);
+    static unsigned long long encode(http_conn *conn, int op);
+    void dispatch(unsigned long long data, int res, unsigned flags);
+    void drain_posted();
+    void arm_accept();
+    void arm_wakeup();
+    void start_recv(http_conn *conn);
+    void start_send(http_conn *conn);
+    void on_accept(int res, unsigned flags);
+    void on_recv(http_conn *conn, int res, unsigned flags);
+    void on_send(http_conn *conn, int op, int res);
+    void send_done(http_conn *conn);            // 一批响应发送完
+    bool open_pipe(uring_io *io);
+    void close_pipe(uring_io *io);
+
+private:
+    io_ring m_ring;
+    unsigned long long m_wakeup_value;          // OP_WAKEUP读入的计数
+    int m_pipe_size;                            // 实际的管道容量
+    bool m_accept_cancelled;                    // 已提交取消accept的操作
+};
+
+#endif // HAVE_IO_URING
+
+#endif // URING_REACTOR_H
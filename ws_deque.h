@@ -0,0 +1,116 @@
+#ifndef WS_DEQUE_H
+#define WS_DEQUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+
+#include "mpmc_ring.h"
+
+// Chase-Lev工作窃取双端队列（固定容量）
+// 只有拥有者线程从底部push/pop，其他线程从顶部steal，
+// 拥有者的push/pop在非竞争情况下没有原子读改写操作
+template<typename T>
+class ws_deque {
+public:
+    enum steal_result {
+        STEAL_OK = 0,       // 窃取成功
+        STEAL_EMPTY,        // 队列为空
+        STEAL_ABORT         // 与其他线程竞争失败，可重试
+    };
+
+    // 容量向上取整为2的幂
+    explicit ws_deque(size_t capacity);
+    ~ws_deque();
+
+    bool push(T data);                  // 仅拥有者调用，队列满时返回false
+    bool pop(T &data);                  // 仅拥有者调用，从底部取出最新的元素
+    steal_result steal(T &data);        // 任意线程调用，从顶部取出最旧的元素
+    size_t size() const;                // 近似的元素个数，仅用于统计
+
+private:
+    ws_deque(const ws_deque &);
+    ws_deque &operator=(const ws_deque &);
+
+    std::atomic<T> *m_buffer;
+    int64_t m_mask;
+    alignas(CACHELINE_SIZE) std::atomic<int64_t> m_top;        // 窃取端
+    alignas(CACHELINE_SIZE) std::atomic<int64_t> m_bottom;     // 拥有者端
+};
+
+template<typename T>
+ws_deque<T>::ws_deque(size_t capacity) : m_buffer(NULL), m_mask(0), m_top(0), m_bottom(0) {
+    if(capacity == 0) {
+        throw std::exception();
+    }
+    size_t size = 1;
+    while(size < capacity) {
+        size <<= 1;
+    }
+    m_buffer = new std::atomic<T>[size];
+    m_mask = (int64_t)size - 1;
+}
+
+template<typename T>
+ws_deque<T>::~ws_deque() {
+    delete[] m_buffer;
+}
+
+template<typename T>
+bool ws_deque<T>::push(T data) {
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_acquire);
+    if(b - t > m_mask) {
+        return false;
+    }
+    m_buffer[b & m_mask].store(data, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
+
+template<typename T>
+bool ws_deque<T>::pop(T &data) {
+    int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    if(t > b) {
+        // 队列为空，恢复bottom
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+    data = m_buffer[b & m_mask].load(std::memory_order_relaxed);
+    if(t == b) {
+        // 只剩最后一个元素，与窃取者竞争top
+        bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+template<typename T>
+typename ws_deque<T>::steal_result ws_deque<T>::steal(T &data) {
+    int64_t t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = m_bottom.load(std::memory_order_acquire);
+    if(t >= b) {
+        return STEAL_EMPTY;
+    }
+    data = m_buffer[t & m_mask].load(std::memory_order_relaxed);
+    if(!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return STEAL_ABORT;
+    }
+    return STEAL_OK;
+}
+
+template<typename T>
+size_t ws_deque<T>::size() const {
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    return b > t ? (size_t)(b - t) : 0;
+}
+
+#endif // WS_DEQUE_H